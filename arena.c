@@ -0,0 +1,158 @@
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "logger.h"
+
+/* Smallest chunk taken from the heap */
+#define ARENA_CHUNK_MIN 16384
+/* Every allocation is aligned to this */
+#define ARENA_ALIGN alignof(max_align_t)
+
+struct arena_chunk {
+    struct arena_chunk *prev;
+    size_t used;
+    size_t cap;
+    alignas(ARENA_ALIGN) char data[];
+};
+
+static size_t align_up(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+/**
+ * Takes a new chunk from the heap with room for at least size bytes.
+ */
+static void chunk_add(struct arena *arena, size_t size)
+{
+    size_t cap = size > ARENA_CHUNK_MIN ? size : ARENA_CHUNK_MIN;
+    struct arena_chunk *fresh = malloc(sizeof(struct arena_chunk) + cap);
+    if(fresh == NULL) {
+        perror("arena");
+        exit(EXIT_FAILURE);
+    }
+    fresh->prev = arena->chunk;
+    fresh->used = 0;
+    fresh->cap = cap;
+    arena->chunk = fresh;
+    arena->chunk_allocs += 1;
+    LOG("New arena chunk of %zu bytes\n", cap);
+}
+
+/**
+ * Hands out size bytes of the arena, aligned for any type. The memory stays
+ * valid until the arena is reset.
+ *
+ * @param arena arena to allocate from
+ * @param size number of bytes needed
+ * @return start of the space
+ */
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    size = align_up(size);
+    struct arena_chunk *chunk = arena->chunk;
+    if(chunk == NULL || chunk->cap - chunk->used < size) {
+        chunk_add(arena, size);
+        chunk = arena->chunk;
+    }
+
+    arena->last = chunk->used;
+    chunk->used += size;
+    arena->in_use += size;
+    return chunk->data + arena->last;
+}
+
+/**
+ * Resizes an allocation. Shrinking never moves it, and gives the space back
+ * if it is the latest allocation. The latest allocation also grows in place
+ * as long as its chunk has room, anything else is copied into new space.
+ *
+ * @param arena arena ptr came from
+ * @param ptr space to resize, or NULL for a new allocation
+ * @param old_size size ptr was allocated with
+ * @param new_size size needed from now on
+ * @return start of the space, which may have moved
+ */
+void *arena_grow(struct arena *arena, void *ptr, size_t old_size, size_t new_size)
+{
+    struct arena_chunk *chunk = arena->chunk;
+    if(ptr != NULL && ptr == chunk->data + arena->last
+            && chunk->cap - arena->last >= align_up(new_size)) {
+        size_t size = chunk->used - arena->last;
+        chunk->used = arena->last + align_up(new_size);
+        arena->in_use = arena->in_use - size + align_up(new_size);
+        return ptr;
+    }
+    if(ptr != NULL && new_size <= old_size) {
+        return ptr;
+    }
+
+    void *moved = arena_alloc(arena, new_size);
+    if(ptr != NULL) {
+        memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+    }
+    return moved;
+}
+
+/**
+ * Copies a string into the arena.
+ *
+ * @param arena arena to allocate from
+ * @param str string to copy
+ * @return the copy
+ */
+char *arena_strdup(struct arena *arena, const char *str)
+{
+    size_t len = strlen(str);
+    char *copy = arena_alloc(arena, len + 1);
+    memcpy(copy, str, len + 1);
+    return copy;
+}
+
+/**
+ * Gives back everything allocated from the arena at once. If it needed more
+ * than one chunk, they are replaced by a single one big enough for all of it,
+ * so that the same work never has to go to the heap again.
+ *
+ * @param arena arena to reset
+ */
+void arena_reset(struct arena *arena)
+{
+    if(arena->in_use > arena->peak) {
+        arena->peak = arena->in_use;
+    }
+    arena->in_use = 0;
+    arena->last = 0;
+    if(arena->chunk == NULL) {
+        return;
+    }
+
+    if(arena->chunk->prev != NULL) {
+        arena_free(arena);
+        chunk_add(arena, arena->peak);
+    }
+    arena->chunk->used = 0;
+}
+
+/**
+ * Returns all the memory of an arena to the heap. The arena can still be used
+ * afterwards.
+ *
+ * @param arena arena to free
+ */
+void arena_free(struct arena *arena)
+{
+    struct arena_chunk *chunk = arena->chunk;
+    while(chunk != NULL) {
+        struct arena_chunk *prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+    arena->chunk = NULL;
+    arena->in_use = 0;
+    arena->last = 0;
+}
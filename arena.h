@@ -0,0 +1,30 @@
+/**
+ * @file
+ *
+ * Bump allocator for memory that only lives as long as one command. Space is
+ * handed out front to back and never freed on its own: the whole arena is
+ * reset once the command is done, keeping its memory for the next one.
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+struct arena_chunk;
+
+struct arena {
+    struct arena_chunk *chunk;  /* Newest chunk, space is taken from it */
+    size_t last;                /* Offset of the latest allocation in chunk */
+    size_t in_use;              /* Bytes handed out since the last reset */
+    size_t peak;                /* Most bytes ever handed out between resets */
+    unsigned long chunk_allocs; /* Chunks allocated from the heap so far */
+};
+
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_grow(struct arena *arena, void *ptr, size_t old_size, size_t new_size);
+char *arena_strdup(struct arena *arena, const char *str);
+void arena_reset(struct arena *arena);
+void arena_free(struct arena *arena);
+
+#endif
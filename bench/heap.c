@@ -0,0 +1,23 @@
+/**
+ * @file
+ *
+ * Preloaded into the shell by the benchmarks to give it a large heap, as a
+ * long-running shell has: $BENCH_HEAP_MB megabytes are allocated and touched
+ * at startup. Children don't inherit it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+static char *ballast = NULL;
+
+__attribute__((constructor)) static void heap_init(void)
+{
+    const char *env = getenv("BENCH_HEAP_MB");
+    size_t size = (size_t) (env != NULL ? atoi(env) : 256) << 20;
+    ballast = malloc(size);
+    if(ballast != NULL) {
+        memset(ballast, 1, size);
+    }
+    unsetenv("LD_PRELOAD");
+}
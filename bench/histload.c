@@ -0,0 +1,83 @@
+/**
+ * @file
+ *
+ * Times loading a history file, as an interactive shell does at startup.
+ * Writes a file of the given number of commands (about a third of them
+ * repeats of earlier ones) and loads it with each history limit given:
+ *
+ *   histload <commands> <limit>...
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "history.h"
+
+/* Same layout histfile.c writes */
+#define HISTFILE_MAGIC "FISHHIS1"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void write_file(const char *path, unsigned int commands)
+{
+    FILE *file = fopen(path, "w");
+    if(file == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fwrite(HISTFILE_MAGIC, 1, strlen(HISTFILE_MAGIC), file);
+    char cmd[128];
+    srand(1);
+    for(unsigned int i = 0; i < commands; i++) {
+        unsigned int n = rand() % 3 == 0 ? rand() % (i + 1) : i;
+        int len = snprintf(cmd, sizeof(cmd), "git -C ~/src/project%u log --oneline -n %u | grep fix",
+                n % 97, n);
+        uint32_t len32 = len;
+        fwrite(&len32, sizeof(len32), 1, file);
+        fwrite(cmd, 1, len + 1, file);
+        fwrite(&len32, sizeof(len32), 1, file);
+    }
+    fclose(file);
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 3) {
+        fprintf(stderr, "usage: %s commands limit...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    char path[] = "/tmp/histload.XXXXXX";
+    int fd = mkstemp(path);
+    if(fd == -1) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    unsigned int commands = atoi(argv[1]);
+    write_file(path, commands);
+
+    for(int i = 2; i < argc; i++) {
+        unsigned int limit = atoi(argv[i]);
+        double best = 1e9;
+        for(int run = 0; run < 5; run++) {
+            hist_init(limit);
+            double start = now();
+            hist_open(path);
+            double took = now() - start;
+            best = took < best ? took : best;
+            hist_destroy();
+        }
+        printf("%u commands, limit %7u: %8.2f ms\n", commands, limit, best * 1000);
+    }
+    unlink(path);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,20 @@
+#!/usr/bin/env bash
+# Times loading a history file of 500,000 commands with the default history
+# limit and larger ones:
+#
+#   bench/histload.sh [commands] [limit...]
+#
+# Build the shell with `make LOGGER=0` first; the loader is linked against
+# its objects.
+
+set -e
+cd "$(dirname "$0")/.."
+commands=${1:-500000}
+shift || true
+limits=${*:-10000 100000 500000}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+${CC:-cc} -O2 -I. bench/histload.c histfile.o histshare.o history.o intern.o logger.o \
+    prefix.o search.o -lpthread -o "$tmp/histload"
+"$tmp/histload" "$commands" $limits
@@ -0,0 +1,140 @@
+/**
+ * @file
+ *
+ * Times lexing command lines of growing size against the tokenizer the lexer
+ * replaced: strdup() + tok_str() on blanks, then strcmp() scans for pipes,
+ * redirections and a trailing &. Lines are short words with a pipe every 50
+ * words and a redirection every 97.
+ *
+ *   lex [seconds per size]
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "lex.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The old tokenizer, as util.c had it */
+static char *next_token(char **str_ptr, const char *delim)
+{
+    if(*str_ptr == NULL) {
+        return NULL;
+    }
+    size_t tok_start = strspn(*str_ptr, delim);
+    size_t tok_end = strcspn(*str_ptr + tok_start, delim);
+    if(tok_end == 0) {
+        *str_ptr = NULL;
+        return NULL;
+    }
+    char *current_ptr = *str_ptr + tok_start;
+    *str_ptr += tok_start + tok_end;
+    if(**str_ptr == '\0') {
+        *str_ptr = NULL;
+    } else {
+        **str_ptr = '\0';
+        (*str_ptr)++;
+    }
+    return current_ptr;
+}
+
+static int tok_str(char *str, char **buf[], const char *delim)
+{
+    char *str_iter = str;
+    char *curr_tok = NULL;
+    int arr_sz = 1;
+    int i = 0;
+
+    *buf = malloc(sizeof(char *));
+    while((curr_tok = next_token(&str_iter, delim)) != NULL) {
+        if(strncmp("#", curr_tok, 1) == 0) {
+            break;
+        }
+        if(i == arr_sz) {
+            arr_sz *= 2;
+            *buf = realloc(*buf, arr_sz * sizeof(char *));
+        }
+        (*buf)[i++] = curr_tok;
+    }
+    if(i == arr_sz) {
+        *buf = realloc(*buf, (arr_sz + 1) * sizeof(char *));
+    }
+    (*buf)[i] = NULL;
+    return i;
+}
+
+/* What the shell did with a line before the lexer: tokenize a copy, then
+ * look for pipes, redirections and a trailing & */
+static int old_lex(const char *line)
+{
+    char *copy = strdup(line);
+    char **argv;
+    int argc = tok_str(copy, &argv, " \t\n");
+    int found = 0;
+    for(int i = 0; i < argc; i++) {
+        found += strcmp(argv[i], "|") == 0;
+    }
+    for(int i = 0; i < argc; i++) {
+        found += strcmp(argv[i], "<") == 0 || strcmp(argv[i], ">") == 0
+            || strcmp(argv[i], ">>") == 0;
+    }
+    found += argc > 0 && strcmp(argv[argc - 1], "&") == 0;
+    free(argv);
+    free(copy);
+    return found;
+}
+
+static char *make_line(size_t size)
+{
+    char *line = malloc(size + 16);
+    size_t len = 0;
+    for(unsigned int word = 1; len < size; word++) {
+        const char *text = word % 50 == 0 ? "|" : word % 97 == 0 ? ">" : "word";
+        len += sprintf(line + len, "%s%s", len > 0 ? " " : "", text);
+    }
+    return line;
+}
+
+int main(int argc, char *argv[])
+{
+    double budget = argc > 1 ? atof(argv[1]) : 0.5;
+    size_t sizes[] = { 80, 1024, 65536, 1 << 20, 16 << 20 };
+    struct arena arena = { 0 };
+    struct cmdline cmd = { 0 };
+
+    printf("%10s %14s %14s\n", "line size", "old", "lex_line");
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        char *line = make_line(sizes[s]);
+        double per[2];
+        for(int which = 0; which < 2; which++) {
+            unsigned long runs = 0;
+            double start = now();
+            double took;
+            do {
+                if(which == 0) {
+                    old_lex(line);
+                } else {
+                    lex_line(&cmd, line, &arena);
+                    lex_clear(&cmd);
+                    arena_reset(&arena);
+                }
+                runs += 1;
+            } while((took = now() - start) < budget);
+            per[which] = took / runs;
+        }
+        printf("%10zu %12.2f us %12.2f us\n", sizes[s], per[0] * 1e6, per[1] * 1e6);
+        free(line);
+    }
+    arena_free(&arena);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,16 @@
+#!/usr/bin/env bash
+# Times the lexer against the tokenizer it replaced, on lines from 80 bytes
+# to 16 MB:
+#
+#   bench/lex.sh [seconds per size]
+#
+# Build the shell with `make LOGGER=0` first; the benchmark is linked against
+# its objects. The old tokenizer is compiled with $CFLAGS (default -O2).
+
+set -e
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+${CC:-cc} ${CFLAGS:--O2} -I. bench/lex.c lex.o arena.o logger.o -lpthread -o "$tmp/lex"
+"$tmp/lex" "$@"
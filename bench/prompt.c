@@ -0,0 +1,97 @@
+/**
+ * @file
+ *
+ * Times rendering the prompt against the way it was rendered before it was
+ * cached: the user from the environment, the host name into a fresh buffer,
+ * getcwd() abbreviated to ~ a character at a time, then snprintf() into
+ * another buffer freed by the caller.
+ *
+ *   prompt [prompts]
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ui.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The old prompt, as ui.c had it */
+static char *old_cwd(void)
+{
+    char *cwd = getcwd(NULL, 0);
+    const char *home = getenv("HOME");
+    int home_size = home != NULL ? strlen(home) : 0;
+
+    if(home_size > 0 && strncmp(home, cwd, home_size) == 0) {
+        int new_size = strlen(cwd) - home_size;
+        char *new_cwd = malloc((new_size + 2) * sizeof(char));
+        new_cwd[0] = '~';
+        int new_ind = 1;
+        for(int i = home_size; i < strlen(cwd); i++) {
+            new_cwd[new_ind++] = cwd[i];
+        }
+        new_cwd[new_size + 1] = '\0';
+        free(cwd);
+        return new_cwd;
+    }
+    return cwd;
+}
+
+static char *old_prompt_line(void)
+{
+    const char *status_val = prompt_status() ? "🔥" : "✅";
+
+    char cmd_num[25];
+    snprintf(cmd_num, 25, "%u", prompt_cmd_num());
+
+    char *user = getenv("USER");
+    char *host = malloc(HOST_NAME_MAX * sizeof(char));
+    gethostname(host, HOST_NAME_MAX);
+    char *cwd = old_cwd();
+
+    char *format_str = ">>-[%s]-[%s]-[%s@%s:%s]-> ";
+    size_t prompt_sz = strlen(format_str) + strlen(status_val) + strlen(cmd_num)
+        + strlen(user != NULL ? user : "") + strlen(host) + strlen(cwd) + 1;
+    char *prompt_str = malloc(sizeof(char) * prompt_sz);
+    snprintf(prompt_str, prompt_sz, format_str, status_val, cmd_num,
+            user != NULL ? user : "", host, cwd);
+
+    free(cwd);
+    free(host);
+    return prompt_str;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long prompts = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+    size_t total = 0;
+
+    double start = now();
+    for(unsigned long i = 0; i < prompts; i++) {
+        char *prompt = old_prompt_line();
+        total += strlen(prompt);
+        free(prompt);
+    }
+    double old = now() - start;
+
+    start = now();
+    for(unsigned long i = 0; i < prompts; i++) {
+        total += strlen(prompt_line());
+    }
+    double cached = now() - start;
+
+    printf("%s\n", prompt_line());
+    printf("old      %8.0f ns per prompt\n", old / prompts * 1e9);
+    printf("cached   %8.0f ns per prompt\n", cached / prompts * 1e9);
+    return total > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
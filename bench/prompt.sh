@@ -0,0 +1,17 @@
+#!/usr/bin/env bash
+# Times rendering the prompt, cached as the shell does it now and rebuilt from
+# scratch as it used to be:
+#
+#   bench/prompt.sh [prompts]
+#
+# Build the shell with `make LOGGER=0` first; the benchmark is linked against
+# its objects.
+
+set -e
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+${CC:-cc} -O2 -I. bench/prompt.c dircache.o histfile.o histshare.o history.o intern.o jobs.o \
+    logger.o pathindex.o prefix.o search.o ui.o -lm -lpthread -lreadline -o "$tmp/prompt"
+"$tmp/prompt" "$@"
@@ -0,0 +1,38 @@
+/**
+ * @file
+ *
+ * Preloaded into the shell by the benchmarks to count what it reads from its
+ * standard input. The counts are printed to stderr when the shell exits.
+ * Children don't inherit it, so only the shell's own reads are counted.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static ssize_t (*real_read)(int, void *, size_t) = NULL;
+static unsigned long reads = 0;
+static unsigned long long bytes = 0;
+
+__attribute__((constructor)) static void readcount_init(void)
+{
+    real_read = dlsym(RTLD_NEXT, "read");
+    unsetenv("LD_PRELOAD");
+}
+
+__attribute__((destructor)) static void readcount_report(void)
+{
+    fprintf(stderr, "stdin: %lu reads, %llu bytes\n", reads, bytes);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+    ssize_t read_sz = real_read(fd, buf, count);
+    if(fd == STDIN_FILENO) {
+        reads += 1;
+        bytes += read_sz > 0 ? read_sz : 0;
+    }
+    return read_sz;
+}
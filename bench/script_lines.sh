@@ -0,0 +1,33 @@
+#!/usr/bin/env bash
+# Times a script read from stdin and counts what the shell reads to get it,
+# for a script of builtins and one of external commands:
+#
+#   bench/script_lines.sh [lines]
+#
+# Build the shell with `make LOGGER=0` first so logging stays out of it.
+
+set -e
+cd "$(dirname "$0")/.."
+lines=${1:-200000}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+${CC:-cc} -shared -fPIC -O2 bench/readcount.c -o "$tmp/readcount.so" -ldl
+
+yes 'cd .' | head -n "$lines" > "$tmp/builtins"
+yes 'true' | head -n "$((lines / 20))" > "$tmp/external"
+
+for script in builtins external; do
+    count=$(wc -l < "$tmp/$script")
+    for source in file pipe; do
+        start=$(date +%s%N)
+        if [ "$source" = file ]; then
+            LD_PRELOAD="$tmp/readcount.so" ./fish < "$tmp/$script" > /dev/null 2> "$tmp/err"
+        else
+            cat "$tmp/$script" | LD_PRELOAD="$tmp/readcount.so" ./fish > /dev/null 2> "$tmp/err"
+        fi
+        end=$(date +%s%N)
+        printf '%-8s %6d lines from a %s: %5d ms, %s\n' "$script" "$count" "$source" \
+            "$(( (end - start) / 1000000 ))" "$(grep '^stdin:' "$tmp/err")"
+    done
+done
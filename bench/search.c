@@ -0,0 +1,118 @@
+/**
+ * @file
+ *
+ * Times the Ctrl-R search over a synthetic history of a million commands,
+ * typing each query one key at a time as the widget does, and gives the
+ * slowest keystroke of each query with every scanner the CPU supports.
+ *
+ *   search [commands]
+ */
+
+/* Built in, so the scanner can be chosen */
+#include "../search.c"
+
+#include <stdio.h>
+#include <time.h>
+
+static const char *queries[] = {
+    "git co", "make cl", "README", "kubectl get pods 4242", "zzq", "gtcmt", "Docker",
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int next_rand(unsigned int *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/**
+ * Writes a command as they come up in a shell's history.
+ */
+static int command(char *buf, size_t size, unsigned int *state)
+{
+    unsigned int n = next_rand(state) % 10000;
+    switch(next_rand(state) % 10) {
+        case 0: return snprintf(buf, size, "git commit -m 'fix issue %u'", n);
+        case 1: return snprintf(buf, size, "git checkout feature/%u", n);
+        case 2: return snprintf(buf, size, "make -C src/module%u all", n);
+        case 3: return snprintf(buf, size, "cd /srv/app/release-%u", n);
+        case 4: return snprintf(buf, size, "kubectl get pods -n team%u", n);
+        case 5: return snprintf(buf, size, "docker run --rm image%u", n);
+        case 6: return snprintf(buf, size, "vim src/file%u.c", n);
+        case 7: return snprintf(buf, size, "ssh build%u.example.com", n);
+        case 8: return snprintf(buf, size, "grep -rn pattern%u .", n);
+        default: return snprintf(buf, size, "ls -la /var/log/app%u", n);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    char *buf = malloc((size_t) count * 64);
+    const char **cmds = malloc(count * sizeof(char *));
+    unsigned int state = 2463534242u;
+    size_t len = 0;
+    for(unsigned int i = 0; i < count; i++) {
+        cmds[i] = buf + len;
+        len += command(buf + len, 64, &state) + 1;
+    }
+    search_add_all(cmds, count, 1);
+    printf("%u commands, %.1f MB\n", count, len / 1e6);
+
+    const struct scanner *scanners[] = {
+        &scalar_scanner,
+#if SEARCH_X86
+        &sse2_scanner, &avx2_scanner,
+#endif
+    };
+    const char *supported[] = { NULL, "sse2", "avx2" };
+
+    printf("%-24s", "query");
+    for(size_t s = 0; s < sizeof(scanners) / sizeof(scanners[0]); s++) {
+        printf("%10s", scanners[s]->name);
+    }
+    printf("\n");
+#if SEARCH_X86
+    __builtin_cpu_init();
+#endif
+    for(size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+        printf("%-24s", queries[q]);
+        for(size_t s = 0; s < sizeof(scanners) / sizeof(scanners[0]); s++) {
+#if SEARCH_X86
+            if(supported[s] != NULL && !(s == 1 ? __builtin_cpu_supports("sse2")
+                        : __builtin_cpu_supports("avx2"))) {
+                printf("%10s", "-");
+                continue;
+            }
+#endif
+            scanner = scanners[s];
+            /* The worst keystroke, typing the query from its first key */
+            char typed[64] = "";
+            double worst = 0;
+            for(size_t k = 0; queries[q][k] != '\0'; k++) {
+                typed[k] = queries[q][k];
+                typed[k + 1] = '\0';
+                double start = now();
+                search_query(typed);
+                double took = now() - start;
+                worst = took > worst ? took : worst;
+            }
+            search_done();
+            printf("%8.0fus", worst * 1e6);
+        }
+        printf("\n");
+    }
+
+    search_clear();
+    free(cmds);
+    free(buf);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,17 @@
+#!/usr/bin/env bash
+# Times the Ctrl-R search over a synthetic history of a million commands,
+# giving the slowest keystroke of each query with the scalar, SSE2 and AVX2
+# scanners:
+#
+#   bench/search.sh [commands]
+#
+# Build the shell with `make LOGGER=0` first; the benchmark is linked against
+# its objects.
+
+set -e
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+${CC:-cc} -O2 -I. bench/search.c logger.o -lpthread -o "$tmp/search"
+"$tmp/search" "$@"
@@ -0,0 +1,42 @@
+#!/usr/bin/env bash
+# Measures how many external commands the shell launches per second, running
+# a script of /bin/true lines, with a small heap and with a large one:
+#
+#   bench/spawn_rate.sh [lines] [heap MB]
+#
+# Startup time is measured with an empty script and subtracted. Build the
+# shell with `make LOGGER=0` first; `make LOGGER=0 SPAWN=0` gives the fork()
+# numbers to compare with.
+
+set -e
+cd "$(dirname "$0")/.."
+lines=${1:-5000}
+heap_mb=${2:-256}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+${CC:-cc} -shared -fPIC -O2 bench/heap.c -o "$tmp/heap.so"
+
+yes /bin/true | head -n "$lines" > "$tmp/script"
+: > "$tmp/empty"
+
+# Prints the milliseconds the shell takes for a script
+run() {
+    local start end
+    start=$(date +%s%N)
+    env $2 ./fish "$1" > /dev/null
+    end=$(date +%s%N)
+    echo $(( (end - start) / 1000000 ))
+}
+
+for heap in plain large; do
+    preload=
+    if [ "$heap" = large ]; then
+        preload="LD_PRELOAD=$tmp/heap.so BENCH_HEAP_MB=$heap_mb"
+    fi
+    startup=$(run "$tmp/empty" "$preload")
+    total=$(run "$tmp/script" "$preload")
+    ms=$(( total - startup > 0 ? total - startup : 1 ))
+    printf '%-6s heap: %d commands in %d ms, %d per second\n' \
+        "$heap" "$lines" "$ms" $(( lines * 1000 / ms ))
+done
@@ -0,0 +1,127 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtin.h"
+#include "logger.h"
+#include "pathindex.h"
+
+/* Smallest number of slots in the table */
+#define BUILTIN_SLOTS_MIN 16
+/* Seeds tried for a table size before it is doubled */
+#define BUILTIN_SEED_TRIES 64
+
+/* Builtins in the order they were registered */
+static struct builtin *builtins = NULL;
+static size_t builtin_count = 0;
+
+/* Perfect hash table: every builtin has a slot of its own, found by hashing
+ * its name with the seed. Empty slots are NULL. */
+static const struct builtin **slots = NULL;
+static size_t slot_count = 0;
+static uint32_t slot_seed = 0;
+
+/**
+ * Hashes a builtin name (FNV-1a, starting from the seed).
+ */
+static uint32_t hash_name(const char *name, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ seed;
+    while(*name != '\0') {
+        hash ^= (unsigned char) *name++;
+        hash *= 16777619u;
+    }
+    /* FNV's low bits mix poorly, fold the high ones in */
+    return hash ^ (hash >> 16);
+}
+
+/**
+ * Fills the table with every builtin, looking for a seed that gives each one
+ * a slot of its own, and growing the table until one does.
+ */
+static void table_build(void)
+{
+    size_t count = slot_count > 0 ? slot_count : BUILTIN_SLOTS_MIN;
+    while(count < builtin_count * 2) {
+        count *= 2;
+    }
+
+    for(;;) {
+        slots = realloc(slots, count * sizeof(struct builtin *));
+        for(uint32_t seed = 0; seed < BUILTIN_SEED_TRIES; seed++) {
+            memset(slots, 0, count * sizeof(struct builtin *));
+            bool collided = false;
+            for(size_t i = 0; i < builtin_count && !collided; i++) {
+                size_t slot = hash_name(builtins[i].name, seed) & (count - 1);
+                collided = slots[slot] != NULL;
+                slots[slot] = &builtins[i];
+            }
+            if(!collided) {
+                slot_count = count;
+                slot_seed = seed;
+                LOG("Builtin table of %zu slots for %zu builtins, seed %u\n",
+                        count, builtin_count, seed);
+                return;
+            }
+        }
+        count *= 2;
+    }
+}
+
+/**
+ * Adds a builtin. Registering a name again replaces its function. The name
+ * is also offered by command completion.
+ *
+ * @param name name the builtin is run by, which must stay valid
+ * @param function function running the builtin
+ */
+void builtin_register(const char *name, builtin_fn function)
+{
+    for(size_t i = 0; i < builtin_count; i++) {
+        if(strcmp(builtins[i].name, name) == 0) {
+            builtins[i].function = function;
+            return;
+        }
+    }
+
+    builtins = realloc(builtins, (builtin_count + 1) * sizeof(struct builtin));
+    builtins[builtin_count].name = name;
+    builtins[builtin_count].function = function;
+    builtin_count += 1;
+    /* The table points into the list, which may have moved */
+    table_build();
+    pathindex_add_builtin(name);
+}
+
+/**
+ * Looks up a builtin by its whole name.
+ *
+ * @param name command name
+ * @return the builtin, or NULL if name isn't one
+ */
+const struct builtin *builtin_find(const char *name)
+{
+    if(slot_count == 0) {
+        return NULL;
+    }
+    const struct builtin *builtin = slots[hash_name(name, slot_seed) & (slot_count - 1)];
+    if(builtin != NULL && strcmp(builtin->name, name) == 0) {
+        return builtin;
+    }
+    return NULL;
+}
+
+/**
+ * Forgets every builtin.
+ */
+void builtin_destroy(void)
+{
+    free(builtins);
+    builtins = NULL;
+    builtin_count = 0;
+    free(slots);
+    slots = NULL;
+    slot_count = 0;
+}
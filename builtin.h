@@ -0,0 +1,40 @@
+/**
+ * @file
+ *
+ * Registry of the shell's builtins. Builtins are found by their whole name
+ * through a perfect hash that is rebuilt whenever one is registered, so
+ * looking up a command costs one hash and at most one comparison no matter
+ * how many builtins there are. Any translation unit can add its own builtins
+ * with builtin_register() or BUILTIN().
+ */
+
+#ifndef _BUILTIN_H_
+#define _BUILTIN_H_
+
+#include "lex.h"
+
+/* All builtins take the same arguments, see builtin_handler() in shell.c */
+typedef int (*builtin_fn)(char *args[], int argc, struct cmdline *bang, char *old_cmd);
+
+struct builtin {
+    const char *name;
+    builtin_fn function;
+};
+
+void builtin_register(const char *name, builtin_fn function);
+const struct builtin *builtin_find(const char *name);
+void builtin_destroy(void);
+
+/**
+ * Registers a builtin before main() runs, from any translation unit.
+ *
+ * Example Usage:
+ * BUILTIN("pwd", pwd_handler);
+ */
+#define BUILTIN(name, function) \
+    static void __attribute__((constructor)) builtin_register_##function(void) \
+    { \
+        builtin_register(name, function); \
+    }
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ * @file
+ *
+ * Resizes arena allocations up and down: the latest one grows and shrinks in
+ * place and gives its space back, older ones keep their place when shrunk.
+ */
+
+#include <string.h>
+
+#include "arena.h"
+#include "check.h"
+
+int main(void)
+{
+    struct arena arena = { 0 };
+
+    char *buf = arena_alloc(&arena, 100);
+    memset(buf, 'a', 100);
+    size_t small = arena.in_use;
+
+    char *grown = arena_grow(&arena, buf, 100, 1000);
+    CHECK(grown == buf);
+    CHECK(arena.in_use > small);
+
+    /* Shrinking the latest allocation gives its space back */
+    char *shrunk = arena_grow(&arena, grown, 1000, 100);
+    CHECK(shrunk == buf);
+    CHECK(arena.in_use == small);
+    CHECK(memcmp(shrunk, "aaaaaaaaaa", 10) == 0);
+    char *next = arena_alloc(&arena, 16);
+    CHECK(next >= buf + 100 && next < buf + 1000);
+
+    /* An older allocation keeps its place and contents when shrunk */
+    size_t before = arena.in_use;
+    char *older = arena_grow(&arena, buf, 100, 10);
+    CHECK(older == buf);
+    CHECK(arena.in_use == before);
+    CHECK(memcmp(older, "aaaaaaaaaa", 10) == 0);
+
+    /* Down to nothing and back */
+    char *last = arena_alloc(&arena, 64);
+    before = arena.in_use;
+    CHECK(arena_grow(&arena, last, 64, 0) == last);
+    CHECK(arena.in_use == before - 64);
+    CHECK(arena_grow(&arena, last, 0, 64) == last);
+    CHECK(arena.in_use == before);
+
+    /* Growing an older allocation copies it */
+    char *moved = arena_grow(&arena, buf, 10, 200);
+    CHECK(moved != buf);
+    CHECK(memcmp(moved, "aaaaaaaaaa", 10) == 0);
+
+    arena_reset(&arena);
+    CHECK(arena.in_use == 0);
+    arena_free(&arena);
+    return check_failures();
+}
@@ -0,0 +1,38 @@
+/**
+ * @file
+ *
+ * What the checks share: CHECK() reports a condition that does not hold and
+ * counts it, and main() returns check_failures() at the end.
+ */
+
+#ifndef _CHECK_H_
+#define _CHECK_H_
+
+#include <stdio.h>
+#include <time.h>
+
+static int check_failed = 0;
+
+#define CHECK(cond) do { \
+        if(!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            check_failed += 1; \
+        } \
+    } while(0)
+
+/**
+ * Gives a monotonic time in seconds.
+ */
+static inline double check_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static inline int check_failures(void)
+{
+    return check_failed > 0 ? 1 : 0;
+}
+
+#endif
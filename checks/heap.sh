@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+# Once it has run a few, the shell runs simple commands without taking
+# anything from the heap: a script of 2,200 of them makes as many heap
+# allocations as one of 200.
+
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+count() {
+    for ((i = 0; i < $1; i++)); do
+        echo 'true'
+        echo '/bin/true one two'
+    done > "$tmp/script"
+    FISH_HISTSIZE=100 LD_PRELOAD=./checks/heapcount.so ./fish "$tmp/script" 2>&1 \
+        | sed -n 's/^heap: \([0-9]*\) allocations$/\1/p'
+}
+
+few=$(count 100)
+many=$(count 1100)
+echo "heap allocations: $few for 200 commands, $many for 2200"
+[ -n "$few" ] && [ "$few" = "$many" ]
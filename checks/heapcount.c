@@ -0,0 +1,46 @@
+/**
+ * @file
+ *
+ * Preloaded into the shell by checks/heap.sh to count every allocation it
+ * takes from the heap. The count is printed to stderr when the shell exits.
+ * Children don't inherit it, so only the shell's own allocations count.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+
+/* glibc's own allocator, which the wrappers below forward to */
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long allocs = 0;
+
+__attribute__((constructor)) static void heapcount_init(void)
+{
+    unsetenv("LD_PRELOAD");
+}
+
+__attribute__((destructor)) static void heapcount_report(void)
+{
+    fprintf(stderr, "heap: %lu allocations\n", allocs);
+}
+
+void *malloc(size_t size)
+{
+    allocs += 1;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    allocs += 1;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    allocs += 1;
+    return __libc_realloc(ptr, size);
+}
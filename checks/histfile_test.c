@@ -0,0 +1,106 @@
+/**
+ * @file
+ *
+ * Checks that a history file loads the same commands before and after it is
+ * compacted, without repeats or removed commands, and that a large one is
+ * loaded in bulk into the history.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+/* For histfile_compact() */
+#include "histfile.c"
+#include "history.h"
+
+/* Commands the file keeps, and commands written to it */
+#define KEEP 50
+#define WRITTEN 500
+/* Commands written for the bulk load */
+#define LARGE 200000
+
+static char *loaded[KEEP];
+static unsigned int loaded_count = 0;
+
+static void load(const char *cmds[], unsigned int count)
+{
+    for(unsigned int i = 0; i < loaded_count; i++) {
+        free(loaded[i]);
+    }
+    CHECK(count <= KEEP);
+    for(unsigned int i = 0; i < count && i < KEEP; i++) {
+        loaded[i] = strdup(cmds[i]);
+    }
+    loaded_count = count;
+}
+
+int main(void)
+{
+    char path[] = "/tmp/histfile_test.XXXXXX";
+    close(mkstemp(path));
+    unlink(path);
+
+    CHECK(histfile_open(path, KEEP, load) == 0);
+    char cmd[64];
+    for(unsigned int i = 0; i < WRITTEN; i++) {
+        snprintf(cmd, sizeof(cmd), "command %u", i * 7 % 60);
+        histfile_append(cmd);
+        if(i % 100 == 99) {
+            histfile_append("removed again");
+            histfile_remove_last();
+        }
+    }
+    histfile_close();
+
+    CHECK(histfile_open(path, KEEP, load) == 0);
+    unsigned int before_count = loaded_count;
+    char *before[KEEP];
+    memcpy(before, loaded, sizeof(before));
+    loaded_count = 0;
+    CHECK(before_count == KEEP);
+    snprintf(cmd, sizeof(cmd), "command %u", (WRITTEN - 1) * 7 % 60);
+    CHECK(strcmp(before[before_count - 1], cmd) == 0);
+    for(unsigned int i = 0; i < before_count; i++) {
+        CHECK(strcmp(before[i], "removed again") != 0);
+        for(unsigned int j = 0; j < i; j++) {
+            CHECK(strcmp(before[i], before[j]) != 0);
+        }
+    }
+
+    histfile_compact();
+    histfile_close();
+    CHECK(histfile_open(path, KEEP, load) == 0);
+    CHECK(loaded_count == before_count);
+    for(unsigned int i = 0; i < loaded_count && i < before_count; i++) {
+        CHECK(strcmp(loaded[i], before[i]) == 0);
+    }
+    histfile_close();
+    unlink(path);
+
+    /* Written through the history, so the file is compacted along the way */
+    hist_init(LARGE);
+    hist_open(path);
+    for(unsigned int i = 0; i < LARGE; i++) {
+        snprintf(cmd, sizeof(cmd), "ssh host%u uptime", i % (LARGE / 2) + i / (LARGE / 2));
+        hist_add(cmd);
+    }
+    hist_destroy();
+
+    hist_init(LARGE);
+    double start = check_now();
+    hist_open(path);
+    double took = check_now() - start;
+    printf("loaded %u commands in %.2f ms\n", hist_last_cnum(), took * 1000);
+    CHECK(took < 1);
+    /* host0 to host99999 once, then host1 to host100000 again */
+    CHECK(hist_last_cnum() == LARGE / 2 + 1);
+    CHECK(strcmp(hist_search_cnum(1), "ssh host0 uptime") == 0);
+    CHECK(strcmp(hist_search_cnum(hist_last_cnum()), "ssh host100000 uptime") == 0);
+    CHECK(strcmp(hist_search_prefix("ssh host5 ", 0), "ssh host5 uptime") == 0);
+    CHECK(hist_track_cnum() == 6);
+    hist_destroy();
+    unlink(path);
+
+    return check_failures();
+}
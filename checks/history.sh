@@ -0,0 +1,19 @@
+#!/usr/bin/env bash
+# The shell keeps FISH_HISTSIZE commands: a bang can still reach the first of
+# 150,000 commands, and no longer can once the limit is lower.
+
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+{
+    echo 'echo first command'
+    yes 'cd .' | head -n 149998
+    echo '!1'
+} > "$tmp/script"
+
+out=$(FISH_HISTSIZE=150000 ./fish "$tmp/script" 2>&1)
+[ "$(echo "$out" | grep -c '^first command$')" -eq 2 ] || { echo "$out"; exit 1; }
+
+out=$(FISH_HISTSIZE=149998 ./fish "$tmp/script" 2>&1)
+[ "$(echo "$out" | grep -c '^first command$')" -eq 1 ] || { echo "$out"; exit 1; }
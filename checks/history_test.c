@@ -0,0 +1,87 @@
+/**
+ * @file
+ *
+ * Fills a history far past the default limit and searches it: by command
+ * number, by prefix as the arrow keys do, and with the Ctrl-R search.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "check.h"
+#include "history.h"
+#include "search.h"
+
+/* Commands kept, and commands added (the oldest ones are evicted) */
+#define LIMIT 200000
+#define ADDED 300000
+/* Distinct directories the commands run in */
+#define DIRS 5000
+
+static void command(char *buf, size_t size, unsigned int i)
+{
+    snprintf(buf, size, "make -C dir%u target%u", i % DIRS, i);
+}
+
+int main(void)
+{
+    char cmd[64];
+    char expect[64];
+
+    hist_init(LIMIT);
+    double start = check_now();
+    for(unsigned int i = 0; i < ADDED; i++) {
+        command(cmd, sizeof(cmd), i);
+        hist_add(cmd);
+    }
+    double added = check_now() - start;
+    printf("added %d commands in %.0f ms\n", ADDED, added * 1000);
+    CHECK(added < 5);
+
+    CHECK(hist_oldest_cnum() == ADDED - LIMIT + 1);
+    CHECK(hist_last_cnum() == ADDED);
+    command(expect, sizeof(expect), ADDED - LIMIT);
+    CHECK(strcmp(hist_search_cnum(ADDED - LIMIT + 1), expect) == 0);
+    command(expect, sizeof(expect), ADDED - 1);
+    CHECK(strcmp(hist_search_cnum(ADDED), expect) == 0);
+    CHECK(hist_search_cnum(ADDED - LIMIT) == NULL);
+
+    /* Walking back through every command run in one directory */
+    start = check_now();
+    hist_track_clear();
+    unsigned int matches = 0;
+    unsigned int i = ADDED - 1 - (ADDED - 1) % DIRS + 42;
+    const char *found;
+    while((found = hist_search_prefix("make -C dir42 ", 0)) != NULL) {
+        command(expect, sizeof(expect), i);
+        CHECK(strcmp(found, expect) == 0);
+        CHECK(hist_track_cnum() == i + 1);
+        matches += 1;
+        i -= DIRS;
+    }
+    CHECK(matches == LIMIT / DIRS);
+    double walked = check_now() - start;
+    printf("walked %u prefix matches in %.3f ms\n", matches, walked * 1000);
+    CHECK(walked < 0.5);
+
+    /* And forward again from the oldest one */
+    hist_track_clear();
+    CHECK(hist_search_prefix("make -C dir4999 t", 0) != NULL);
+    CHECK(hist_track_cnum() == ADDED);
+    CHECK(hist_search_prefix("make -C dir4999 t", 1) == NULL);
+
+    start = check_now();
+    CHECK(search_query("dir1234 target151234") == 1);
+    unsigned int cnum;
+    CHECK(strcmp(search_result(0, &cnum), "make -C dir1234 target151234") == 0);
+    CHECK(cnum == 151235);
+    CHECK(search_query("dir1234 target1") > 0);
+    search_done();
+    double searched = check_now() - start;
+    printf("searched twice in %.3f ms\n", searched * 1000);
+    CHECK(searched < 0.5);
+
+    hist_destroy();
+    return check_failures();
+}
@@ -0,0 +1,144 @@
+/**
+ * @file
+ *
+ * Stress test of the shared history ring: dozens of writer processes append
+ * at once, for many laps of the ring, while a reader syncs along. One more
+ * writer is killed in the middle of writing its slot. Every writer has to
+ * finish, the reader must never see a torn or reordered command, and the
+ * ring has to go on working past the dead writer's slot.
+ */
+
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#include "check.h"
+/* For the ring's internals, to die in the middle of a slot */
+#include "histshare.c"
+
+#define WRITERS 32
+#define APPENDS 2000
+
+/* What the reader has seen: the last number read from each writer */
+static long last_seen[WRITERS];
+static unsigned long seen_count = 0;
+static unsigned long torn = 0;
+static unsigned long reordered = 0;
+
+/* Commands carry a checksum of their writer and number, so a mix of two
+ * commands shows up */
+static void command(char *buf, size_t size, int writer, int n)
+{
+    snprintf(buf, size, "writer %d appends %d check %d", writer, n, writer * 7919 + n * 31);
+}
+
+static void check_command(const char *cmd)
+{
+    int writer, n, check;
+    char expect[128];
+    if(sscanf(cmd, "writer %d appends %d check %d", &writer, &n, &check) != 3
+            || writer < 0 || writer >= WRITERS) {
+        torn += 1;
+        return;
+    }
+    command(expect, sizeof(expect), writer, n);
+    if(strcmp(cmd, expect) != 0) {
+        torn += 1;
+        return;
+    }
+    if(n <= last_seen[writer]) {
+        reordered += 1;
+    }
+    last_seen[writer] = n;
+    seen_count += 1;
+}
+
+/**
+ * Reserves a slot and dies before finishing it, as a session killed in the
+ * middle of histshare_append() would.
+ */
+static void die_in_slot(void)
+{
+    uint64_t seq = atomic_fetch_add(&ring->head, 1);
+    atomic_store(&ring_slot(seq)->stamp, 2 * (seq + 1) - 1);
+    raise(SIGKILL);
+}
+
+static void writer(int id)
+{
+    char cmd[128];
+    for(int n = 0; n < APPENDS; n++) {
+        command(cmd, sizeof(cmd), id, n);
+        histshare_append(cmd);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+int main(void)
+{
+    char path[] = "/tmp/histshare_test.XXXXXX";
+    close(mkstemp(path));
+    unlink(path);
+    CHECK(histshare_open(path) == 0);
+
+    pid_t dead = fork();
+    if(dead == 0) {
+        histshare_open(path);
+        die_in_slot();
+    }
+    int status;
+    waitpid(dead, &status, 0);
+    CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+
+    double start = check_now();
+    pid_t pids[WRITERS];
+    for(int i = 0; i < WRITERS; i++) {
+        pids[i] = fork();
+        if(pids[i] == 0) {
+            histshare_open(path);
+            writer(i);
+        }
+    }
+
+    /* The reader syncs as long as writers are left, and once more after */
+    for(int i = 0; i < WRITERS; i++) {
+        last_seen[i] = -1;
+    }
+    int left = WRITERS;
+    while(left > 0) {
+        histshare_sync(check_command);
+        pid_t pid;
+        while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+            left -= 1;
+        }
+        if(check_now() - start > 60) {
+            fprintf(stderr, "%d writers still running after 60 s\n", left);
+            for(int i = 0; i < WRITERS; i++) {
+                kill(pids[i], SIGKILL);
+            }
+            return EXIT_FAILURE;
+        }
+        sched_yield();
+    }
+    histshare_sync(check_command);
+    double took = check_now() - start;
+
+    printf("%d writers appended %d commands each in %.0f ms (%.2f us per append), "
+            "reader saw %lu\n", WRITERS, APPENDS, took * 1000,
+            took * 1e6 / (WRITERS * APPENDS), seen_count);
+    CHECK(torn == 0);
+    CHECK(reordered == 0);
+    CHECK(atomic_load(&ring->head) == 1 + WRITERS * APPENDS);
+    /* At the very least the last lap was read */
+    CHECK(seen_count >= ring->slot_count);
+
+    /* No slot is left half written */
+    for(uint32_t i = 0; i < ring->slot_count; i++) {
+        CHECK(atomic_load(&ring_slot(i)->stamp) % 2 == 0);
+    }
+
+    histshare_close();
+    unlink(path);
+    return check_failures();
+}
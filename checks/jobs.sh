@@ -0,0 +1,21 @@
+#!/usr/bin/env bash
+# A captured job that stops is killed instead of holding up the output of the
+# jobs after it, in a script run with -j and under parallel.
+
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+cat > "$tmp/script" <<'SCRIPT'
+echo one
+sh -c 'echo two; kill -STOP $$; echo stopped'
+echo three
+SCRIPT
+out=$(timeout 10 ./fish -j 4 "$tmp/script" 2>/dev/null)
+[ "$out" = "$(printf 'one\ntwo\nthree')" ] || { echo "$out"; exit 1; }
+
+printf 'a\nb\n' > "$tmp/items"
+echo "parallel -k -a $tmp/items sh -c 'echo {}; kill -STOP \$\$'" > "$tmp/script"
+echo 'echo done' >> "$tmp/script"
+out=$(timeout 10 ./fish "$tmp/script" 2>/dev/null)
+[ "$out" = "$(printf 'a\nb\ndone')" ] || { echo "$out"; exit 1; }
@@ -0,0 +1,24 @@
+#!/usr/bin/env bash
+# parallel reads its arguments from a pipe when it ends a pipeline, and from
+# a file given with <, and leaves their operators out of its template.
+
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+printf 'l1\nl2\n' > "$tmp/list"
+cat > "$tmp/script" <<SCRIPT
+seq 1 3 | parallel -k echo x
+parallel -k echo z < $tmp/list
+seq 1 2 | parallel -k echo {} '<' > $tmp/out
+cat $tmp/out
+SCRIPT
+out=$(timeout 10 ./fish "$tmp/script" 2>&1)
+expect='x 1
+x 2
+x 3
+z l1
+z l2
+1 <
+2 <'
+[ "$out" = "$expect" ] || { echo "$out"; exit 1; }
@@ -0,0 +1,18 @@
+#!/usr/bin/env bash
+# A missing redirected file is reported by its own name, and does not make
+# the shell search PATH again for a command it found before.
+
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+cat > "$tmp/script" <<SCRIPT
+cat < $tmp/missing
+echo hi > $tmp/missing/out
+nosuchcmd
+SCRIPT
+out=$(timeout 10 ./fish "$tmp/script" 2>&1)
+expect="$tmp/missing: No such file or directory
+$tmp/missing/out: No such file or directory
+nosuchcmd: No such file or directory"
+[ "$out" = "$expect" ] || { echo "$out"; exit 1; }
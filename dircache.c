@@ -0,0 +1,187 @@
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "dircache.h"
+#include "logger.h"
+
+/* Number of directory listings kept */
+#define DIRCACHE_SLOTS 8
+/* Bytes of names a listing starts with room for */
+#define DIRCACHE_NAMES_MIN 4096
+
+/* A directory and its entries when it was last read */
+struct dir_listing {
+    char *path;             /* Path as it was completed from, NULL if unused */
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    char *names;            /* Names one after the other, each NUL terminated */
+    const char **entries;   /* The names, sorted */
+    size_t count;
+    unsigned long used;     /* Completion the listing was last used by */
+};
+
+static struct dir_listing slots[DIRCACHE_SLOTS];
+static unsigned long use_clock = 0;
+
+static int name_cmp(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *) a, *(const char *const *) b);
+}
+
+static void listing_clear(struct dir_listing *listing)
+{
+    free(listing->path);
+    free(listing->names);
+    free(listing->entries);
+    memset(listing, 0, sizeof(struct dir_listing));
+}
+
+/**
+ * Reads a directory into a listing, sorting its names.
+ *
+ * @return whether the directory could be read
+ */
+static bool listing_read(struct dir_listing *listing, const char *path)
+{
+    DIR *stream = opendir(path);
+    struct stat st;
+    if(stream == NULL || fstat(dirfd(stream), &st) != 0) {
+        if(stream != NULL) {
+            closedir(stream);
+        }
+        return false;
+    }
+
+    size_t cap = DIRCACHE_NAMES_MIN;
+    size_t names_sz = 0;
+    size_t count = 0;
+    char *names = malloc(cap);
+    struct dirent *entry;
+    while((entry = readdir(stream)) != NULL) {
+        const char *name = entry->d_name;
+        if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+        size_t len = strlen(name) + 1;
+        if(names_sz + len > cap) {
+            cap *= 2;
+            names = realloc(names, cap);
+        }
+        memcpy(names + names_sz, name, len);
+        names_sz += len;
+        count += 1;
+    }
+    closedir(stream);
+
+    const char **entries = malloc((count > 0 ? count : 1) * sizeof(char *));
+    const char *name = names;
+    for(size_t i = 0; i < count; i++) {
+        entries[i] = name;
+        name += strlen(name) + 1;
+    }
+    qsort(entries, count, sizeof(char *), name_cmp);
+
+    listing_clear(listing);
+    listing->path = strdup(path);
+    listing->dev = st.st_dev;
+    listing->ino = st.st_ino;
+    listing->mtime = st.st_mtim;
+    listing->names = names;
+    listing->entries = entries;
+    listing->count = count;
+    LOG("Listed %zu names in %s\n", count, path);
+    return true;
+}
+
+/**
+ * Finds the listing of a directory, reading it if it isn't cached or changed
+ * since. A new listing replaces the one used least recently.
+ *
+ * @return the listing, or NULL if the directory can't be read
+ */
+static struct dir_listing *listing_get(const char *path)
+{
+    struct stat st;
+    if(stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+
+    struct dir_listing *listing = NULL;
+    for(int i = 0; i < DIRCACHE_SLOTS && listing == NULL; i++) {
+        if(slots[i].path != NULL && strcmp(slots[i].path, path) == 0) {
+            listing = &slots[i];
+        }
+    }
+    if(listing == NULL) {
+        listing = &slots[0];
+        for(int i = 1; i < DIRCACHE_SLOTS; i++) {
+            if(slots[i].used < listing->used) {
+                listing = &slots[i];
+            }
+        }
+    } else if(listing->dev == st.st_dev && listing->ino == st.st_ino
+            && listing->mtime.tv_sec == st.st_mtim.tv_sec
+            && listing->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        listing->used = ++use_clock;
+        return listing;
+    }
+
+    if(!listing_read(listing, path)) {
+        listing_clear(listing);
+        return NULL;
+    }
+    listing->used = ++use_clock;
+    return listing;
+}
+
+/**
+ * Finds the entries of a directory starting with a prefix.
+ *
+ * @param dir directory to look in, an empty string being the current one
+ * @param prefix start of the names
+ * @param count receives the number of matches
+ * @return first of the matches, which are sorted and follow each other; valid
+ *  until the next call
+ */
+const char *const *dircache_match(const char *dir, const char *prefix, size_t *count)
+{
+    *count = 0;
+    struct dir_listing *listing = listing_get(dir[0] != '\0' ? dir : ".");
+    if(listing == NULL) {
+        return NULL;
+    }
+
+    size_t len = strlen(prefix);
+    size_t low = 0;
+    size_t high = listing->count;
+    while(low < high) {
+        size_t mid = low + (high - low) / 2;
+        if(strcmp(listing->entries[mid], prefix) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    size_t end = low;
+    while(end < listing->count && strncmp(listing->entries[end], prefix, len) == 0) {
+        end++;
+    }
+    *count = end - low;
+    return listing->entries + low;
+}
+
+/**
+ * Frees all the cached listings.
+ */
+void dircache_destroy(void)
+{
+    for(int i = 0; i < DIRCACHE_SLOTS; i++) {
+        listing_clear(&slots[i]);
+    }
+    use_clock = 0;
+}
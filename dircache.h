@@ -0,0 +1,19 @@
+/**
+ * @file
+ *
+ * Cache of directory listings for completing file names. The few directories
+ * completed from most recently are kept listed and sorted, so the names
+ * starting with a prefix are found with a binary search instead of reading
+ * the directory again on every Tab. A listing is only read again once the
+ * directory's modification time changes.
+ */
+
+#ifndef _DIRCACHE_H_
+#define _DIRCACHE_H_
+
+#include <stddef.h>
+
+const char *const *dircache_match(const char *dir, const char *prefix, size_t *count);
+void dircache_destroy(void);
+
+#endif
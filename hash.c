@@ -0,0 +1,223 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "logger.h"
+
+/* Number of buckets in the command table */
+#define HASH_BUCKETS 256
+/* Seconds a command that was not found is remembered as missing */
+#define HASH_MISS_TTL 5
+
+/* A remembered command. A NULL path marks a command that was not found. */
+struct hash_entry {
+    char *name;
+    char *path;
+    unsigned int hits;
+    time_t expires;
+    struct hash_entry *next;
+};
+
+static struct hash_entry *table[HASH_BUCKETS] = { NULL };
+/* Copy of the PATH the table was filled from */
+static char *table_path = NULL;
+/* Location last found through a relative PATH entry, which is not remembered */
+static char *uncached_path = NULL;
+
+/**
+ * Hashes a command name (FNV-1a).
+ */
+static unsigned int hash_name(const char *name)
+{
+    unsigned int hash = 2166136261u;
+    while(*name != '\0') {
+        hash ^= (unsigned char) *name++;
+        hash *= 16777619u;
+    }
+    return hash % HASH_BUCKETS;
+}
+
+/**
+ * Searches each PATH directory for an executable with the given name.
+ *
+ * @param name command to search for
+ * @param path value of PATH to search
+ * @param relative set to whether a relative entry of PATH was searched, whose
+ *  result changes with the working directory
+ * @return newly allocated location of the command, or NULL if not found
+ */
+static char *path_search(const char *name, const char *path, bool *relative)
+{
+    size_t name_sz = strlen(name);
+    const char *dir = path;
+    *relative = false;
+
+    while(dir != NULL) {
+        const char *dir_end = strchr(dir, ':');
+        size_t dir_sz = dir_end != NULL ? dir_end - dir : strlen(dir);
+
+        /* An empty PATH entry means the current directory */
+        char *full = malloc(dir_sz + name_sz + 3);
+        if(dir_sz == 0) {
+            full[0] = '.';
+            dir_sz = 1;
+        } else {
+            memcpy(full, dir, dir_sz);
+        }
+        full[dir_sz] = '/';
+        memcpy(full + dir_sz + 1, name, name_sz + 1);
+        *relative |= full[0] != '/';
+
+        struct stat st;
+        if(stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0) {
+            return full;
+        }
+        free(full);
+        dir = dir_end != NULL ? dir_end + 1 : NULL;
+    }
+    return NULL;
+}
+
+/**
+ * Drops every remembered command if PATH changed since they were found.
+ */
+static void check_path(void)
+{
+    const char *path = getenv("PATH");
+    if(path == NULL) {
+        path = "";
+    }
+    if(table_path == NULL || strcmp(table_path, path) != 0) {
+        LOG("PATH changed, resetting command table%s\n", "");
+        hash_reset();
+        table_path = strdup(path);
+    }
+}
+
+/**
+ * Finds the location of a command, searching PATH only if the command has not
+ * been looked up before. Names containing a '/' are returned as they are.
+ * Searches that went through a relative entry of PATH (such as `.`, `bin` or
+ * an empty one) are not remembered, since a cd changes their result; such a
+ * location stays valid until the next lookup.
+ *
+ * @param name command to look up
+ * @return location of the command, or NULL if it is not in PATH
+ */
+const char *hash_lookup(const char *name)
+{
+    if(strchr(name, '/') != NULL) {
+        return name;
+    }
+    check_path();
+
+    unsigned int bucket = hash_name(name);
+    struct hash_entry *entry = table[bucket];
+    while(entry != NULL && strcmp(entry->name, name) != 0) {
+        entry = entry->next;
+    }
+
+    if(entry != NULL) {
+        if(entry->path != NULL || time(NULL) < entry->expires) {
+            entry->hits += 1;
+            return entry->path;
+        }
+        /* A missing command has expired, search for it again */
+        hash_forget(name);
+    }
+
+    bool relative;
+    char *path = path_search(name, table_path, &relative);
+    if(relative) {
+        LOG("Command %s found at %s, not remembered\n", name, path != NULL ? path : "(none)");
+        free(uncached_path);
+        uncached_path = path;
+        return path;
+    }
+
+    entry = malloc(sizeof(struct hash_entry));
+    entry->name = strdup(name);
+    entry->path = path;
+    entry->next = table[bucket];
+    table[bucket] = entry;
+
+    entry->hits = 1;
+    entry->expires = time(NULL) + HASH_MISS_TTL;
+    LOG("Command %s found at %s\n", name, entry->path != NULL ? entry->path : "(none)");
+    return entry->path;
+}
+
+/**
+ * Forgets the remembered location of a command, e.g. because it could no
+ * longer be executed from there.
+ *
+ * @param name command to forget
+ */
+void hash_forget(const char *name)
+{
+    struct hash_entry **link = &table[hash_name(name)];
+    while(*link != NULL) {
+        struct hash_entry *entry = *link;
+        if(strcmp(entry->name, name) == 0) {
+            *link = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            return;
+        }
+        link = &entry->next;
+    }
+}
+
+/**
+ * Forgets every remembered command.
+ */
+void hash_reset(void)
+{
+    for(int i = 0; i < HASH_BUCKETS; i++) {
+        while(table[i] != NULL) {
+            hash_forget(table[i]->name);
+        }
+    }
+    free(table_path);
+    table_path = NULL;
+    free(uncached_path);
+    uncached_path = NULL;
+}
+
+/**
+ * Prints every remembered command along with how often it was used.
+ */
+void hash_print(void)
+{
+    bool empty = true;
+    for(int i = 0; i < HASH_BUCKETS; i++) {
+        for(struct hash_entry *entry = table[i]; entry != NULL; entry = entry->next) {
+            if(entry->path == NULL) {
+                continue;
+            }
+            if(empty) {
+                printf("hits\tcommand\n");
+                empty = false;
+            }
+            printf("%4u\t%s\n", entry->hits, entry->path);
+        }
+    }
+    if(empty) {
+        printf("hash: hash table empty\n");
+    }
+    fflush(stdout);
+}
+
+/**
+ * Frees the command table.
+ */
+void hash_destroy(void)
+{
+    hash_reset();
+}
@@ -0,0 +1,17 @@
+/**
+ * @file
+ *
+ * Remembers where commands were found in PATH, so each command only has to be
+ * searched for once. Backs the hash builtin.
+ */
+
+#ifndef _HASH_H_
+#define _HASH_H_
+
+const char *hash_lookup(const char *name);
+void hash_forget(const char *name);
+void hash_reset(void);
+void hash_print(void);
+void hash_destroy(void);
+
+#endif
@@ -0,0 +1,502 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "histfile.h"
+#include "logger.h"
+
+/* The file starts with this, anything else is left alone */
+#define HISTFILE_MAGIC "FISHHIS1"
+#define HISTFILE_HEADER (sizeof(HISTFILE_MAGIC) - 1)
+/* Length of a record that cancels an earlier one instead of adding a command */
+#define HISTFILE_REMOVED 0xFFFFFFFFu
+/* The file is compacted once it is this many times the size it had after
+ * the last compaction, and at least HISTFILE_COMPACT_MIN bytes */
+#define HISTFILE_COMPACT_RATIO 4
+#define HISTFILE_COMPACT_MIN 65536
+/* Records read ahead while collecting, see records_collect() */
+#define HISTFILE_BATCH 16
+
+/* Every record is framed by its length on both sides, so the file can be read
+ * from either end:
+ *
+ *   command:  [u32 len] [len bytes of text] [NUL] [u32 len]
+ *   removal:  [u32 HISTFILE_REMOVED] [u64 offset of the record] [u32 HISTFILE_REMOVED]
+ *
+ * Records are only ever appended. Loading reads backwards from the end and
+ * stops once it has enough commands, so it does not depend on the file size. */
+#define RECORD_SIZE(len) \
+    ((len) == HISTFILE_REMOVED \
+        ? 2 * sizeof(uint32_t) + sizeof(uint64_t) \
+        : (size_t) (len) + 1 + 2 * sizeof(uint32_t))
+
+struct record {
+    const char *text;
+    uint32_t len;
+};
+
+/* Slot of the set of collected commands: the hash of a command, so that
+ * other commands rarely need to be compared with it, and its index + 1 */
+struct seen_slot {
+    uint32_t hash;
+    unsigned int idx;
+};
+
+static int hist_fd = -1;
+static char *hist_path = NULL;
+static ino_t hist_ino = 0;
+static unsigned int hist_keep = 0;
+/* Size of the file after our last append, and after it was last compacted */
+static off_t file_end = 0;
+static off_t kept_end = 0;
+/* Offset of the last record this session appended, -1 if it can't be removed */
+static off_t last_record = -1;
+
+/**
+ * Finds the start of the record ending at an offset.
+ *
+ * @return the start of the record, or 0 if the bytes before end are not a
+ * whole record
+ */
+static size_t record_start(const char *map, size_t end)
+{
+    uint32_t len;
+    if(end < HISTFILE_HEADER + 2 * sizeof(uint32_t)) {
+        return 0;
+    }
+    memcpy(&len, map + end - sizeof(uint32_t), sizeof(uint32_t));
+    if(RECORD_SIZE(len) > end - HISTFILE_HEADER) {
+        return 0;
+    }
+
+    size_t start = end - RECORD_SIZE(len);
+    uint32_t head;
+    memcpy(&head, map + start, sizeof(uint32_t));
+    if(head != len || (len != HISTFILE_REMOVED && map[start + sizeof(uint32_t) + len] != '\0')) {
+        return 0;
+    }
+    return start;
+}
+
+/**
+ * Finds where the last whole record ends. Anything after that is a record
+ * that was cut short, e.g. by a crash in the middle of writing it.
+ */
+static size_t records_end(const char *map, size_t size)
+{
+    if(size == HISTFILE_HEADER || record_start(map, size) != 0) {
+        return size;
+    }
+
+    size_t pos = HISTFILE_HEADER;
+    while(size - pos >= 2 * sizeof(uint32_t)) {
+        uint32_t len;
+        memcpy(&len, map + pos, sizeof(uint32_t));
+        if(RECORD_SIZE(len) > size - pos || record_start(map, pos + RECORD_SIZE(len)) != pos) {
+            break;
+        }
+        pos += RECORD_SIZE(len);
+    }
+    LOG("History file has a partial record, %zu of %zu bytes are usable\n", pos, size);
+    return pos;
+}
+
+/**
+ * Hashes a command (FNV-1a).
+ */
+static uint32_t record_hash(const struct record *rec)
+{
+    uint32_t hash = 2166136261u;
+    for(uint32_t i = 0; i < rec->len; i++) {
+        hash ^= (unsigned char) rec->text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Collects the newest commands in a mapped file, newest first. Commands that
+ * were removed are skipped, and so are older copies of a command already
+ * collected. Loading and compacting both go by this, so a session sees the
+ * same history whether or not the file was compacted since.
+ *
+ * @param map mapped file
+ * @param end end of the last whole record
+ * @param limit most commands to collect
+ * @param out receives up to limit records
+ * @return the number of records collected
+ */
+static unsigned int records_collect(const char *map, size_t end, unsigned int limit,
+        struct record *out)
+{
+    /* Offsets of removed records not yet reached. A removal usually follows
+     * right after the record it cancels, so this stays short. */
+    uint64_t *removed = NULL;
+    unsigned int removed_count = 0;
+    unsigned int removed_cap = 0;
+
+    /* Open-addressed set of the collected commands */
+    unsigned int seen_size = 16;
+    while(seen_size < 2 * limit) {
+        seen_size *= 2;
+    }
+    struct seen_slot *seen = calloc(seen_size, sizeof(struct seen_slot));
+    unsigned int seen_mask = seen_size - 1;
+
+    /* Records are read a batch ahead of being looked up in the set, so that
+     * the slots they need can be fetched into the cache meanwhile */
+    struct {
+        size_t start;
+        uint32_t len;
+        uint32_t hash;
+    } batch[HISTFILE_BATCH];
+
+    unsigned int count = 0;
+    size_t pos = end;
+    bool whole = true;
+    while(count < limit && pos > HISTFILE_HEADER && whole) {
+        unsigned int batch_count = 0;
+        while(batch_count < HISTFILE_BATCH && pos > HISTFILE_HEADER) {
+            size_t start = record_start(map, pos);
+            if(start == 0) {
+                whole = false;
+                break;
+            }
+            pos = start;
+            uint32_t len;
+            memcpy(&len, map + start, sizeof(uint32_t));
+            batch[batch_count].start = start;
+            batch[batch_count].len = len;
+            if(len != HISTFILE_REMOVED) {
+                struct record rec = { map + start + sizeof(uint32_t), len };
+                batch[batch_count].hash = record_hash(&rec);
+                __builtin_prefetch(&seen[batch[batch_count].hash & seen_mask]);
+            }
+            batch_count += 1;
+        }
+
+        for(unsigned int b = 0; b < batch_count && count < limit; b++) {
+            size_t start = batch[b].start;
+            uint32_t len = batch[b].len;
+            if(len == HISTFILE_REMOVED) {
+                if(removed_count == removed_cap) {
+                    removed_cap = removed_cap == 0 ? 8 : removed_cap * 2;
+                    removed = realloc(removed, removed_cap * sizeof(uint64_t));
+                }
+                memcpy(&removed[removed_count++], map + start + sizeof(uint32_t), sizeof(uint64_t));
+                continue;
+            }
+
+            bool skip = false;
+            for(unsigned int i = 0; i < removed_count; i++) {
+                if(removed[i] == start) {
+                    removed[i] = removed[--removed_count];
+                    skip = true;
+                    break;
+                }
+            }
+            if(skip) {
+                continue;
+            }
+
+            struct record rec = { map + start + sizeof(uint32_t), len };
+            uint32_t hash = batch[b].hash;
+            unsigned int slot = hash & seen_mask;
+            while(seen[slot].idx != 0) {
+                struct record *other = &out[seen[slot].idx - 1];
+                if(seen[slot].hash == hash && other->len == len
+                        && memcmp(other->text, rec.text, len) == 0) {
+                    skip = true;
+                    break;
+                }
+                slot = (slot + 1) & seen_mask;
+            }
+            if(skip) {
+                continue;
+            }
+            seen[slot].hash = hash;
+            seen[slot].idx = count + 1;
+            out[count++] = rec;
+        }
+    }
+
+    free(removed);
+    free(seen);
+    return count;
+}
+
+/**
+ * Writes the whole of a buffer, retrying short writes.
+ */
+static int write_all(int fd, const char *buf, size_t size)
+{
+    while(size > 0) {
+        ssize_t written = write(fd, buf, size);
+        if(written == -1) {
+            return -1;
+        }
+        buf += written;
+        size -= written;
+    }
+    return 0;
+}
+
+/**
+ * Rewrites the file with only the newest copy of each of the commands that
+ * would be loaded from it. The new file replaces the old one atomically;
+ * other sessions notice and reopen it before their next append.
+ */
+static void histfile_compact(void)
+{
+    struct stat st;
+    if(flock(hist_fd, LOCK_EX | LOCK_NB) == -1) {
+        /* Someone else is writing, try again after the next command */
+        return;
+    }
+    if(stat(hist_path, &st) == -1 || st.st_ino != hist_ino) {
+        /* Another session compacted it already */
+        flock(hist_fd, LOCK_UN);
+        return;
+    }
+    if(fstat(hist_fd, &st) == -1 || st.st_size < HISTFILE_HEADER) {
+        flock(hist_fd, LOCK_UN);
+        return;
+    }
+
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, hist_fd, 0);
+    if(map == MAP_FAILED) {
+        flock(hist_fd, LOCK_UN);
+        return;
+    }
+    struct record *recs = malloc((hist_keep > 0 ? hist_keep : 1) * sizeof(struct record));
+    unsigned int count = records_collect(map, records_end(map, st.st_size), hist_keep, recs);
+
+    size_t size = HISTFILE_HEADER;
+    for(unsigned int i = 0; i < count; i++) {
+        size += RECORD_SIZE(recs[i].len);
+    }
+    char *buf = malloc(size);
+    memcpy(buf, HISTFILE_MAGIC, HISTFILE_HEADER);
+    char *pos = buf + HISTFILE_HEADER;
+    for(unsigned int i = count; i > 0; i--) {
+        struct record *rec = &recs[i - 1];
+        memcpy(pos, &rec->len, sizeof(uint32_t));
+        memcpy(pos + sizeof(uint32_t), rec->text, rec->len + 1);
+        memcpy(pos + sizeof(uint32_t) + rec->len + 1, &rec->len, sizeof(uint32_t));
+        pos += RECORD_SIZE(rec->len);
+    }
+    munmap(map, st.st_size);
+    free(recs);
+
+    size_t tmp_sz = strlen(hist_path) + 32;
+    char *tmp = malloc(tmp_sz);
+    snprintf(tmp, tmp_sz, "%s.%d.tmp", hist_path, getpid());
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+    if(fd == -1 || write_all(fd, buf, size) == -1 || fsync(fd) == -1
+            || fstat(fd, &st) == -1 || rename(tmp, hist_path) == -1) {
+        perror("history");
+        if(fd != -1) {
+            close(fd);
+            unlink(tmp);
+        }
+        flock(hist_fd, LOCK_UN);
+    } else {
+        LOG("Compacted history file from %lld to %zu bytes\n", (long long) file_end, size);
+        close(hist_fd);
+        hist_fd = fd;
+        hist_ino = st.st_ino;
+        file_end = kept_end = size;
+        last_record = -1;
+    }
+    free(tmp);
+    free(buf);
+}
+
+/**
+ * Makes sure the open file is still the one at the history path, reopening it
+ * if another session compacted it. Has to be called with a shared lock held,
+ * and returns with one held on the new file.
+ */
+static int histfile_follow(void)
+{
+    struct stat st;
+    while(stat(hist_path, &st) == 0 && st.st_ino != hist_ino) {
+        int fd = open(hist_path, O_RDWR | O_APPEND | O_CLOEXEC);
+        if(fd == -1) {
+            break;
+        }
+        close(hist_fd);
+        hist_fd = fd;
+        flock(hist_fd, LOCK_SH);
+        if(fstat(hist_fd, &st) == -1) {
+            break;
+        }
+        hist_ino = st.st_ino;
+        kept_end = file_end = st.st_size;
+        last_record = -1;
+    }
+    return hist_fd;
+}
+
+/**
+ * Opens the history file and loads its newest commands. The file is created
+ * if it doesn't exist yet. From then on, commands passed to histfile_append()
+ * are written to it.
+ *
+ * @param path location of the history file
+ * @param limit most commands to load, and to keep when compacting
+ * @param load called once with the commands loaded, oldest first, and how
+ *  many there are; only the newest copy of a repeated command is loaded
+ * @return 0 on success, -1 if the file cannot be used
+ */
+int histfile_open(const char *path, unsigned int limit,
+        void (*load)(const char *cmds[], unsigned int count))
+{
+    histfile_close();
+
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if(fd == -1) {
+        perror("history");
+        return -1;
+    }
+    struct stat st;
+    flock(fd, LOCK_EX);
+    if(fstat(fd, &st) == -1) {
+        perror("history");
+        close(fd);
+        return -1;
+    }
+    if(st.st_size == 0) {
+        write_all(fd, HISTFILE_MAGIC, HISTFILE_HEADER);
+        st.st_size = HISTFILE_HEADER;
+    }
+
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED || st.st_size < HISTFILE_HEADER
+            || memcmp(map, HISTFILE_MAGIC, HISTFILE_HEADER) != 0) {
+        fprintf(stderr, "history: %s is not a history file, not saving history\n", path);
+        if(map != MAP_FAILED) {
+            munmap(map, st.st_size);
+        }
+        close(fd);
+        return -1;
+    }
+
+    size_t end = records_end(map, st.st_size);
+    if(end < st.st_size) {
+        /* Drop the partial record so that new ones can be read back */
+        ftruncate(fd, end);
+    }
+
+    struct record *recs = malloc((limit > 0 ? limit : 1) * sizeof(struct record));
+    const char **cmds = malloc((limit > 0 ? limit : 1) * sizeof(char *));
+    unsigned int count = records_collect(map, end, limit, recs);
+    size_t kept = HISTFILE_HEADER;
+    for(unsigned int i = 0; i < count; i++) {
+        cmds[count - 1 - i] = recs[i].text;
+        kept += RECORD_SIZE(recs[i].len);
+    }
+    load(cmds, count);
+    LOG("Loaded %u commands from %s (%zu bytes)\n", count, path, end);
+    free(cmds);
+    free(recs);
+    munmap(map, st.st_size);
+    flock(fd, LOCK_UN);
+
+    hist_fd = fd;
+    hist_path = strdup(path);
+    hist_ino = st.st_ino;
+    hist_keep = limit;
+    file_end = end;
+    kept_end = kept;
+    last_record = -1;
+    return 0;
+}
+
+/**
+ * Appends a command to the history file, compacting it first if it has grown
+ * too much.
+ *
+ * @param cmd command string
+ */
+void histfile_append(const char *cmd)
+{
+    if(hist_fd == -1) {
+        return;
+    }
+    if(file_end >= HISTFILE_COMPACT_MIN && file_end > HISTFILE_COMPACT_RATIO * kept_end) {
+        histfile_compact();
+    }
+
+    uint32_t len = strlen(cmd);
+    struct iovec iov[3] = {
+        { &len, sizeof(uint32_t) },
+        { (char *) cmd, len + 1 },
+        { &len, sizeof(uint32_t) },
+    };
+
+    /* The shared lock only keeps a compaction from replacing the file in the
+     * middle of the write, appends from several sessions can go ahead
+     * together. O_APPEND makes each record land in one piece. */
+    flock(hist_fd, LOCK_SH);
+    histfile_follow();
+    ssize_t written = writev(hist_fd, iov, 3);
+    off_t end = lseek(hist_fd, 0, SEEK_CUR);
+    flock(hist_fd, LOCK_UN);
+
+    if(written == RECORD_SIZE(len) && end != -1) {
+        file_end = end;
+        last_record = end - written;
+    } else {
+        LOG("Could not append to history file: %zd of %zu bytes\n", written, RECORD_SIZE(len));
+        last_record = -1;
+    }
+}
+
+/**
+ * Records that the command last appended by this session was removed from
+ * the history again.
+ */
+void histfile_remove_last(void)
+{
+    if(hist_fd == -1 || last_record == -1) {
+        return;
+    }
+
+    uint32_t mark = HISTFILE_REMOVED;
+    uint64_t offset = last_record;
+    struct iovec iov[3] = {
+        { &mark, sizeof(uint32_t) },
+        { &offset, sizeof(uint64_t) },
+        { &mark, sizeof(uint32_t) },
+    };
+
+    flock(hist_fd, LOCK_SH);
+    if(histfile_follow() != -1 && last_record != -1) {
+        writev(hist_fd, iov, 3);
+        file_end = lseek(hist_fd, 0, SEEK_CUR);
+    }
+    flock(hist_fd, LOCK_UN);
+    last_record = -1;
+}
+
+/**
+ * Closes the history file. Everything was already written as it happened.
+ */
+void histfile_close(void)
+{
+    if(hist_fd != -1) {
+        close(hist_fd);
+        hist_fd = -1;
+    }
+    free(hist_path);
+    hist_path = NULL;
+}
@@ -0,0 +1,18 @@
+/**
+ * @file
+ *
+ * Keeps the history in a file across sessions. The file is an append-only log
+ * of length-prefixed records, loaded by mapping it into memory and reading it
+ * back from the end.
+ */
+
+#ifndef _HISTFILE_H_
+#define _HISTFILE_H_
+
+int histfile_open(const char *path, unsigned int limit,
+        void (*load)(const char *cmds[], unsigned int count));
+void histfile_append(const char *cmd);
+void histfile_remove_last(void);
+void histfile_close(void);
+
+#endif
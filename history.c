@@ -1,146 +1,331 @@
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "histfile.h"
 #include "history.h"
+#include "histshare.h"
+#include "intern.h"
 #include "logger.h"
-#include "linkedhistory.c"
+#include "prefix.h"
+#include "search.h"
 
-static struct LinkedHistory *history = NULL;
+/* Fixed-capacity ring of commands. The command numbered cnum is stored at
+ * index (cnum - 1) % hist_cap, and the entries held are always the
+ * consecutive command numbers from hist_oldest to hist_last. Entries are ids
+ * of interned strings, so repeated commands share one copy of their text. */
+static unsigned int *history = NULL;
+static unsigned int hist_cap = 0;
+static unsigned int hist_count = 0;
+static unsigned int hist_last = 0;
+/* Command number of the entry the arrow keys are on, 0 if none */
+static unsigned int hist_track = 0;
+
+#define hist_oldest (hist_last - hist_count + 1)
+
+static void hist_insert(const char *cmd);
+static void hist_load(const char *cmds[], unsigned int count);
+
+/**
+ * Gives the ring slot of a command number that is in the history.
+ */
+static unsigned int *hist_slot(unsigned int command_number)
+{
+    return &history[(command_number - 1) % hist_cap];
+}
+
+/**
+ * Gives the text of a command that is in the history.
+ */
+static const char *hist_text(unsigned int command_number)
+{
+    return intern_str(*hist_slot(command_number));
+}
+
+/**
+ * Checks if a command number is currently held in the history.
+ */
+static int hist_holds(unsigned int command_number)
+{
+    return hist_count > 0
+        && command_number >= hist_oldest
+        && command_number <= hist_last;
+}
 
 void hist_init(unsigned int limit)
 {
     LOG("Initializing history%s\n", "");
-    history = (struct LinkedHistory *) malloc(sizeof(struct LinkedHistory));
-    history->list_max = limit;
-    history->list_sz = 0;
-    history->total_id_count = 0;
-    history->head = NULL;
-    history->tail = NULL;
-    history->track = NULL;
+    history = calloc(limit, sizeof(unsigned int));
+    hist_cap = limit;
+    hist_count = 0;
+    hist_last = 0;
+    hist_track = 0;
 }
 
 void hist_destroy(void)
 {
-    while(history->head != NULL) {
-        del_head(history);
-    }
+    hist_count = 0;
     free(history);
+    history = NULL;
+    prefix_clear();
+    search_clear();
+    intern_clear();
+    histfile_close();
+    histshare_close();
+}
+
+/**
+ * Loads the history saved in a file, and saves every command added from now
+ * on to it.
+ *
+ * @param path location of the history file
+ */
+void hist_open(const char *path)
+{
+    histfile_open(path, hist_cap, hist_load);
+}
+
+/**
+ * Shares the history with other sessions using the same ring file. Their
+ * commands are picked up by hist_sync().
+ *
+ * @param path location of the shared ring file
+ */
+void hist_share(const char *path)
+{
+    histshare_open(path);
+}
+
+/**
+ * Adds the commands other sessions ran since the last call to the history.
+ * This resets the arrow keys, so it is only called before they start moving.
+ */
+void hist_sync(void)
+{
+    histshare_sync(hist_insert);
 }
 
 void hist_add(const char *cmd)
 {
-    append_node(history, cmd, -1, false);
-    history->track = NULL;
+    if(hist_cap == 0) {
+        return;
+    }
+    hist_insert(cmd);
+    histfile_append(cmd);
+    /* A ! line is replaced by its expansion right away, other sessions only
+     * get to see the expansion */
+    if(cmd[0] != '!') {
+        histshare_append(cmd);
+    }
+}
+
+/**
+ * Adds a command to the history without saving or sharing it.
+ */
+static void hist_insert(const char *cmd)
+{
+    if(hist_cap == 0) {
+        return;
+    }
+
+    /* Stored before the oldest entry is let go, so that re-running the
+     * command about to be evicted keeps its copy */
+    unsigned int id = intern_add(cmd);
+    hist_last += 1;
+    unsigned int *slot = hist_slot(hist_last);
+    if(hist_count < hist_cap) {
+        LOG("List size increased!%s\n", "");
+        hist_count += 1;
+    } else {
+        /* The new entry takes the oldest one's slot */
+        LOG("List max reached! Deleting oldest history entry %u...\n", hist_last - hist_cap);
+        prefix_pop_oldest(intern_str(*slot));
+        search_pop_oldest();
+        intern_release(*slot);
+    }
+    *slot = id;
+    prefix_add(cmd, hist_last);
+    search_add(cmd, hist_last);
+    hist_track = 0;
+}
+
+/**
+ * Adds the commands loaded from the history file. Into an empty history they
+ * go in bulk: the ring is filled directly and the indexes are built at once,
+ * instead of one command at a time.
+ *
+ * @param cmds distinct commands, oldest first
+ * @param count number of commands
+ */
+static void hist_load(const char *cmds[], unsigned int count)
+{
+    if(count > hist_cap) {
+        cmds += count - hist_cap;
+        count = hist_cap;
+    }
+    if(count == 0) {
+        return;
+    }
+    if(hist_count > 0) {
+        for(unsigned int i = 0; i < count; i++) {
+            hist_insert(cmds[i]);
+        }
+        return;
+    }
+
+    unsigned int *ids = malloc(count * sizeof(unsigned int));
+    intern_add_all(cmds, count, ids);
+    for(unsigned int i = 0; i < count; i++) {
+        *hist_slot(hist_last + 1 + i) = ids[i];
+    }
+    free(ids);
+    prefix_add_all(cmds, count, hist_last + 1);
+    search_add_all(cmds, count, hist_last + 1);
+    hist_last += count;
+    hist_count = count;
+    hist_track = 0;
 }
 
 void hist_remove(int command_number)
 {
     LOG("Total num of ids in history is %u, id to remove is %d\n", hist_last_cnum(), command_number);
-    LOG("Command %d to be removed is %s\n", command_number, hist_search_cnum(command_number));
-    LOG("Value at tail was %s\n", hist_search_cnum(hist_last_cnum()));
-    int offset = (history->total_id_count) - (history->list_sz);
-    remove_node(history, command_number - offset - 1, false);
-    LOG("Value at tail is now %s\n", hist_search_cnum(hist_last_cnum()));
-    history->track = NULL;
+    if(command_number < 1 || !hist_holds(command_number)) {
+        return;
+    }
+    LOG("Command %d to be removed is %s\n", command_number, hist_text(command_number));
+
+    /* Later commands are renumbered down by one. Removing the newest command
+     * (the usual case) moves nothing. */
+    if(command_number == hist_last) {
+        prefix_pop_newest(hist_text(command_number));
+        search_pop_newest();
+        histfile_remove_last();
+    } else {
+        prefix_clear();
+        search_clear();
+    }
+    intern_release(*hist_slot(command_number));
+    for(unsigned int cnum = command_number; cnum < hist_last; cnum++) {
+        *hist_slot(cnum) = *hist_slot(cnum + 1);
+    }
+    *hist_slot(hist_last) = 0;
+    hist_last -= 1;
+    hist_count -= 1;
+    hist_track = 0;
+
+    if(command_number <= hist_last) {
+        /* The numbers changed, so the indexes have to be rebuilt */
+        for(unsigned int cnum = hist_oldest; cnum <= hist_last; cnum++) {
+            prefix_add(hist_text(cnum), cnum);
+            search_add(hist_text(cnum), cnum);
+        }
+    }
 }
 
 void hist_print(void)
 {
-    node_ptr temp_node = history->head;
-    while(temp_node != NULL){
-        printf("%d %s\n", temp_node->id, temp_node->val);
-        fflush(stdout);
-        temp_node = temp_node->next;
+    for(unsigned int cnum = hist_oldest; hist_count > 0 && cnum <= hist_last; cnum++) {
+        printf("%u %s\n", cnum, hist_text(cnum));
     }
+    fflush(stdout);
 }
 
+/**
+ * Finds the next command with a prefix older or newer than the command the
+ * arrow keys are on, and moves them onto it.
+ *
+ * @param prefix prefix to search for
+ * @param newer 0 to search towards older commands, else towards newer ones
+ * @return the command found, or NULL if there is none
+ */
 const char *hist_search_prefix(char *prefix, int newer)
 {
-    if(history->track == NULL) {
-        if(newer == 0) {
-            history->track = history->tail;
+    unsigned int found = 0;
+    size_t prefix_sz = strlen(prefix);
+
+    if(newer) {
+        if(hist_track == 0) {
+            return NULL;
         }
-    } else if(newer) {
-        history->track = history->track->next;
-    } else {
-        if(history->track->prev != NULL) {
-            history->track = history->track->prev;
+        found = prefix_newer(prefix, hist_track);
+        while(found != 0 && strncmp(prefix, hist_text(found), prefix_sz) != 0) {
+            found = prefix_newer(prefix, found);
+        }
+    } else if(hist_count > 0) {
+        /* Starting out, or sitting on the oldest command, that command is
+         * itself a candidate */
+        unsigned int below = hist_track == 0 ? hist_last + 1
+            : hist_track == hist_oldest ? hist_oldest + 1
+            : hist_track;
+        found = prefix_older(prefix, below);
+        while(found != 0 && strncmp(prefix, hist_text(found), prefix_sz) != 0) {
+            found = prefix_older(prefix, found);
+        }
+        if(found == 0) {
+            /* A failed search leaves the arrow keys on the oldest command */
+            hist_track = hist_oldest;
+            return NULL;
         }
     }
 
-    while(history->track != NULL) {
-            if(strncmp(prefix, history->track->val, strlen(prefix)) == 0) {
-                return history->track->val;
-            }
-            if(newer) {
-                history->track = history->track->next;
-            } else {
-                if(history->track == history->head) {
-                    break;
-                }
-                history->track = history->track->prev;
-            }
-    }
-
-    return NULL;
+    hist_track = found;
+    return found != 0
+        ? hist_text(found)
+        : NULL;
 }
 
 const char *hist_search_cnum(int command_number)
 {
-    /* If the command_number is between the id of head and tail */
-    if(history->head != NULL) {
-        if(command_number <= history->tail->id &&
-            command_number >= history->head->id) {
-            /* Calculate index of node in list with offset */
-            int offset = (history->total_id_count) - (history->list_sz);
-            /* -1 to turn command_number into index num */
-            return get_node(history, command_number - offset - 1)->val;
-        }
+    if(command_number < 1 || !hist_holds(command_number)) {
+        return NULL;
     }
-    return NULL;
+    /* Looking up an entry also moves the arrow keys onto it */
+    hist_track = command_number;
+    return hist_text(command_number);
 }
 
 void hist_track_clear() {
-    history->track = NULL;
+    hist_track = 0;
 }
 
 const char *hist_track_val() {
-    return history->track != NULL
-        ? history->track->val
+    return hist_track != 0
+        ? hist_text(hist_track)
         : NULL;
 }
 
 const char *hist_track_prev_val() {
-    if(history->track != NULL && history->track->prev != NULL) {
-        history->track = history->track->prev;
-        return history->track->val;
+    if(hist_track != 0 && hist_track > hist_oldest) {
+        hist_track -= 1;
+        return hist_text(hist_track);
     }
     return NULL;
 }
 
 const char *hist_track_next_val(){
-    if(history->track != NULL && /*(history->track = */history->track->next/*)*/ != NULL) {
-        history->track = history->track->next;
-        return history->track->val;
+    if(hist_track != 0 && hist_track < hist_last) {
+        hist_track += 1;
+        return hist_text(hist_track);
     }
     return NULL;
 }
 
 unsigned int hist_oldest_cnum(void) {
-    return history != NULL && history->head != NULL
-        ? history->head->id
+    return hist_count > 0
+        ? hist_oldest
         : -1;
 }
 
 unsigned int hist_last_cnum(void)
 {
-    return history != NULL && history->tail != NULL
-        ? history->tail->id
+    return hist_count > 0
+        ? hist_last
         : -1;
 }
 
 unsigned int hist_track_cnum(void) {
-    return history != NULL && history->track != NULL
-        ? history->track->id
+    return hist_track != 0
+        ? hist_track
         : -1;
 }
@@ -9,6 +9,9 @@
 
 void hist_init(unsigned int);
 void hist_destroy(void);
+void hist_open(const char *path);
+void hist_share(const char *path);
+void hist_sync(void);
 void hist_add(const char *);
 void hist_remove(int command_number);
 void hist_print(void);
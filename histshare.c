@@ -0,0 +1,256 @@
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "histshare.h"
+#include "logger.h"
+
+#define HISTSHARE_MAGIC "FISHRNG1"
+/* Number of slots in a new ring, a power of two */
+#define HISTSHARE_SLOTS 4096
+/* Size of a slot, commands that don't fit are not shared */
+#define HISTSHARE_SLOT_SIZE 512
+/* A slot still being written holds up readers, unless this many newer slots
+ * have been reserved since (its writer probably died) */
+#define HISTSHARE_PATIENCE 64
+/* A writer a lap ahead waits this long (ns) for a slot still being written
+ * before it takes the slot over; writing a slot takes microseconds, so its
+ * writer died or was stopped */
+#define HISTSHARE_STALE_NS 50000000
+
+struct share_header {
+    char magic[8];
+    uint32_t slot_count;
+    uint32_t slot_size;
+    /* Sequence number the next append reserves */
+    _Atomic uint64_t head;
+};
+
+/* The stamp tells what a slot holds: 2 * (seq + 1) once the command with
+ * sequence number seq is complete, one less while it is being written. A
+ * reader copies the command out and then checks that the stamp didn't
+ * change, so it never needs to lock out writers. */
+struct share_slot {
+    _Atomic uint64_t stamp;
+    uint32_t session;
+    uint32_t len;
+    char text[];
+};
+
+static struct share_header *ring = NULL;
+static size_t ring_size = 0;
+static uint32_t session = 0;
+/* Sequence number of the next command to read from the ring */
+static uint64_t next_seq = 0;
+
+static struct share_slot *ring_slot(uint64_t seq)
+{
+    size_t idx = seq & (ring->slot_count - 1);
+    return (struct share_slot *) ((char *) (ring + 1) + idx * ring->slot_size);
+}
+
+static size_t slot_text_max(void)
+{
+    return ring->slot_size - sizeof(struct share_slot);
+}
+
+/**
+ * Maps the shared ring, creating it if needed. Only commands appended from
+ * now on are picked up.
+ *
+ * @param path location of the ring file
+ * @return 0 on success, -1 if the ring cannot be used
+ */
+int histshare_open(const char *path)
+{
+    histshare_close();
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(fd == -1) {
+        perror("history");
+        return -1;
+    }
+
+    /* The lock is only held while setting up, so that two sessions starting
+     * together don't both initialize the ring */
+    flock(fd, LOCK_EX);
+    struct stat st;
+    size_t size = sizeof(struct share_header) + (size_t) HISTSHARE_SLOTS * HISTSHARE_SLOT_SIZE;
+    if(fstat(fd, &st) == 0 && st.st_size == 0) {
+        struct share_header header = { HISTSHARE_MAGIC, HISTSHARE_SLOTS, HISTSHARE_SLOT_SIZE };
+        if(ftruncate(fd, size) == -1 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+            perror("history");
+            close(fd);
+            return -1;
+        }
+        st.st_size = size;
+    }
+
+    struct share_header *map = MAP_FAILED;
+    if(st.st_size >= sizeof(struct share_header)) {
+        map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    if(map == MAP_FAILED || memcmp(map->magic, HISTSHARE_MAGIC, sizeof(map->magic)) != 0
+            || map->slot_count == 0 || (map->slot_count & (map->slot_count - 1)) != 0
+            || map->slot_size <= sizeof(struct share_slot)
+            || sizeof(struct share_header) + (size_t) map->slot_count * map->slot_size > st.st_size) {
+        fprintf(stderr, "history: %s is not a shared history file\n", path);
+        if(map != MAP_FAILED) {
+            munmap(map, st.st_size);
+        }
+        return -1;
+    }
+
+    ring = map;
+    ring_size = st.st_size;
+    session = getpid();
+    next_seq = atomic_load(&ring->head);
+    LOG("Sharing history through %s from command %llu\n", path, (unsigned long long) next_seq);
+    return 0;
+}
+
+/**
+ * Gives a monotonic time in nanoseconds.
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Publishes a command to the other sessions. A slot is reserved by bumping
+ * the ring's head, so writers never wait for each other.
+ *
+ * @param cmd command string
+ */
+void histshare_append(const char *cmd)
+{
+    if(ring == NULL) {
+        return;
+    }
+    size_t len = strlen(cmd);
+    if(len >= slot_text_max()) {
+        LOG("Command too long to share (%zu bytes)\n", len);
+        return;
+    }
+
+    uint64_t seq = atomic_fetch_add(&ring->head, 1);
+    struct share_slot *slot = ring_slot(seq);
+    uint64_t done = 2 * (seq + 1);
+
+    /* The slot's previous command is normally complete. Only if a writer a
+     * whole lap behind is still at it does this have to wait, for at most
+     * HISTSHARE_STALE_NS: a writer that died in the slot never finishes, so
+     * the slot is then taken over from it. If a newer lap already took the
+     * slot, this command is dropped. */
+    uint64_t stamp = atomic_load(&slot->stamp);
+    uint64_t waiting_since = 0;
+    while(true) {
+        if(stamp >= done - 1) {
+            return;
+        }
+        if(stamp % 2 == 1) {
+            uint64_t now = now_ns();
+            if(waiting_since == 0) {
+                waiting_since = now;
+            }
+            if(now - waiting_since < HISTSHARE_STALE_NS) {
+                sched_yield();
+                stamp = atomic_load(&slot->stamp);
+                continue;
+            }
+            LOG("Taking over the slot of shared command %llu from a writer that stopped\n",
+                    (unsigned long long) (stamp / 2));
+        }
+        if(atomic_compare_exchange_weak(&slot->stamp, &stamp, done - 1)) {
+            break;
+        }
+    }
+
+    slot->session = session;
+    slot->len = len;
+    memcpy(slot->text, cmd, len + 1);
+    /* Only published if the slot was not taken over meanwhile */
+    uint64_t writing = done - 1;
+    if(!atomic_compare_exchange_strong_explicit(&slot->stamp, &writing, done,
+                memory_order_release, memory_order_relaxed)) {
+        LOG("Shared history slot was taken over, command %llu dropped\n", (unsigned long long) seq);
+    }
+}
+
+/**
+ * Reads the commands other sessions appended since the last call.
+ *
+ * @param add called with each new command, oldest first
+ */
+void histshare_sync(void (*add)(const char *cmd))
+{
+    if(ring == NULL) {
+        return;
+    }
+
+    char text[HISTSHARE_SLOT_SIZE];
+    uint64_t head = atomic_load(&ring->head);
+    if(head - next_seq > ring->slot_count) {
+        /* Commands older than a lap were overwritten already */
+        next_seq = head - ring->slot_count;
+    }
+
+    for(; next_seq < head; next_seq++) {
+        struct share_slot *slot = ring_slot(next_seq);
+        uint64_t done = 2 * (next_seq + 1);
+        uint64_t stamp = atomic_load_explicit(&slot->stamp, memory_order_acquire);
+        if(stamp < done) {
+            if(head - next_seq > HISTSHARE_PATIENCE) {
+                continue;
+            }
+            /* Still being written, pick it up next time */
+            break;
+        }
+        if(stamp > done) {
+            /* Overwritten by a later lap */
+            continue;
+        }
+
+        uint32_t from = slot->session;
+        size_t len = slot->len;
+        if(len >= sizeof(text) || len >= slot_text_max()) {
+            continue;
+        }
+        memcpy(text, slot->text, len);
+        text[len] = '\0';
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&slot->stamp, memory_order_relaxed) != done) {
+            continue;
+        }
+
+        if(from != session) {
+            add(text);
+        }
+    }
+}
+
+/**
+ * Unmaps the shared ring.
+ */
+void histshare_close(void)
+{
+    if(ring != NULL) {
+        munmap(ring, ring_size);
+        ring = NULL;
+    }
+}
@@ -0,0 +1,17 @@
+/**
+ * @file
+ *
+ * Shares history between sessions on the same host through a ring of slots
+ * in a memory-mapped file. Sessions append without taking a lock, and pick
+ * up each other's commands when asked to.
+ */
+
+#ifndef _HISTSHARE_H_
+#define _HISTSHARE_H_
+
+int histshare_open(const char *path);
+void histshare_append(const char *cmd);
+void histshare_sync(void (*add)(const char *cmd));
+void histshare_close(void);
+
+#endif
@@ -0,0 +1,290 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+#include "logger.h"
+
+/* Size of an arena chunk. Longer strings get a chunk of their own. */
+#define INTERN_CHUNK 65536
+/* Initial number of buckets in the lookup table, doubled as it fills up */
+#define INTERN_BUCKETS 256
+
+/* An interned string. Ids index the entry table, 0 is never handed out. An
+ * entry with no references is free and links to the next free one. */
+struct intern_entry {
+    char *str;
+    unsigned int len;
+    unsigned int hash;
+    unsigned int refs;
+    unsigned int next;      /* Next id in the same bucket, or the next free id */
+};
+
+/* Arena chunks are filled front to back and never reuse space: strings that
+ * are no longer referenced stay in place until the arena is compacted. */
+struct intern_chunk {
+    struct intern_chunk *prev;
+    size_t used;
+    size_t cap;
+    char data[];
+};
+
+static struct intern_chunk *chunk = NULL;
+static struct intern_entry *entries = NULL;
+static unsigned int entry_count = 1;
+static unsigned int entry_cap = 0;
+static unsigned int free_id = 0;
+static unsigned int *buckets = NULL;
+static unsigned int bucket_count = 0;
+static unsigned int live_count = 0;
+static size_t live_bytes = 0;
+static size_t dead_bytes = 0;
+
+/**
+ * Hashes a string (FNV-1a).
+ */
+static unsigned int intern_hash(const char *str, size_t len)
+{
+    unsigned int hash = 2166136261u;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Reserves space for a string at the end of the arena.
+ */
+static char *intern_chunk_alloc(size_t size)
+{
+    if(chunk == NULL || chunk->cap - chunk->used < size) {
+        size_t cap = size > INTERN_CHUNK ? size : INTERN_CHUNK;
+        struct intern_chunk *fresh = malloc(sizeof(struct intern_chunk) + cap);
+        fresh->prev = chunk;
+        fresh->used = 0;
+        fresh->cap = cap;
+        chunk = fresh;
+    }
+    char *space = chunk->data + chunk->used;
+    chunk->used += size;
+    return space;
+}
+
+/**
+ * Frees a list of chunks, starting from its newest one.
+ */
+static void intern_chunk_free(struct intern_chunk *last)
+{
+    while(last != NULL) {
+        struct intern_chunk *prev = last->prev;
+        free(last);
+        last = prev;
+    }
+}
+
+/**
+ * Moves every live string into fresh chunks, dropping the space of the ones
+ * no longer referenced. Ids stay the same, only the strings move.
+ */
+static void intern_compact(void)
+{
+    LOG("Compacting history arena: %zu bytes live, %zu dead\n", live_bytes, dead_bytes);
+    struct intern_chunk *old = chunk;
+    chunk = NULL;
+    for(unsigned int id = 1; id < entry_count; id++) {
+        struct intern_entry *entry = &entries[id];
+        if(entry->refs > 0) {
+            char *str = intern_chunk_alloc(entry->len + 1);
+            memcpy(str, entry->str, entry->len + 1);
+            entry->str = str;
+        }
+    }
+    intern_chunk_free(old);
+    dead_bytes = 0;
+}
+
+/**
+ * Rebuilds the lookup table with a number of buckets, hashing every live
+ * string into it.
+ */
+static void buckets_rebuild(unsigned int count)
+{
+    free(buckets);
+    buckets = calloc(count, sizeof(unsigned int));
+    bucket_count = count;
+    for(unsigned int id = 1; id < entry_count; id++) {
+        struct intern_entry *entry = &entries[id];
+        if(entry->refs > 0) {
+            unsigned int *bucket = &buckets[entry->hash % bucket_count];
+            entry->next = *bucket;
+            *bucket = id;
+        }
+    }
+}
+
+/**
+ * Makes room in the entry table for a number of new ids.
+ */
+static void entries_reserve(unsigned int count)
+{
+    if(entry_count + count > entry_cap) {
+        while(entry_count + count > entry_cap) {
+            entry_cap = entry_cap == 0 ? INTERN_BUCKETS : entry_cap * 2;
+        }
+        entries = realloc(entries, entry_cap * sizeof(struct intern_entry));
+    }
+}
+
+/**
+ * Stores a string, or adds a reference to the copy already stored.
+ *
+ * Strings only ever move inside this call, so the pointers intern_str() gives
+ * out stay valid until the next intern_add(), even if their string is
+ * released in between.
+ *
+ * @param str string to store
+ * @return id of the stored string
+ */
+unsigned int intern_add(const char *str)
+{
+    size_t len = strlen(str);
+    unsigned int hash = intern_hash(str, len);
+    if(bucket_count > 0) {
+        for(unsigned int id = buckets[hash % bucket_count]; id != 0; id = entries[id].next) {
+            struct intern_entry *entry = &entries[id];
+            if(entry->hash == hash && entry->len == len && memcmp(entry->str, str, len) == 0) {
+                entry->refs += 1;
+                return id;
+            }
+        }
+    }
+
+    if(dead_bytes >= INTERN_CHUNK && dead_bytes > live_bytes) {
+        intern_compact();
+    }
+    if(live_count >= bucket_count) {
+        buckets_rebuild(bucket_count == 0 ? INTERN_BUCKETS : bucket_count * 2);
+    }
+
+    unsigned int id = free_id;
+    if(id != 0) {
+        free_id = entries[id].next;
+    } else {
+        entries_reserve(1);
+        id = entry_count++;
+    }
+
+    struct intern_entry *entry = &entries[id];
+    entry->str = intern_chunk_alloc(len + 1);
+    memcpy(entry->str, str, len + 1);
+    entry->len = len;
+    entry->hash = hash;
+    entry->refs = 1;
+    entry->next = buckets[hash % bucket_count];
+    buckets[hash % bucket_count] = id;
+    live_count += 1;
+    live_bytes += len + 1;
+    return id;
+}
+
+/**
+ * Stores many strings at once, as loading a saved history does: their text
+ * goes into one chunk and the lookup table is built once, sized for all of
+ * them. The strings have to be distinct; they are only looked up among the
+ * ones already stored, one at a time, if there are any.
+ *
+ * @param strs strings to store
+ * @param count number of strings
+ * @param ids receives the id of each string
+ */
+void intern_add_all(const char *strs[], unsigned int count, unsigned int ids[])
+{
+    if(count == 0 || live_count > 0 || free_id != 0) {
+        for(unsigned int i = 0; i < count; i++) {
+            ids[i] = intern_add(strs[i]);
+        }
+        return;
+    }
+
+    entries_reserve(count);
+    size_t bytes = 0;
+    for(unsigned int i = 0; i < count; i++) {
+        entries[entry_count + i].len = strlen(strs[i]);
+        bytes += entries[entry_count + i].len + 1;
+    }
+
+    char *space = intern_chunk_alloc(bytes);
+    for(unsigned int i = 0; i < count; i++) {
+        struct intern_entry *entry = &entries[entry_count];
+        memcpy(space, strs[i], entry->len + 1);
+        entry->str = space;
+        entry->hash = intern_hash(space, entry->len);
+        entry->refs = 1;
+        space += entry->len + 1;
+        ids[i] = entry_count++;
+    }
+    live_count += count;
+    live_bytes += bytes;
+
+    unsigned int buckets_needed = bucket_count == 0 ? INTERN_BUCKETS : bucket_count;
+    while(buckets_needed <= live_count) {
+        buckets_needed *= 2;
+    }
+    buckets_rebuild(buckets_needed);
+}
+
+/**
+ * Gives the string stored under an id.
+ *
+ * @param id id returned by intern_add()
+ * @return the string
+ */
+const char *intern_str(unsigned int id)
+{
+    return entries[id].str;
+}
+
+/**
+ * Drops a reference to a string. Once nothing refers to it, its id is reused
+ * and its space is reclaimed when the arena is next compacted.
+ *
+ * @param id id returned by intern_add()
+ */
+void intern_release(unsigned int id)
+{
+    struct intern_entry *entry = &entries[id];
+    entry->refs -= 1;
+    if(entry->refs > 0) {
+        return;
+    }
+
+    unsigned int *link = &buckets[entry->hash % bucket_count];
+    while(*link != id) {
+        link = &entries[*link].next;
+    }
+    *link = entry->next;
+
+    entry->next = free_id;
+    free_id = id;
+    live_count -= 1;
+    live_bytes -= entry->len + 1;
+    dead_bytes += entry->len + 1;
+}
+
+/**
+ * Frees every stored string.
+ */
+void intern_clear(void)
+{
+    intern_chunk_free(chunk);
+    free(entries);
+    free(buckets);
+    chunk = NULL;
+    entries = NULL;
+    buckets = NULL;
+    entry_count = 1;
+    entry_cap = bucket_count = 0;
+    free_id = live_count = 0;
+    live_bytes = dead_bytes = 0;
+}
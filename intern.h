@@ -0,0 +1,18 @@
+/**
+ * @file
+ *
+ * Interned string storage for the history. Each distinct command is stored
+ * once, in large arena chunks, and referred to by a small id; repeated
+ * commands only bump a reference count.
+ */
+
+#ifndef _INTERN_H_
+#define _INTERN_H_
+
+unsigned int intern_add(const char *str);
+void intern_add_all(const char *strs[], unsigned int count, unsigned int ids[]);
+const char *intern_str(unsigned int id);
+void intern_release(unsigned int id);
+void intern_clear(void);
+
+#endif
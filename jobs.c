@@ -0,0 +1,1037 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "jobs.h"
+#include "logger.h"
+
+/* Buckets the process table starts with; it doubles whenever it holds more
+ * processes than buckets */
+#define JOBS_BUCKETS_MIN 64
+/* Environment variable overriding the limit of jobs running at once */
+#define JOBS_LIMIT_ENV "FISH_JOBS"
+/* Finished background jobs remembered for wait and jobs; past this many the
+ * oldest is forgotten */
+#define JOBS_DONE_MAX 256
+/* Finished jobs and processes kept for reuse, so that running a command
+ * takes nothing from the heap once the shell has run a few */
+#define JOBS_FREE_MAX 64
+/* Wait status of a process that could not be launched */
+#define JOBS_LAUNCH_FAILED (EXIT_FAILURE << 8)
+
+static struct job_proc **buckets = NULL;
+static size_t bucket_count = 0;
+static unsigned int bucket_bits = 0;
+static size_t proc_count = 0;
+/* Jobs in the order they were started */
+static struct job *first_job = NULL;
+static struct job *last_job = NULL;
+static size_t done_count = 0;
+/* Jobs and processes kept for reuse, linked through next. A kept job holds
+ * on to its command buffer. */
+static struct job *free_jobs = NULL;
+static struct job_proc *free_procs = NULL;
+static unsigned int free_job_count = 0;
+static unsigned int free_proc_count = 0;
+
+/* Starts the commands of jobs */
+static job_launcher launch = NULL;
+/* Most background jobs running at once, and how many are */
+static unsigned int limit = 1;
+static unsigned int running = 0;
+/* Jobs waiting for one of the running ones to finish, oldest first */
+static struct job *queue_head = NULL;
+static struct job *queue_tail = NULL;
+
+/* The SIGCHLD handler writes into chld_pipe[1]; the reaper drains [0] */
+static int chld_pipe[2] = { -1, -1 };
+
+/* Terminal the foreground job is given with job control on, or -1 */
+static int control_tty = -1;
+static pid_t shell_pgid = 0;
+static struct termios shell_tmodes;
+
+/**
+ * Notes that a child changed state. Reaping is left to jobs_reap(), so this
+ * stays async-signal-safe.
+ */
+static void chld_handler(int signo)
+{
+    int saved_errno = errno;
+    char byte = 0;
+    ssize_t unused = write(chld_pipe[1], &byte, 1);
+    (void) unused;
+    errno = saved_errno;
+}
+
+static size_t pid_bucket(pid_t pid)
+{
+    /* Fibonacci hashing, taking the top bits of the product */
+    return ((uint32_t) pid * 2654435769u) >> (32 - bucket_bits);
+}
+
+static void table_insert(struct job_proc *proc)
+{
+    size_t bucket = pid_bucket(proc->pid);
+    proc->hash_next = buckets[bucket];
+    buckets[bucket] = proc;
+}
+
+/**
+ * Doubles the number of buckets and moves every process to its new bucket.
+ */
+static void table_grow(void)
+{
+    size_t old_count = bucket_count;
+    struct job_proc **old = buckets;
+    bucket_count = old_count > 0 ? old_count * 2 : JOBS_BUCKETS_MIN;
+    bucket_bits = __builtin_ctzl(bucket_count);
+    buckets = calloc(bucket_count, sizeof(struct job_proc *));
+
+    for(size_t i = 0; i < old_count; i++) {
+        struct job_proc *proc = old[i];
+        while(proc != NULL) {
+            struct job_proc *next = proc->hash_next;
+            table_insert(proc);
+            proc = next;
+        }
+    }
+    free(old);
+}
+
+/**
+ * Takes a process out of the table. Its pid may be reused once it was
+ * reaped, so this happens as soon as it is done.
+ */
+static void table_remove(struct job_proc *proc)
+{
+    struct job_proc **link = &buckets[pid_bucket(proc->pid)];
+    while(*link != proc) {
+        link = &(*link)->hash_next;
+    }
+    *link = proc->hash_next;
+    proc_count -= 1;
+}
+
+/**
+ * Sets up the reaper: the pipe the SIGCHLD handler writes into, and the
+ * handler itself. The limit of jobs running at once comes from FISH_JOBS if
+ * it is set, and is the number of online CPUs otherwise.
+ *
+ * @param launcher function that starts the pipeline of a job
+ */
+void jobs_init(job_launcher launcher)
+{
+    LOG("Initializing background jobs table%s\n", "");
+    launch = launcher;
+
+    const char *env = getenv(JOBS_LIMIT_ENV);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    limit = cpus > 0 ? cpus : 1;
+    if(env != NULL && atoi(env) > 0) {
+        limit = atoi(env);
+    }
+
+    if(pipe2(chld_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        perror("pipe");
+        return;
+    }
+    table_grow();
+
+    struct sigaction act = { .sa_handler = chld_handler, .sa_flags = SA_RESTART };
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGCHLD, &act, NULL);
+}
+
+/**
+ * Turns on job control: the shell waits until it is in the foreground of the
+ * terminal, moves into a process group of its own and ignores the signals
+ * the terminal sends to stop it, which jobs get instead.
+ *
+ * @param tty_fd descriptor of the terminal
+ * @return whether job control is on
+ */
+bool jobs_control(int tty_fd)
+{
+    if(!isatty(tty_fd)) {
+        return false;
+    }
+    while(tcgetpgrp(tty_fd) != (shell_pgid = getpgrp())) {
+        kill(-shell_pgid, SIGTTIN);
+    }
+
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    /* Fails harmlessly when the shell already leads its session */
+    setpgid(0, 0);
+    shell_pgid = getpgrp();
+    if(tcsetpgrp(tty_fd, shell_pgid) == -1) {
+        perror("tcsetpgrp");
+        return false;
+    }
+    tcgetattr(tty_fd, &shell_tmodes);
+    control_tty = tty_fd;
+    LOG("Job control on, shell group %d\n", shell_pgid);
+    return true;
+}
+
+/**
+ * Gives the descriptor that becomes readable once a child changed state,
+ * for callers that wait on it with poll().
+ */
+int jobs_fd(void)
+{
+    return chld_pipe[0];
+}
+
+/**
+ * Changes the state of a job, keeping count of the background jobs that run
+ * and of the finished ones still remembered.
+ */
+static void job_set_state(struct job *job, enum job_state state, bool foreground)
+{
+    running -= !job->foreground && job->state == JOB_RUNNING;
+    done_count -= job->state == JOB_DONE;
+    if(state != job->state) {
+        job->notified = false;
+    }
+    job->state = state;
+    job->foreground = foreground;
+    running += !job->foreground && job->state == JOB_RUNNING;
+    done_count += job->state == JOB_DONE;
+}
+
+/**
+ * Stops tracking a job and frees it. It must not be queued.
+ */
+static void job_remove(struct job *job)
+{
+    running -= !job->foreground && job->state == JOB_RUNNING;
+    done_count -= job->state == JOB_DONE;
+
+    struct job_proc *proc = job->procs;
+    while(proc != NULL) {
+        struct job_proc *next = proc->next;
+        if(!proc->done) {
+            table_remove(proc);
+        }
+        if(free_proc_count < JOBS_FREE_MAX) {
+            proc->next = free_procs;
+            free_procs = proc;
+            free_proc_count += 1;
+        } else {
+            free(proc);
+        }
+        proc = next;
+    }
+
+    if(job->prev != NULL) {
+        job->prev->next = job->next;
+    } else {
+        first_job = job->next;
+    }
+    if(job->next != NULL) {
+        job->next->prev = job->prev;
+    } else {
+        last_job = job->prev;
+    }
+    if(job->out_fd != -1) {
+        close(job->out_fd);
+        close(job->err_fd);
+    }
+    free(job->argv);
+    if(free_job_count < JOBS_FREE_MAX) {
+        job->next = free_jobs;
+        free_jobs = job;
+        free_job_count += 1;
+    } else {
+        free(job->command);
+        free(job);
+    }
+}
+
+/**
+ * Gives a cleared job, reusing a finished one if there is any, with a copy of
+ * its command line.
+ */
+static struct job *job_alloc(const char *command)
+{
+    struct job *job = free_jobs;
+    char *buf = NULL;
+    size_t cap = 0;
+    if(job != NULL) {
+        free_jobs = job->next;
+        free_job_count -= 1;
+        buf = job->command;
+        cap = job->command_cap;
+        memset(job, 0, sizeof(struct job));
+    } else {
+        job = calloc(1, sizeof(struct job));
+    }
+
+    size_t size = strlen(command) + 1;
+    if(size > cap) {
+        free(buf);
+        cap = size;
+        buf = malloc(cap);
+    }
+    memcpy(buf, command, size);
+    job->command = buf;
+    job->command_cap = cap;
+    return job;
+}
+
+/**
+ * Whether a job is left for its owner to collect instead of being forgotten
+ * once it finished.
+ */
+static bool job_captured(const struct job *job)
+{
+    return job->out_fd != -1;
+}
+
+/**
+ * Copies what a queued job is to launch into one allocation: the argument
+ * pointers, then the kinds, then the strings.
+ */
+static void job_save(struct job *job, char *argv[], const unsigned char *kinds, int argc)
+{
+    size_t size = (argc + 1) * sizeof(char *) + argc;
+    for(int i = 0; i < argc; i++) {
+        size += strlen(argv[i]) + 1;
+    }
+
+    job->argv = malloc(size);
+    job->kinds = (unsigned char *) (job->argv + argc + 1);
+    memcpy(job->kinds, kinds, argc);
+    char *strings = (char *) job->kinds + argc;
+    for(int i = 0; i < argc; i++) {
+        size_t len = strlen(argv[i]) + 1;
+        memcpy(strings, argv[i], len);
+        job->argv[i] = strings;
+        strings += len;
+    }
+    job->argv[argc] = NULL;
+    job->argc = argc;
+}
+
+/**
+ * Takes a job out of the queue before its turn.
+ */
+static void queue_remove(struct job *job)
+{
+    struct job *prev = NULL;
+    for(struct job *cur = queue_head; cur != NULL; prev = cur, cur = cur->queue_next) {
+        if(cur != job) {
+            continue;
+        }
+        if(prev != NULL) {
+            prev->queue_next = job->queue_next;
+        } else {
+            queue_head = job->queue_next;
+        }
+        if(queue_tail == job) {
+            queue_tail = prev;
+        }
+        job->queue_next = NULL;
+        return;
+    }
+}
+
+/**
+ * Launches the pipeline of a job.
+ *
+ * @return whether any of its processes could be launched; if not, the job
+ *  is done
+ */
+static bool job_launch(struct job *job, char *argv[], const unsigned char *kinds, int argc)
+{
+    job->own_group = jobs_group(job) != NULL;
+    launch(job, argv, kinds, argc);
+    if(job->procs_left == 0) {
+        job->status = JOBS_LAUNCH_FAILED;
+        job_set_state(job, JOB_DONE, job->foreground);
+        return false;
+    }
+
+    job_set_state(job, JOB_RUNNING, job->foreground);
+    LOG("Job %d started: group %d, %s\n", job->id, job->group.pgid, job->command);
+    return true;
+}
+
+/**
+ * Launches queued jobs for as long as there are free slots.
+ */
+static void schedule(void)
+{
+    while(running < limit && queue_head != NULL) {
+        struct job *job = queue_head;
+        queue_head = job->queue_next;
+        if(queue_head == NULL) {
+            queue_tail = NULL;
+        }
+        job->queue_next = NULL;
+        job_launch(job, job->argv, job->kinds, job->argc);
+    }
+}
+
+/**
+ * Starts a job. A background job is queued instead if the limit of running
+ * jobs is reached; a foreground job is always launched at once and is to be
+ * waited for with jobs_foreground(). The output of a captured job is kept in
+ * memory until jobs_collect() writes it out.
+ *
+ * @param argv NULL terminated pipeline, redirections included
+ * @param kinds kind of each token in argv
+ * @param argc amount of tokens in argv
+ * @param command command line of the job, which is copied
+ * @param flags JOB_FOREGROUND if the shell waits for the job, JOB_CAPTURE to
+ *  capture its output, JOB_NOW to launch it whatever the limit
+ * @return the new job, or NULL if it could not be launched
+ */
+struct job *jobs_submit(char *argv[], const unsigned char *kinds, int argc,
+        const char *command, enum job_flags flags)
+{
+    bool foreground = flags & JOB_FOREGROUND;
+    struct job *job = job_alloc(command);
+    job->id = last_job != NULL ? last_job->id + 1 : 1;
+    job->state = JOB_QUEUED;
+    job->foreground = foreground;
+    job->out_fd = -1;
+    job->err_fd = -1;
+    job->collected = flags & JOB_CAPTURE;
+    if(flags & JOB_CAPTURE) {
+        job->out_fd = memfd_create("fish-out", MFD_CLOEXEC);
+        job->err_fd = memfd_create("fish-err", MFD_CLOEXEC);
+        if(job->out_fd == -1 || job->err_fd == -1) {
+            /* The output goes straight out instead */
+            perror("memfd_create");
+            if(job->out_fd != -1) {
+                close(job->out_fd);
+            }
+            if(job->err_fd != -1) {
+                close(job->err_fd);
+            }
+            job->out_fd = -1;
+            job->err_fd = -1;
+        }
+    }
+
+    job->prev = last_job;
+    if(last_job != NULL) {
+        last_job->next = job;
+    } else {
+        first_job = job;
+    }
+    last_job = job;
+
+    if(foreground || (flags & JOB_NOW) || (running < limit && queue_head == NULL)) {
+        if(!job_launch(job, argv, kinds, argc)) {
+            job_remove(job);
+            return NULL;
+        }
+        return job;
+    }
+
+    job_save(job, argv, kinds, argc);
+    if(queue_tail != NULL) {
+        queue_tail->queue_next = job;
+    } else {
+        queue_head = job;
+    }
+    queue_tail = job;
+    LOG("Job %d queued, %u running: %s\n", job->id, running, command);
+    return job;
+}
+
+/**
+ * Changes the limit of background jobs running at once, launching queued
+ * jobs if it went up.
+ *
+ * @param new_limit most jobs to run at once, at least 1
+ */
+void jobs_set_limit(unsigned int new_limit)
+{
+    limit = new_limit > 0 ? new_limit : 1;
+    schedule();
+}
+
+/**
+ * Gives the limit of background jobs running at once.
+ */
+unsigned int jobs_limit(void)
+{
+    return limit;
+}
+
+/**
+ * Adds a process the launcher started to the pipeline of a job. The first
+ * one gives the job its process group.
+ *
+ * @param job job being launched
+ * @param pid the process, or -1 if it could not be launched
+ */
+void jobs_add_proc(struct job *job, pid_t pid)
+{
+    struct job_proc *proc = free_procs;
+    if(proc != NULL) {
+        free_procs = proc->next;
+        free_proc_count -= 1;
+        memset(proc, 0, sizeof(struct job_proc));
+    } else {
+        proc = calloc(1, sizeof(struct job_proc));
+    }
+    proc->pid = pid;
+    proc->job = job;
+    if(job->last_proc != NULL) {
+        job->last_proc->next = proc;
+    } else {
+        job->procs = proc;
+    }
+    job->last_proc = proc;
+
+    if(pid == -1) {
+        proc->done = true;
+        proc->status = JOBS_LAUNCH_FAILED;
+        return;
+    }
+    if(job->group.pgid == 0) {
+        job->group.pgid = pid;
+    }
+    if(proc_count >= bucket_count) {
+        table_grow();
+    }
+    table_insert(proc);
+    proc_count += 1;
+    job->procs_left += 1;
+}
+
+/**
+ * Gives the process group the next process of a job is launched into. Jobs
+ * run in groups of their own, except for foreground jobs without job
+ * control, which stay in the shell's group so the terminal's signals reach
+ * them.
+ *
+ * @return the group, or NULL to stay in the shell's
+ */
+const struct spawn_group *jobs_group(struct job *job)
+{
+    if(job->foreground && control_tty == -1) {
+        return NULL;
+    }
+    job->group.tty_fd = job->foreground ? control_tty : -1;
+    return &job->group;
+}
+
+/**
+ * Finds the job a process runs in.
+ *
+ * @param pid process to look for
+ * @return the job, or NULL if the process isn't part of a job
+ */
+struct job *jobs_find(pid_t pid)
+{
+    if(bucket_count == 0) {
+        return NULL;
+    }
+    struct job_proc *proc = buckets[pid_bucket(pid)];
+    while(proc != NULL && proc->pid != pid) {
+        proc = proc->hash_next;
+    }
+    return proc != NULL ? proc->job : NULL;
+}
+
+/**
+ * Finds a job by its job spec: %n for job n, or %, %% or %+ (or no spec at
+ * all) for the most recent job.
+ *
+ * @param spec job spec, or NULL
+ * @return the job, or NULL if there is no such job
+ */
+struct job *jobs_get(const char *spec)
+{
+    if(spec == NULL || strcmp(spec, "%") == 0 || strcmp(spec, "%%") == 0
+            || strcmp(spec, "%+") == 0) {
+        return last_job;
+    }
+    if(spec[0] != '%') {
+        return NULL;
+    }
+
+    int id = atoi(spec + 1);
+    for(struct job *job = first_job; job != NULL; job = job->next) {
+        if(job->id == id) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static int job_signal(struct job *job, int signo);
+
+/**
+ * Records that a process of a job changed state, and works out the state of
+ * the job from those of its processes. A job submitted with JOB_CAPTURE that
+ * stops is killed instead.
+ */
+static void proc_changed(pid_t pid, int status)
+{
+    struct job_proc *proc = buckets[pid_bucket(pid)];
+    while(proc != NULL && proc->pid != pid) {
+        proc = proc->hash_next;
+    }
+    if(proc == NULL) {
+        LOG("Reaped %d, which is not part of a job\n", pid);
+        return;
+    }
+
+    struct job *job = proc->job;
+    if(WIFSTOPPED(status)) {
+        job->procs_stopped += !proc->stopped;
+        proc->stopped = true;
+        job->status = status;
+    } else if(WIFCONTINUED(status)) {
+        job->procs_stopped -= proc->stopped;
+        proc->stopped = false;
+    } else {
+        job->procs_stopped -= proc->stopped;
+        proc->stopped = false;
+        proc->done = true;
+        proc->status = status;
+        job->procs_left -= 1;
+        table_remove(proc);
+    }
+
+    enum job_state state = JOB_RUNNING;
+    if(job->procs_left == 0) {
+        state = JOB_DONE;
+        job->status = job->last_proc->status;
+    } else if(job->procs_stopped == job->procs_left) {
+        state = JOB_STOPPED;
+    }
+    if(state == JOB_STOPPED && job->collected) {
+        /* Nothing can continue a job whose caller is waiting for it, and the
+         * output of the jobs after it would wait forever */
+        fprintf(stderr, "fish: job %d stopped, killing it: %s\n", job->id, job->command);
+        job_signal(job, SIGKILL);
+        state = JOB_RUNNING;
+    }
+    LOG("Process %d of job %d changed, status %d\n", pid, job->id, status);
+    job_set_state(job, state, job->foreground);
+}
+
+/**
+ * Reaps children until a job is no longer queued or running, blocking in
+ * waitpid(). Whatever other children change state meanwhile is recorded
+ * too, and queued jobs are launched as slots free.
+ */
+static void job_block(struct job *job)
+{
+    while(job->state == JOB_QUEUED || job->state == JOB_RUNNING) {
+        int status;
+        pid_t pid = waitpid(-1, &status, WUNTRACED | WCONTINUED);
+        if(pid == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            LOG("Job %d has no children left to wait for\n", job->id);
+            break;
+        }
+        proc_changed(pid, status);
+        schedule();
+    }
+}
+
+/**
+ * Sends a signal to every process of a job.
+ */
+static int job_signal(struct job *job, int signo)
+{
+    if(job->own_group) {
+        return killpg(job->group.pgid, signo);
+    }
+    int result = 0;
+    for(struct job_proc *proc = job->procs; proc != NULL; proc = proc->next) {
+        if(!proc->done && kill(proc->pid, signo) == -1) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/**
+ * Continues a stopped job.
+ */
+static void job_continue(struct job *job, bool foreground)
+{
+    for(struct job_proc *proc = job->procs; proc != NULL; proc = proc->next) {
+        proc->stopped = false;
+    }
+    job->procs_stopped = 0;
+    job_set_state(job, JOB_RUNNING, foreground);
+    job_signal(job, SIGCONT);
+}
+
+/**
+ * Prints one line of the jobs list.
+ */
+static void job_print(struct job *job)
+{
+    char state[16];
+    if(job->state == JOB_QUEUED) {
+        strcpy(state, "Queued");
+    } else if(job->state == JOB_RUNNING) {
+        strcpy(state, "Running");
+    } else if(job->state == JOB_STOPPED) {
+        strcpy(state, "Stopped");
+    } else if(WIFSIGNALED(job->status)) {
+        snprintf(state, sizeof(state), "Signal %d", WTERMSIG(job->status));
+    } else if(WEXITSTATUS(job->status) != 0) {
+        snprintf(state, sizeof(state), "Exit %d", WEXITSTATUS(job->status));
+    } else {
+        strcpy(state, "Done");
+    }
+
+    if(job->group.pgid == 0) {
+        printf("[%d] %-8s %7s  %s\n", job->id, state, "-", job->command);
+    } else {
+        printf("[%d] %-8s %7d  %s\n", job->id, state, job->group.pgid, job->command);
+    }
+    job->notified = true;
+}
+
+/**
+ * Runs a job in the foreground until it finishes or is stopped: a queued job
+ * is launched, a stopped one continued. With job control on, the job is
+ * given the terminal, and the shell takes it back afterwards.
+ *
+ * @param job job to run
+ * @return wait status of the job, or of the signal that stopped it
+ */
+int jobs_foreground(struct job *job)
+{
+    if(job->state == JOB_QUEUED) {
+        queue_remove(job);
+        job->foreground = true;
+        if(!job_launch(job, job->argv, job->kinds, job->argc)) {
+            job_remove(job);
+            return JOBS_LAUNCH_FAILED;
+        }
+    }
+
+    if(control_tty != -1 && job->own_group) {
+        tcsetpgrp(control_tty, job->group.pgid);
+        if(job->state == JOB_STOPPED && job->has_tmodes) {
+            tcsetattr(control_tty, TCSADRAIN, &job->tmodes);
+        }
+    }
+    if(job->state == JOB_STOPPED) {
+        job_continue(job, true);
+    } else {
+        job_set_state(job, job->state, true);
+    }
+    /* A background job may have moved to the foreground, freeing a slot */
+    schedule();
+
+    job_block(job);
+
+    if(control_tty != -1) {
+        if(job->state == JOB_STOPPED) {
+            job->has_tmodes = tcgetattr(control_tty, &job->tmodes) == 0;
+        }
+        tcsetpgrp(control_tty, shell_pgid);
+        tcsetattr(control_tty, TCSADRAIN, &shell_tmodes);
+        /* The interrupt went to the job, so the prompt moves on by itself */
+        if(job->state == JOB_DONE && WIFSIGNALED(job->status) && WTERMSIG(job->status) == SIGINT) {
+            printf("\n");
+        }
+    }
+
+    int status = job->status;
+    if(job->state == JOB_STOPPED) {
+        job_set_state(job, JOB_STOPPED, false);
+        printf("\n");
+        job_print(job);
+        fflush(stdout);
+    } else {
+        job_remove(job);
+    }
+    return status;
+}
+
+/**
+ * Continues a stopped job in the background.
+ *
+ * @param job job to continue
+ */
+void jobs_background(struct job *job)
+{
+    if(job->state == JOB_STOPPED) {
+        job_continue(job, false);
+    }
+}
+
+/**
+ * Waits for a job to finish, reaping whatever else finishes meanwhile. A
+ * queued job is waited for until it was launched and has finished; a stopped
+ * job is not waited for.
+ *
+ * @param job job to wait for
+ * @return wait status of the job
+ */
+int jobs_wait(struct job *job)
+{
+    job_block(job);
+    int status = job->status;
+    if(job->state == JOB_DONE && !job_captured(job)) {
+        job_remove(job);
+    }
+    return status;
+}
+
+/**
+ * Waits for every queued and running background job to finish, and forgets
+ * the finished ones that are not captured.
+ *
+ * @return 0
+ */
+int jobs_wait_all(void)
+{
+    struct job *job = first_job;
+    while(job != NULL) {
+        job_block(job);
+        struct job *next = job->next;
+        if(job->state == JOB_DONE && !job->foreground && !job_captured(job)) {
+            job_remove(job);
+        }
+        job = next;
+    }
+    return 0;
+}
+
+/**
+ * Sends a signal to a job. A stopped job is also continued so it can act on
+ * the signal, and a queued job is taken out of the queue without ever
+ * running.
+ *
+ * @param job job to signal
+ * @param signo signal to send
+ * @return 0, or -1 if the signal could not be sent
+ */
+int jobs_kill(struct job *job, int signo)
+{
+    if(job->state == JOB_QUEUED) {
+        queue_remove(job);
+        job_remove(job);
+        return 0;
+    }
+    if(job->state == JOB_DONE) {
+        return 0;
+    }
+
+    int result = job_signal(job, signo);
+    if(job->state == JOB_STOPPED && signo != SIGCONT && signo != SIGSTOP
+            && signo != SIGTSTP && signo != SIGTTIN && signo != SIGTTOU) {
+        job_signal(job, SIGCONT);
+    }
+    return result;
+}
+
+/**
+ * Writes out everything a captured job wrote into one of its memory files.
+ *
+ * @param fd memory file
+ * @param to descriptor the output goes to
+ */
+static void capture_write(int fd, int to)
+{
+    off_t size = lseek(fd, 0, SEEK_END);
+    off_t offset = 0;
+    while(offset < size) {
+        /* sendfile() copies within the kernel and advances offset itself */
+        ssize_t sent = sendfile(to, fd, &offset, size - offset);
+        if(sent <= 0) {
+            if(sent == -1 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+    }
+
+    /* Some descriptors take no sendfile(), copy whatever is left by hand */
+    char buf[65536];
+    ssize_t len;
+    while(offset < size && (len = pread(fd, buf, sizeof(buf), offset)) > 0) {
+        ssize_t written = write(to, buf, len);
+        if(written <= 0) {
+            if(written == -1 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        offset += written;
+    }
+}
+
+/**
+ * Waits for a captured job to finish, writes out its output, standard output
+ * first, then standard error, and forgets it. A job that was not captured is
+ * just waited for.
+ *
+ * @param job job to collect
+ * @return wait status of the job
+ */
+int jobs_collect(struct job *job)
+{
+    job_block(job);
+    int status = job->status;
+    if(job_captured(job)) {
+        fflush(stdout);
+        capture_write(job->out_fd, STDOUT_FILENO);
+        capture_write(job->err_fd, STDERR_FILENO);
+        close(job->out_fd);
+        close(job->err_fd);
+        job->out_fd = -1;
+        job->err_fd = -1;
+    }
+    if(job->state == JOB_DONE) {
+        job_remove(job);
+    }
+    return status;
+}
+
+/**
+ * Collects every child that changed state since the last call. Signals
+ * coalesce, so one byte in the pipe may stand for any number of children;
+ * waitpid() is called until none are left. Finished background jobs are
+ * remembered until they were reported, up to JOBS_DONE_MAX of them.
+ */
+void jobs_reap(void)
+{
+    char drain[64];
+    while(chld_pipe[0] != -1 && read(chld_pipe[0], drain, sizeof(drain)) > 0) {
+    }
+
+    pid_t pid;
+    int status;
+    while((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
+        proc_changed(pid, status);
+    }
+    schedule();
+
+    struct job *job = first_job;
+    while(done_count > JOBS_DONE_MAX && job != NULL) {
+        struct job *next = job->next;
+        /* A foreground job is removed by whoever waits for it */
+        if(job->state == JOB_DONE && !job->foreground && !job_captured(job)) {
+            job_remove(job);
+        }
+        job = next;
+    }
+}
+
+/**
+ * Waits until every queued job has been launched, reaping finished ones to
+ * make room. The jobs still running are left alone.
+ */
+void jobs_drain(void)
+{
+    while(queue_head != NULL) {
+        LOG("Waiting for a slot, %u running\n", running);
+        struct pollfd pfd = { .fd = chld_pipe[0], .events = POLLIN };
+        if(poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+            perror("poll");
+            return;
+        }
+        jobs_reap();
+    }
+}
+
+/**
+ * Reports the background jobs that finished or were stopped since they were
+ * last reported, and forgets the finished ones.
+ */
+void jobs_notify(void)
+{
+    struct job *job = first_job;
+    while(job != NULL) {
+        struct job *next = job->next;
+        if(!job->notified && (job->state == JOB_DONE || job->state == JOB_STOPPED)) {
+            job_print(job);
+        }
+        if(job->state == JOB_DONE && !job->foreground && !job_captured(job)) {
+            job_remove(job);
+        }
+        job = next;
+    }
+    fflush(stdout);
+}
+
+/**
+ * Prints every job with its state, oldest first, and forgets the finished
+ * ones.
+ */
+void jobs_print(void)
+{
+    struct job *job = first_job;
+    while(job != NULL) {
+        struct job *next = job->next;
+        job_print(job);
+        if(job->state == JOB_DONE && !job->foreground && !job_captured(job)) {
+            job_remove(job);
+        }
+        job = next;
+    }
+    fflush(stdout);
+}
+
+/**
+ * Stops tracking every job. The jobs themselves keep running.
+ */
+void jobs_destroy(void)
+{
+    queue_head = NULL;
+    queue_tail = NULL;
+    while(first_job != NULL) {
+        job_remove(first_job);
+    }
+    running = 0;
+    done_count = 0;
+    while(free_jobs != NULL) {
+        struct job *next = free_jobs->next;
+        free(free_jobs->command);
+        free(free_jobs);
+        free_jobs = next;
+    }
+    while(free_procs != NULL) {
+        struct job_proc *next = free_procs->next;
+        free(free_procs);
+        free_procs = next;
+    }
+    free_job_count = 0;
+    free_proc_count = 0;
+    free(buckets);
+    buckets = NULL;
+    bucket_count = 0;
+    bucket_bits = 0;
+    proc_count = 0;
+    for(int i = 0; i < 2; i++) {
+        if(chld_pipe[i] != -1) {
+            close(chld_pipe[i]);
+            chld_pipe[i] = -1;
+        }
+    }
+}
@@ -0,0 +1,116 @@
+/**
+ * @file
+ *
+ * Jobs and the reaper that collects them. A job is a pipeline, launched into
+ * a process group of its own so it can be stopped, continued and signalled as
+ * a whole. The SIGCHLD handler only writes a byte into a pipe; the shell
+ * reaps every child that changed state when it gets back to its own loop, as
+ * soon as the pipe is readable when it waits on it, or while it blocks on the
+ * jobs it waits for. Processes are kept in a hash table keyed by pid.
+ *
+ * At most a limited number of background jobs run at once, by default one
+ * per online CPU. Jobs started beyond the limit wait in a queue and are
+ * launched in the order they were started as running ones finish.
+ *
+ * With job control on, the foreground job owns the terminal and the shell
+ * takes it back once the job finishes or is stopped.
+ *
+ * The output of a job can be captured into memory files instead, to be
+ * written out once the job finished, so jobs that run at the same time can
+ * still have their output appear in the order they were started.
+ */
+
+#ifndef _JOBS_H_
+#define _JOBS_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <termios.h>
+
+#include "spawn.h"
+
+enum job_state {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE,
+};
+
+/* How jobs_submit() runs a job */
+enum job_flags {
+    JOB_BACKGROUND = 0,
+    JOB_FOREGROUND = 1 << 0,    /* The shell waits for it */
+    JOB_CAPTURE = 1 << 1,       /* Its output is kept until jobs_collect() */
+    JOB_NOW = 1 << 2,           /* Launched even past the limit of running jobs,
+                                   for callers that keep their own */
+};
+
+struct job;
+
+/* One process of the pipeline of a job */
+struct job_proc {
+    pid_t pid;                  /* -1 if it could not be launched */
+    int status;                 /* Wait status, once done */
+    bool done;
+    bool stopped;
+    struct job *job;
+    struct job_proc *next;      /* Next process of the pipeline */
+    struct job_proc *hash_next; /* Next process in the same bucket */
+};
+
+/* Launches the pipeline of a job, adding each process with jobs_add_proc() */
+typedef void (*job_launcher)(struct job *job, char *argv[], const unsigned char *kinds, int argc);
+
+struct job {
+    int id;                     /* Job number, one more than the last job's */
+    char *command;
+    size_t command_cap;         /* Bytes allocated for command */
+    enum job_state state;
+    bool foreground;
+    bool notified;              /* Whether its state was reported */
+    bool own_group;             /* Whether it runs in a group of its own */
+    bool collected;             /* Submitted with JOB_CAPTURE, for a caller
+                                   that waits for it in jobs_collect() */
+    int out_fd;                 /* Memory files holding its output when it */
+    int err_fd;                 /* is captured, or -1 */
+    int status;                 /* Wait status of the last process, once done,
+                                   or the one that stopped it */
+    struct spawn_group group;   /* pgid is 0 until a process was launched */
+    struct job_proc *procs;
+    struct job_proc *last_proc;
+    int procs_left;             /* Processes not done yet */
+    int procs_stopped;          /* Processes of those that are stopped */
+    struct termios tmodes;      /* Terminal modes it was stopped with */
+    bool has_tmodes;
+    char **argv;                /* What to launch, while queued */
+    unsigned char *kinds;
+    int argc;
+    struct job *queue_next;     /* Next job in the queue */
+    struct job *prev;           /* Jobs in the order they were started */
+    struct job *next;
+};
+
+void jobs_init(job_launcher launcher);
+bool jobs_control(int tty_fd);
+int jobs_fd(void);
+void jobs_set_limit(unsigned int limit);
+unsigned int jobs_limit(void);
+struct job *jobs_submit(char *argv[], const unsigned char *kinds, int argc,
+        const char *command, enum job_flags flags);
+void jobs_add_proc(struct job *job, pid_t pid);
+const struct spawn_group *jobs_group(struct job *job);
+struct job *jobs_find(pid_t pid);
+struct job *jobs_get(const char *spec);
+int jobs_foreground(struct job *job);
+void jobs_background(struct job *job);
+int jobs_wait(struct job *job);
+int jobs_wait_all(void);
+int jobs_kill(struct job *job, int signo);
+int jobs_collect(struct job *job);
+void jobs_reap(void);
+void jobs_drain(void);
+void jobs_notify(void);
+void jobs_print(void);
+void jobs_destroy(void);
+
+#endif
@@ -0,0 +1,483 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LEX_X86 1
+#else
+#define LEX_X86 0
+#endif
+
+#include "arena.h"
+#include "lex.h"
+#include "logger.h"
+
+/* Room is first made for one token per this many bytes of the line, and at
+ * least this many tokens */
+#define LEX_TOKENS_PER_BYTE 8
+#define LEX_TOKENS_MIN 64
+/* While lexing, the argv slots hold the token's offset in the word area
+ * shifted left by this many bits, with its kind in the bits below */
+#define LEX_KIND_BITS 3
+/* Bytes classified at a time. The copy of the line words are cut out of is
+ * followed by this much padding, so blocks may run past its end. */
+#define LEX_BLOCK 64
+
+/* Text of each operator, indexed by kind */
+static char *const op_text[] = { NULL, "|", "<", ">", ">>", "&" };
+
+/* Classification of the LEX_BLOCK bytes from base on, bit i standing for
+ * base[i] */
+struct lex_block {
+    const char *base;
+    uint64_t blank;     /* Spaces, tabs, carriage returns and newlines */
+    uint64_t special;   /* Blanks, operators, quotes, backslashes, # and NULs */
+};
+
+/* Fills in the masks of a block */
+typedef void (*classify_fn)(const char *base, struct lex_block *block);
+
+struct classifier {
+    const char *name;
+    classify_fn classify;
+};
+static const struct classifier *classifier = NULL;
+
+#define CLASS_BLANK 1
+#define CLASS_SPECIAL 2
+
+static const unsigned char char_class[256] = {
+    ['\0'] = CLASS_SPECIAL,
+    ['\t'] = CLASS_BLANK | CLASS_SPECIAL,
+    ['\n'] = CLASS_BLANK | CLASS_SPECIAL,
+    ['\r'] = CLASS_BLANK | CLASS_SPECIAL,
+    [' '] = CLASS_BLANK | CLASS_SPECIAL,
+    ['"'] = CLASS_SPECIAL,
+    ['#'] = CLASS_SPECIAL,
+    ['&'] = CLASS_SPECIAL,
+    ['\''] = CLASS_SPECIAL,
+    ['<'] = CLASS_SPECIAL,
+    ['>'] = CLASS_SPECIAL,
+    ['\\'] = CLASS_SPECIAL,
+    ['|'] = CLASS_SPECIAL,
+};
+
+static void classify_scalar(const char *base, struct lex_block *block)
+{
+    uint64_t blank = 0;
+    uint64_t special = 0;
+    for(int i = 0; i < LEX_BLOCK; i++) {
+        unsigned char class = char_class[(unsigned char) base[i]];
+        blank |= (uint64_t) (class & CLASS_BLANK) << i;
+        special |= (uint64_t) (class >> 1) << i;
+    }
+    block->blank = blank;
+    block->special = special;
+}
+
+static const struct classifier scalar_classifier = { "scalar", classify_scalar };
+
+#if LEX_X86
+/* SSE2 has no byte shuffle, so every special character gets a compare */
+__attribute__((target("sse2")))
+static void classify_sse2(const char *base, struct lex_block *block)
+{
+    uint64_t blank = 0;
+    uint64_t special = 0;
+    for(int i = 0; i < LEX_BLOCK; i += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *) (base + i));
+        __m128i b = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\t'))),
+                _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\r'))));
+        __m128i s = _mm_or_si128(
+                _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(c, _mm_setzero_si128()), _mm_cmpeq_epi8(c, _mm_set1_epi8('|'))),
+                    _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('<')), _mm_cmpeq_epi8(c, _mm_set1_epi8('>')))),
+                _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('&')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\''))),
+                    _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('"')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\\')))));
+        s = _mm_or_si128(s, _mm_cmpeq_epi8(c, _mm_set1_epi8('#')));
+        blank |= (uint64_t) (unsigned int) _mm_movemask_epi8(b) << i;
+        special |= (uint64_t) (unsigned int) _mm_movemask_epi8(_mm_or_si128(b, s)) << i;
+    }
+    block->blank = blank;
+    block->special = special;
+}
+
+static const struct classifier sse2_classifier = { "SSE2", classify_sse2 };
+
+/* AVX2 looks each byte's low and high nibble up in two tables and ANDs the
+ * results, so a byte is special when both nibbles share a bit:
+ *
+ *   bit   high nibble   low nibbles     characters
+ *   0x01  0             0 9 a d         NUL \t \n \r
+ *   0x02  2             0 2 3 6 7       space " # & '
+ *   0x04  3             c e             < >
+ *   0x08  5 7           c               \\ |
+ *   0x10  0             9 a d           \t \n \r (blank)
+ *   0x20  2             0               space (blank)
+ */
+#define NIBBLE_BLANK 0x30
+
+__attribute__((target("avx2")))
+static void classify_avx2(const char *base, struct lex_block *block)
+{
+    const __m256i low_table = _mm256_setr_epi8(
+            0x23, 0, 0x02, 0x02, 0, 0, 0x02, 0x02, 0, 0x11, 0x11, 0, 0x0c, 0x11, 0x04, 0,
+            0x23, 0, 0x02, 0x02, 0, 0, 0x02, 0x02, 0, 0x11, 0x11, 0, 0x0c, 0x11, 0x04, 0);
+    const __m256i high_table = _mm256_setr_epi8(
+            0x11, 0, 0x22, 0x04, 0, 0x08, 0, 0x08, 0, 0, 0, 0, 0, 0, 0, 0,
+            0x11, 0, 0x22, 0x04, 0, 0x08, 0, 0x08, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+
+    uint64_t blank = 0;
+    uint64_t special = 0;
+    for(int i = 0; i < LEX_BLOCK; i += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *) (base + i));
+        __m256i low = _mm256_shuffle_epi8(low_table, _mm256_and_si256(c, nibble));
+        __m256i high = _mm256_shuffle_epi8(high_table, _mm256_and_si256(_mm256_srli_epi16(c, 4), nibble));
+        __m256i bits = _mm256_and_si256(low, high);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_and_si256(bits, _mm256_set1_epi8(NIBBLE_BLANK)), zero);
+        __m256i s = _mm256_cmpeq_epi8(bits, zero);
+        blank |= (uint64_t) (unsigned int) ~_mm256_movemask_epi8(b) << i;
+        special |= (uint64_t) (unsigned int) ~_mm256_movemask_epi8(s) << i;
+    }
+    block->blank = blank;
+    block->special = special;
+}
+
+static const struct classifier avx2_classifier = { "AVX2", classify_avx2 };
+#endif
+
+/**
+ * Picks the widest classifier the CPU supports.
+ */
+static void classifier_init(void)
+{
+    classifier = &scalar_classifier;
+#if LEX_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        classifier = &avx2_classifier;
+    } else if(__builtin_cpu_supports("sse2")) {
+        classifier = &sse2_classifier;
+    }
+#endif
+    LOG("Using %s delimiter classifier\n", classifier->name);
+}
+
+/**
+ * Makes sure the block covers p, classifying the bytes from p on if not.
+ */
+static void block_at(struct lex_block *block, const char *p)
+{
+    if(p < block->base || p - block->base >= LEX_BLOCK) {
+        block->base = p;
+        classifier->classify(p, block);
+    }
+}
+
+/**
+ * Finds the first character from p on that is not a blank.
+ */
+static char *skip_blanks(struct lex_block *block, char *p)
+{
+    while(true) {
+        block_at(block, p);
+        uint64_t rest = ~block->blank >> (p - block->base);
+        if(rest != 0) {
+            return p + __builtin_ctzll(rest);
+        }
+        p += LEX_BLOCK - (p - block->base);
+    }
+}
+
+/**
+ * Finds the first special character from p on.
+ */
+static char *find_special(struct lex_block *block, char *p)
+{
+    while(true) {
+        block_at(block, p);
+        uint64_t rest = block->special >> (p - block->base);
+        if(rest != 0) {
+            return p + __builtin_ctzll(rest);
+        }
+        p += LEX_BLOCK - (p - block->base);
+    }
+}
+
+/**
+ * Cuts out the plain words from p on, i.e. those only separated by blanks,
+ * without looking at each character: the masks of a block give where all of
+ * its words start and end at once. This stops at the first special character
+ * that isn't a blank, and the word running into it is left alone.
+ *
+ * @param block block to classify with
+ * @param p start of a word
+ * @param words offsets in slots are relative to this
+ * @param slots receives a slot per word
+ * @param argc number of slots filled, updated
+ * @param cap number of slots there is room for
+ * @return where lexing goes on, p if no word could be cut out
+ */
+static char *plain_words(struct lex_block *block, char *p, const char *words,
+        uintptr_t *slots, size_t *argc, size_t cap)
+{
+    size_t n = *argc;
+    /* Whether the character before the window is part of a word */
+    uint64_t carry = 0;
+
+    while(n + LEX_BLOCK / 2 + 1 < cap) {
+        block_at(block, p);
+        int shift = p - block->base;
+        int width = LEX_BLOCK - shift;
+
+        /* Only the stretch up to the first special character that isn't a
+         * blank is looked at, which includes a # that may start a comment */
+        uint64_t blank = block->blank >> shift;
+        uint64_t stop = (block->special >> shift) & ~blank;
+        uint64_t stretch = stop != 0 ? (stop & -stop) - 1 : ~(uint64_t) 0 >> shift;
+        uint64_t solid = ~blank & stretch;
+        uint64_t follows = solid << 1 | carry;
+        uint64_t starts = solid & ~follows;
+        uint64_t ends = blank & stretch & follows;
+
+        while(starts != 0) {
+            slots[n++] = (p + __builtin_ctzll(starts) - words) << LEX_KIND_BITS | TOK_WORD;
+            starts &= starts - 1;
+        }
+        while(ends != 0) {
+            p[__builtin_ctzll(ends)] = '\0';
+            ends &= ends - 1;
+        }
+
+        if(stop != 0) {
+            /* A word running into the special character goes back to the
+             * caller whole, so that it is lexed in one go */
+            int at = __builtin_ctzll(stop);
+            if(follows >> at & 1) {
+                n -= 1;
+                *argc = n;
+                return (char *) words + (slots[n] >> LEX_KIND_BITS);
+            }
+            *argc = n;
+            return p + at;
+        }
+        carry = solid >> (width - 1);
+        p += width;
+    }
+
+    if(carry != 0) {
+        n -= 1;
+        p = (char *) words + (slots[n] >> LEX_KIND_BITS);
+    }
+    *argc = n;
+    return p;
+}
+
+/* Kind of the operator each character starts, '>' being completed to '>>'
+ * separately */
+static const unsigned char op_kind[256] = {
+    ['|'] = TOK_PIPE,
+    ['<'] = TOK_IN,
+    ['>'] = TOK_OUT,
+    ['&'] = TOK_BG,
+};
+
+/**
+ * Gives the kind of operator starting at p, or TOK_WORD if there is none.
+ */
+static enum token_kind operator_kind(const char *p)
+{
+    enum token_kind kind = op_kind[(unsigned char) *p];
+    return kind == TOK_OUT && p[1] == '>' ? TOK_APPEND : kind;
+}
+
+/**
+ * Makes the line's buffer at least size bytes long. Only offsets into the
+ * buffer survive a call.
+ */
+static void lex_reserve(struct cmdline *cmd, struct arena *arena, size_t size)
+{
+    if(size <= cmd->buf_sz) {
+        return;
+    }
+    if(size < cmd->buf_sz * 2) {
+        size = cmd->buf_sz * 2;
+    }
+    cmd->buf = arena_grow(arena, cmd->buf, cmd->buf_sz, size);
+    cmd->buf_sz = size;
+}
+
+/**
+ * Lexes a line in one pass. Words have their quotes and escapes removed:
+ * single quotes keep everything up to the next single quote, double quotes
+ * honour \" and \\ inside, and a backslash anywhere else takes the next
+ * character literally. |, <, >, >> and & are operators even without blanks
+ * around them, and a # at the start of a word comments out the rest of the
+ * line.
+ *
+ * The line is classified a block at a time into bitmasks of blanks and
+ * special characters, so runs of blanks and of plain word characters are
+ * stepped over without looking at each byte, and plain words are found a
+ * block at a time. Words are cut out of a copy of the line in place: a plain
+ * word only gets a NUL written after it, and unquoting only ever moves
+ * characters back. The copy, argv and kinds all go into one buffer taken
+ * from the arena, so they live until it is reset.
+ *
+ * @param cmd command line to fill, its previous contents are overwritten
+ * @param line line to lex, left untouched
+ * @param arena arena the tokens are allocated from
+ * @return number of tokens, or -1 if a quote is never closed
+ */
+int lex_line(struct cmdline *cmd, const char *line, struct arena *arena)
+{
+    if(classifier == NULL) {
+        classifier_init();
+    }
+
+    size_t len = strlen(line);
+    size_t argv_off = (len + 1 + LEX_BLOCK + sizeof(char *) - 1) & ~(sizeof(char *) - 1);
+    size_t token_cap = len / LEX_TOKENS_PER_BYTE + LEX_TOKENS_MIN;
+    cmd->buf = NULL;
+    cmd->buf_sz = 0;
+    lex_reserve(cmd, arena, argv_off + token_cap * (sizeof(char *) + 1));
+
+    memcpy(cmd->buf, line, len + 1);
+    memset(cmd->buf + len + 1, 0, LEX_BLOCK);
+    char *words = cmd->buf;
+    uintptr_t *slots = (uintptr_t *) (cmd->buf + argv_off);
+    size_t argc = 0;
+    int pipes = 0;
+    int redirects = 0;
+    char *p = words;
+    struct lex_block block = { p };
+    classifier->classify(p, &block);
+
+    while(true) {
+        p = skip_blanks(&block, p);
+        if(*p == '\0' || *p == '#') {
+            break;
+        }
+
+        /* Room for a block of plain words, or for a word and the operator
+         * right after it */
+        if(argc + LEX_BLOCK / 2 + 2 >= token_cap) {
+            const char *old = cmd->buf;
+            token_cap *= 2;
+            LOG("Growing room for tokens to %zu\n", token_cap);
+            lex_reserve(cmd, arena, argv_off + token_cap * (sizeof(char *) + 1));
+            words = cmd->buf;
+            slots = (uintptr_t *) (cmd->buf + argv_off);
+            p = cmd->buf + (p - old);
+            block.base = cmd->buf + (block.base - old);
+        }
+
+        enum token_kind kind = operator_kind(p);
+        if(kind == TOK_WORD) {
+            char *next = plain_words(&block, p, words, slots, &argc, token_cap);
+            if(next != p) {
+                p = next;
+                continue;
+            }
+
+            slots[argc++] = (p - words) << LEX_KIND_BITS | TOK_WORD;
+            char *out = p;
+            while(true) {
+                char *run_end = find_special(&block, p);
+                if(out != p) {
+                    memmove(out, p, run_end - p);
+                }
+                out += run_end - p;
+                p = run_end;
+
+                if(*p == '\\') {
+                    p++;
+                    if(*p != '\0') {
+                        *out++ = *p++;
+                    }
+                } else if(*p == '\'') {
+                    char *end = strchr(p + 1, '\'');
+                    if(end == NULL) {
+                        goto unterminated;
+                    }
+                    memmove(out, p + 1, end - p - 1);
+                    out += end - p - 1;
+                    p = end + 1;
+                } else if(*p == '"') {
+                    for(p++; *p != '"'; p++) {
+                        if(*p == '\0') {
+                            goto unterminated;
+                        }
+                        if(*p == '\\' && (p[1] == '"' || p[1] == '\\')) {
+                            p++;
+                        }
+                        *out++ = *p;
+                    }
+                    p++;
+                } else if(*p == '#') {
+                    /* Only starts a comment at the start of a word */
+                    *out++ = *p++;
+                } else {
+                    break;
+                }
+            }
+
+            /* The word ends at a blank, an operator or the end of the line,
+             * which the NUL may overwrite, so look at it first */
+            kind = operator_kind(p);
+            bool at_end = *p == '\0';
+            *out = '\0';
+            if(kind == TOK_WORD) {
+                if(at_end) {
+                    break;
+                }
+                p++;
+                continue;
+            }
+        }
+
+        slots[argc++] = kind;
+        p += kind == TOK_APPEND ? 2 : 1;
+        pipes += kind == TOK_PIPE;
+        redirects += kind == TOK_IN || kind == TOK_OUT || kind == TOK_APPEND;
+    }
+
+    /* Turn the slots into pointers now that the buffer won't move again */
+    cmd->argv = (char **) (cmd->buf + argv_off);
+    cmd->kinds = (unsigned char *) (cmd->argv + argc + 1);
+    for(size_t i = 0; i < argc; i++) {
+        uintptr_t slot = (uintptr_t) cmd->argv[i];
+        enum token_kind kind = slot & ((1 << LEX_KIND_BITS) - 1);
+        cmd->kinds[i] = kind;
+        cmd->argv[i] = kind == TOK_WORD ? words + (slot >> LEX_KIND_BITS) : op_text[kind];
+    }
+    cmd->argv[argc] = NULL;
+    cmd->argc = argc;
+    cmd->pipes = pipes;
+    cmd->redirects = redirects;
+    cmd->background = argc > 0 && cmd->kinds[argc - 1] == TOK_BG;
+    LOG("Lexed %zu tokens, %d pipes, %d redirects\n", argc, pipes, redirects);
+    return argc;
+
+unterminated:
+    LOG("Unterminated quote in: %s\n", line);
+    lex_clear(cmd);
+    return -1;
+}
+
+/**
+ * Empties a command line. Its buffer belongs to the arena it came from.
+ *
+ * @param cmd command line to empty
+ */
+void lex_clear(struct cmdline *cmd)
+{
+    cmd->argv = NULL;
+    cmd->kinds = NULL;
+    cmd->argc = cmd->pipes = cmd->redirects = 0;
+    cmd->background = false;
+}
@@ -0,0 +1,42 @@
+/**
+ * @file
+ *
+ * Splits a command line into words and operators in a single pass, handling
+ * quotes, backslash escapes and comments. Everything a line produces lives in
+ * one buffer taken from the arena of the command being run.
+ */
+
+#ifndef _LEX_H_
+#define _LEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+
+enum token_kind {
+    TOK_WORD,
+    TOK_PIPE,       /* | */
+    TOK_IN,         /* < */
+    TOK_OUT,        /* > */
+    TOK_APPEND,     /* >> */
+    TOK_BG,         /* & */
+};
+
+/* A lexed command line. Operators appear in argv as their own text, and
+ * kinds tells them apart from words that merely look the same ('|' quoted). */
+struct cmdline {
+    char **argv;            /* Tokens, NULL terminated */
+    unsigned char *kinds;   /* enum token_kind of each token */
+    int argc;
+    int pipes;              /* Number of TOK_PIPE tokens */
+    int redirects;          /* Number of TOK_IN, TOK_OUT and TOK_APPEND tokens */
+    bool background;        /* Whether the last token is TOK_BG */
+    char *buf;              /* Words, argv and kinds, from the arena */
+    size_t buf_sz;
+};
+
+int lex_line(struct cmdline *cmd, const char *line, struct arena *arena);
+void lex_clear(struct cmdline *cmd);
+
+#endif
@@ -0,0 +1,299 @@
+/**
+ * @file
+ *
+ * Prints the messages in a log file the shell wrote, oldest first, in the
+ * form the shell used to print them to stderr, with the time they were
+ * logged in front.
+ *
+ * Usage: logdecode file...
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+/* A site from the table of the file */
+struct site {
+    const struct log_site_entry *entry;
+    const char *file;
+    const char *func;
+    const char *fmt;
+};
+
+static bool color = false;
+
+/**
+ * Reads a whole file into memory.
+ */
+static char *file_read(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) {
+        perror(path);
+        return NULL;
+    }
+    size_t cap = 1 << 20;
+    char *data = malloc(cap);
+    *size = 0;
+    size_t got;
+    while((got = fread(data + *size, 1, cap - *size, file)) > 0) {
+        *size += got;
+        if(*size == cap) {
+            cap *= 2;
+            data = realloc(data, cap);
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+/**
+ * Copies bytes out of the ring at a position, wrapping around its end.
+ */
+static void ring_read(const unsigned char *ring, uint32_t ring_size, uint64_t pos,
+        void *dest, size_t len)
+{
+    size_t offset = pos & (ring_size - 1);
+    size_t first = ring_size - offset < len ? ring_size - offset : len;
+    memcpy(dest, ring + offset, first);
+    memcpy((char *) dest + first, ring, len - first);
+}
+
+/**
+ * Prints one message: the format with each conversion filled in from the
+ * arguments that were recorded.
+ */
+static void message_print(const struct site *site, const unsigned char *args,
+        const unsigned char *end)
+{
+    if(site->entry->raw) {
+        fputs(site->fmt, stdout);
+        return;
+    }
+
+    int next = 0;
+    const char *p = site->fmt;
+    while(*p != '\0') {
+        const char *pct = strchr(p, '%');
+        if(pct == NULL) {
+            fputs(p, stdout);
+            break;
+        }
+        fwrite(p, 1, pct - p, stdout);
+
+        enum log_arg arg;
+        int stars;
+        p = log_conversion(pct, &arg, &stars);
+        char spec[64];
+        size_t spec_len = p - pct < (long) sizeof(spec) ? (size_t) (p - pct) : sizeof(spec) - 1;
+        memcpy(spec, pct, spec_len);
+        spec[spec_len] = '\0';
+
+        int star[2] = { 0, 0 };
+        for(int i = 0; i < stars && next < site->entry->nargs && args + sizeof(int) <= end; i++) {
+            memcpy(&star[i], args, sizeof(int));
+            args += sizeof(int);
+            next++;
+        }
+        if(arg == LOG_ARG_NONE) {
+            fputs(spec[1] == '%' ? "%" : spec, stdout);
+            continue;
+        }
+        if(next >= site->entry->nargs) {
+            fputs(spec, stdout);
+            continue;
+        }
+        next++;
+
+        union { int i; long l; long long ll; double d; uint64_t p; } val;
+        const char *str = NULL;
+        uint16_t str_len = 0;
+        if(arg == LOG_ARG_STR) {
+            if(args + sizeof(str_len) > end) {
+                break;
+            }
+            memcpy(&str_len, args, sizeof(str_len));
+            args += sizeof(str_len);
+            if(str_len != LOGGER_NULL_STR) {
+                if(args + str_len > end) {
+                    break;
+                }
+                str = (const char *) args;
+                args += str_len;
+            }
+        } else {
+            size_t val_sz = arg == LOG_ARG_INT ? sizeof(int) : 8;
+            if(args + val_sz > end) {
+                break;
+            }
+            memcpy(&val, args, val_sz);
+            args += val_sz;
+        }
+
+#define PRINT_ARG(value) \
+        (stars == 2 ? printf(spec, star[0], star[1], value) \
+         : stars == 1 ? printf(spec, star[0], value) \
+         : printf(spec, value))
+
+        switch(arg) {
+            case LOG_ARG_INT:
+                PRINT_ARG(val.i);
+                break;
+            case LOG_ARG_LONG:
+                PRINT_ARG(val.l);
+                break;
+            case LOG_ARG_LLONG:
+                PRINT_ARG(val.ll);
+                break;
+            case LOG_ARG_DOUBLE:
+                PRINT_ARG(val.d);
+                break;
+            case LOG_ARG_LDOUBLE:
+                PRINT_ARG((long double) val.d);
+                break;
+            case LOG_ARG_PTR:
+                PRINT_ARG((void *) (uintptr_t) val.p);
+                break;
+            case LOG_ARG_STR:
+                if(str == NULL) {
+                    fputs("(null)", stdout);
+                } else {
+                    /* The string isn't NUL terminated in the record */
+                    char *copy = strndup(str, str_len);
+                    PRINT_ARG(copy);
+                    free(copy);
+                }
+                break;
+            case LOG_ARG_NONE:
+                break;
+        }
+#undef PRINT_ARG
+    }
+}
+
+/**
+ * Prints the messages in one log file.
+ *
+ * @return 0 if the file could be decoded, -1 otherwise
+ */
+static int log_decode(const char *path)
+{
+    size_t size;
+    char *data = file_read(path, &size);
+    if(data == NULL) {
+        return -1;
+    }
+
+    const struct log_header *header = (const struct log_header *) data;
+    if(size < LOGGER_HEADER_SIZE || memcmp(header->magic, LOGGER_MAGIC, 8) != 0
+            || size < (size_t) LOGGER_HEADER_SIZE + header->site_area + header->ring_size
+            || header->ring_size == 0 || (header->ring_size & (header->ring_size - 1)) != 0) {
+        fprintf(stderr, "%s: not a log file\n", path);
+        free(data);
+        return -1;
+    }
+
+    /* Sites by id */
+    uint32_t site_count = header->site_count;
+    struct site *sites = calloc(site_count + 1, sizeof(struct site));
+    const char *table = data + LOGGER_HEADER_SIZE;
+    uint32_t table_sz = header->site_bytes < header->site_area
+        ? header->site_bytes : header->site_area;
+    for(uint32_t offset = 0; offset + sizeof(struct log_site_entry) <= table_sz; ) {
+        const struct log_site_entry *entry = (const struct log_site_entry *) (table + offset);
+        if(entry->size < sizeof(struct log_site_entry) || offset + entry->size > table_sz) {
+            break;
+        }
+        if(entry->id < site_count) {
+            struct site *site = &sites[entry->id];
+            site->entry = entry;
+            site->file = (const char *) (entry + 1);
+            site->func = site->file + strlen(site->file) + 1;
+            site->fmt = site->func + strlen(site->func) + 1;
+        }
+        offset += entry->size;
+    }
+
+    /* The ring holds the last ring_size bytes written; the first record in
+     * it may have been partly overwritten, so records are found by the
+     * position each one starts with */
+    const unsigned char *ring = (const unsigned char *) table + header->site_area;
+    uint32_t ring_size = header->ring_size;
+    uint64_t head = header->head;
+    uint64_t pos = head > ring_size ? head - ring_size : 0;
+    unsigned char *record = malloc(ring_size);
+    unsigned long count = 0;
+    unsigned long skipped = 0;
+    bool synced = false;
+
+    while(pos + sizeof(struct log_record) <= head) {
+        struct log_record rec;
+        ring_read(ring, ring_size, pos, &rec, sizeof(rec));
+        if(rec.pos != pos || rec.size < sizeof(rec) || rec.size % 8 != 0
+                || rec.size > ring_size || pos + rec.size > head) {
+            /* Torn or overwritten: look for the next record */
+            skipped += synced;
+            pos += 8;
+            continue;
+        }
+        synced = true;
+        ring_read(ring, ring_size, pos, record, rec.size);
+
+        time_t secs = rec.ns / 1000000000;
+        struct tm tm;
+        char stamp[32];
+        localtime_r(&secs, &tm);
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+        printf("%s.%06lu ", stamp, (unsigned long) (rec.ns % 1000000000) / 1000);
+
+        if(rec.site >= site_count || sites[rec.site].entry == NULL) {
+            printf("(unknown site %u)\n", rec.site);
+        } else {
+            const struct site *site = &sites[rec.site];
+            if(color) {
+                printf("%s%s%s:%u:%s%s()%s: ",
+                        LOGGER_COLOR_RED, site->file, LOGGER_COLOR_RESET,
+                        site->entry->line,
+                        LOGGER_COLOR_BLUE, site->func, LOGGER_COLOR_RESET);
+            } else {
+                printf("%s:%u:%s(): ", site->file, site->entry->line, site->func);
+            }
+            message_print(site, record + sizeof(rec), record + rec.size);
+        }
+        count++;
+        pos += rec.size;
+    }
+
+    fprintf(stderr, "%s: %lu messages from pid %u", path, count, header->pid);
+    if(skipped > 0) {
+        fprintf(stderr, ", %lu bytes of torn records skipped", skipped * 8);
+    }
+    fputc('\n', stderr);
+
+    free(record);
+    free(sites);
+    free(data);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2) {
+        fprintf(stderr, "Usage: %s file...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    color = LOGGER_COLOR && isatty(STDOUT_FILENO);
+
+    int status = EXIT_SUCCESS;
+    for(int i = 1; i < argc; i++) {
+        if(log_decode(argv[i]) == -1) {
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,326 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+/* Bytes in the ring; a power of two */
+#ifndef LOGGER_RING_SIZE
+#define LOGGER_RING_SIZE (1 << 20)
+#endif
+/* Bytes set aside for the site table */
+#define LOGGER_SITE_AREA (64 * 1024)
+/* Most bytes of a string argument kept */
+#define LOGGER_STR_MAX 512
+/* Largest record: the header, and every argument a string at its longest */
+#define LOGGER_RECORD_MAX (sizeof(struct log_record) \
+        + LOGGER_MAX_ARGS * (sizeof(uint16_t) + LOGGER_STR_MAX) + 8)
+
+/* Whether the ring is set up: 0 not yet, 1 being set up, 2 ready, 3 failed */
+static int log_state = 0;
+static struct log_header *log_map = NULL;
+static char *site_table = NULL;
+static unsigned char *ring = NULL;
+static char log_path[PATH_MAX];
+/* Whether the file is removed on a clean exit */
+static bool log_temporary = false;
+static pid_t log_owner = 0;
+
+/* Signals that leave the log file behind, with a note about where it is */
+static const int crash_signals[] = { SIGSEGV, SIGBUS, SIGABRT, SIGFPE, SIGILL };
+
+static void log_exit(void)
+{
+    if(log_temporary && getpid() == log_owner) {
+        unlink(log_path);
+    }
+}
+
+static void log_crash(int sig)
+{
+    static const char note[] = "fish: crashed, log kept in ";
+    ssize_t unused = write(STDERR_FILENO, note, sizeof(note) - 1);
+    unused = write(STDERR_FILENO, log_path, strlen(log_path));
+    unused = write(STDERR_FILENO, "\n", 1);
+    (void) unused;
+    raise(sig);
+}
+
+/**
+ * Maps the log file and sets up its header. The file is sized up front so
+ * writing to the mapping can't fail later for lack of space.
+ *
+ * @return whether logging can go ahead
+ */
+static bool log_init(void)
+{
+    const char *path = getenv(LOGGER_FILE_ENV);
+    if(path != NULL && path[0] != '\0') {
+        snprintf(log_path, sizeof(log_path), "%s", path);
+    } else {
+        const char *tmp = getenv("TMPDIR");
+        snprintf(log_path, sizeof(log_path), "%s/fish.%d.log",
+                tmp != NULL && tmp[0] != '\0' ? tmp : "/tmp", (int) getpid());
+        log_temporary = true;
+    }
+
+    size_t map_sz = LOGGER_HEADER_SIZE + LOGGER_SITE_AREA + LOGGER_RING_SIZE;
+    int fd = open(log_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd == -1) {
+        return false;
+    }
+    if(posix_fallocate(fd, 0, map_sz) != 0) {
+        close(fd);
+        unlink(log_path);
+        return false;
+    }
+    void *map = mmap(NULL, map_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        unlink(log_path);
+        return false;
+    }
+
+    log_map = map;
+    site_table = (char *) map + LOGGER_HEADER_SIZE;
+    ring = (unsigned char *) map + LOGGER_HEADER_SIZE + LOGGER_SITE_AREA;
+    log_map->site_area = LOGGER_SITE_AREA;
+    log_map->ring_size = LOGGER_RING_SIZE;
+    log_map->pid = getpid();
+    memcpy(log_map->magic, LOGGER_MAGIC, sizeof(log_map->magic));
+
+    log_owner = getpid();
+    atexit(log_exit);
+    for(size_t i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); i++) {
+        struct sigaction old;
+        if(sigaction(crash_signals[i], NULL, &old) == 0 && old.sa_handler == SIG_DFL) {
+            struct sigaction act = { .sa_handler = log_crash, .sa_flags = SA_RESETHAND };
+            sigemptyset(&act.sa_mask);
+            sigaction(crash_signals[i], &act, NULL);
+        }
+    }
+    return true;
+}
+
+/**
+ * Scans one printf conversion and tells what argument it takes.
+ *
+ * @param spec the '%' the conversion starts with
+ * @param arg receives the kind of argument, LOG_ARG_NONE if it takes none
+ * @param stars receives the number of int arguments a '*' width or
+ *  precision takes before it
+ * @return the character after the conversion
+ */
+const char *log_conversion(const char *spec, enum log_arg *arg, int *stars)
+{
+    const char *p = spec + 1;
+    *arg = LOG_ARG_NONE;
+    *stars = 0;
+
+    p += strspn(p, "-+ #0'");
+    if(*p == '*') {
+        *stars += 1;
+        p++;
+    }
+    p += strspn(p, "0123456789");
+    if(*p == '.') {
+        p++;
+        if(*p == '*') {
+            *stars += 1;
+            p++;
+        }
+        p += strspn(p, "0123456789");
+    }
+
+    int longs = 0;
+    bool long_double = false;
+    while(*p != '\0' && strchr("hlLqjzZt", *p) != NULL) {
+        longs += *p == 'l' || *p == 'j' || *p == 'z' || *p == 'Z' || *p == 't';
+        longs += (*p == 'q') * 2;
+        long_double |= *p == 'L';
+        p++;
+    }
+
+    switch(*p) {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+            *arg = longs >= 2 ? LOG_ARG_LLONG : longs == 1 ? LOG_ARG_LONG : LOG_ARG_INT;
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            *arg = long_double ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            *arg = LOG_ARG_STR;
+            break;
+        case 'p':
+        case 'n':
+            *arg = LOG_ARG_PTR;
+            break;
+        case '\0':
+            return p;
+    }
+    return p + 1;
+}
+
+/**
+ * Works out the arguments of a site from its format and adds it to the site
+ * table of the file.
+ */
+static void site_register(struct log_site *site)
+{
+    int expected = 0;
+    if(!__atomic_compare_exchange_n(&site->state, &expected, 1, false,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    site->nargs = 0;
+    for(const char *p = site->fmt; !site->raw && *p != '\0'; ) {
+        if(*p != '%') {
+            p++;
+            continue;
+        }
+        enum log_arg arg;
+        int stars;
+        p = log_conversion(p, &arg, &stars);
+        for(int i = 0; i < stars + (arg != LOG_ARG_NONE); i++) {
+            if(site->nargs < LOGGER_MAX_ARGS) {
+                site->args[site->nargs++] = i < stars ? LOG_ARG_INT : arg;
+            }
+        }
+    }
+
+    size_t file_len = strlen(site->file) + 1;
+    size_t func_len = strlen(site->func) + 1;
+    size_t fmt_len = strlen(site->fmt) + 1;
+    size_t size = (sizeof(struct log_site_entry) + file_len + func_len + fmt_len + 7) & ~7UL;
+
+    site->id = __atomic_fetch_add(&log_map->site_count, 1, __ATOMIC_RELAXED);
+    uint32_t offset = __atomic_fetch_add(&log_map->site_bytes, size, __ATOMIC_RELAXED);
+    if(size <= UINT16_MAX && offset + size <= LOGGER_SITE_AREA) {
+        struct log_site_entry *entry = (struct log_site_entry *) (site_table + offset);
+        entry->id = site->id;
+        entry->line = site->line;
+        entry->level = site->level;
+        entry->raw = site->raw;
+        entry->nargs = site->nargs;
+        memcpy(entry->args, site->args, sizeof(entry->args));
+        char *strings = (char *) (entry + 1);
+        memcpy(strings, site->file, file_len);
+        memcpy(strings + file_len, site->func, func_len);
+        memcpy(strings + file_len + func_len, site->fmt, fmt_len);
+        /* The size is written last: the decoder stops at an entry without one */
+        __atomic_store_n(&entry->size, size, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&site->state, 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copies bytes into the ring at a position, wrapping around its end.
+ */
+static void ring_copy(uint64_t pos, const void *src, size_t len)
+{
+    size_t offset = pos & (LOGGER_RING_SIZE - 1);
+    size_t first = LOGGER_RING_SIZE - offset < len ? LOGGER_RING_SIZE - offset : len;
+    memcpy(ring + offset, src, first);
+    memcpy(ring, (const char *) src + first, len - first);
+}
+
+/**
+ * Records a message in the ring: the id of the site it comes from, the time
+ * and the arguments as they are, to be formatted by the decoder. Safe to call
+ * from any thread and from signal handlers.
+ *
+ * @param site site logging the message
+ * @param ... arguments for the site's format
+ */
+void log_write(struct log_site *site, ...)
+{
+    int state = __atomic_load_n(&log_state, __ATOMIC_ACQUIRE);
+    if(state != 2) {
+        int expected = 0;
+        if(state != 0 || !__atomic_compare_exchange_n(&log_state, &expected, 1,
+                    false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        state = log_init() ? 2 : 3;
+        __atomic_store_n(&log_state, state, __ATOMIC_RELEASE);
+        if(state != 2) {
+            return;
+        }
+    }
+    if(__atomic_load_n(&site->state, __ATOMIC_ACQUIRE) != 2) {
+        site_register(site);
+        if(__atomic_load_n(&site->state, __ATOMIC_ACQUIRE) != 2) {
+            return;
+        }
+    }
+
+    _Alignas(8) unsigned char record[LOGGER_RECORD_MAX];
+    size_t len = sizeof(struct log_record);
+
+    va_list args;
+    va_start(args, site);
+    for(int i = 0; i < site->nargs; i++) {
+        union { int i; long l; long long ll; double d; uint64_t p; } val;
+        size_t val_sz = 8;
+        switch(site->args[i]) {
+            case LOG_ARG_INT:
+                val.i = va_arg(args, int);
+                val_sz = sizeof(int);
+                break;
+            case LOG_ARG_LONG:
+                val.l = va_arg(args, long);
+                break;
+            case LOG_ARG_LLONG:
+                val.ll = va_arg(args, long long);
+                break;
+            case LOG_ARG_DOUBLE:
+                val.d = va_arg(args, double);
+                break;
+            case LOG_ARG_LDOUBLE:
+                val.d = (double) va_arg(args, long double);
+                break;
+            case LOG_ARG_PTR:
+                val.p = (uintptr_t) va_arg(args, void *);
+                break;
+            case LOG_ARG_STR: {
+                const char *str = va_arg(args, const char *);
+                uint16_t str_len = LOGGER_NULL_STR;
+                if(str != NULL) {
+                    str_len = strnlen(str, LOGGER_STR_MAX);
+                }
+                memcpy(record + len, &str_len, sizeof(str_len));
+                len += sizeof(str_len);
+                if(str != NULL) {
+                    memcpy(record + len, str, str_len);
+                    len += str_len;
+                }
+                continue;
+            }
+        }
+        memcpy(record + len, &val, val_sz);
+        len += val_sz;
+    }
+    va_end(args);
+
+    memset(record + len, 0, 7);
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct log_record *head = (struct log_record *) record;
+    head->site = site->id;
+    head->size = (len + 7) & ~7UL;
+    head->ns = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+
+    uint64_t pos = __atomic_fetch_add(&log_map->head, head->size, __ATOMIC_RELAXED);
+    ring_copy(pos + sizeof(head->pos), record + sizeof(head->pos), head->size - sizeof(head->pos));
+    /* Records are 8 byte aligned, so the position never wraps around */
+    __atomic_store_n((uint64_t *) (ring + (pos & (LOGGER_RING_SIZE - 1))), pos, __ATOMIC_RELEASE);
+}
@@ -2,13 +2,19 @@
  * @file
  *
  * Helps facilitate debugging by providing basic logging functionality. Unlike
- * printf-style debugging, the log messages can be enabled/disabled by changing 
+ * printf-style debugging, the log messages can be enabled/disabled by changing
  * the value of LOGGER.
+ *
+ * Log messages are not formatted when they are logged: each call site is
+ * registered once, and a call only appends its site id, a timestamp and its
+ * raw arguments to a ring buffer mapped from a file. The file is left behind
+ * if the shell crashes and can be read with the logdecode tool.
  */
 
 #ifndef _LOGGER_H_
 #define _LOGGER_H_
 
+#include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 
@@ -19,6 +25,27 @@
 #define LOGGER 1
 #endif
 
+/**
+ * Log levels. Messages below LOGGER_LEVEL are compiled out; LOG() and LOGP()
+ * log at LOGGER_DEBUG, so everything is kept by default.
+ */
+#define LOGGER_DEBUG 0
+#define LOGGER_INFO  1
+#define LOGGER_WARN  2
+#define LOGGER_ERROR 3
+
+#ifndef LOGGER_LEVEL
+#define LOGGER_LEVEL LOGGER_DEBUG
+#endif
+
+/**
+ * LOGGER_STDERR prints every message to stderr as it is logged instead of
+ * recording it in the ring buffer. It is disabled by default.
+ */
+#ifndef LOGGER_STDERR
+#define LOGGER_STDERR 0
+#endif
+
 /**
  * LOGGER_COLOR determines whether debug output is colorized. It is enabled by
  * default.
@@ -31,54 +58,143 @@
 #define LOGGER_COLOR_RED   "\033[0;31m"
 #define LOGGER_COLOR_BLUE  "\033[1;34m"
 #define LOGGER_COLOR_RESET "\033[0m"
+#else
+#define LOGGER_COLOR_RED   ""
+#define LOGGER_COLOR_BLUE  ""
+#define LOGGER_COLOR_RESET ""
 #endif
 
-/**
- * Prints an unformatted log message (single string).
- *
- * Example Usage:
- * LOGP("Hello world!");
+/* Environment variable naming the file the ring buffer is kept in. Without
+ * it, a file in the temporary directory is used and removed on exit. */
+#define LOGGER_FILE_ENV "FISH_LOG"
+
+/* Most arguments a message can have */
+#define LOGGER_MAX_ARGS 16
+
+/* Kinds of arguments, as the format string gives them */
+enum log_arg {
+    LOG_ARG_NONE,       /* A conversion without an argument, such as %% */
+    LOG_ARG_INT,        /* Anything promoted to int */
+    LOG_ARG_LONG,       /* long, size_t, intmax_t, ptrdiff_t */
+    LOG_ARG_LLONG,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_LDOUBLE,    /* Recorded as a double */
+    LOG_ARG_STR,
+    LOG_ARG_PTR,
+};
+
+/* A place in the code that logs. Each one is a static variable the logging
+ * macros declare, registered the first time it logs. */
+struct log_site {
+    const char *file;
+    const char *func;
+    const char *fmt;
+    int line;
+    int level;
+    int raw;            /* Whether fmt is printed as is, without arguments */
+    int state;          /* 0 new, 1 being registered, 2 registered */
+    uint32_t id;
+    int nargs;
+    unsigned char args[LOGGER_MAX_ARGS];
+};
+
+void log_write(struct log_site *site, ...);
+const char *log_conversion(const char *spec, enum log_arg *arg, int *stars);
+
+/*
+ * Layout of the log file: this header, then the site table, then the ring.
+ * Numbers are in host byte order.
  */
-#define LOGP(str) \
+#define LOGGER_MAGIC "FISHLOG1"
+#define LOGGER_HEADER_SIZE 4096
+
+struct log_header {
+    char magic[8];
+    uint32_t site_area;     /* Bytes set aside for the site table */
+    uint32_t ring_size;     /* Bytes in the ring, a power of two */
+    uint64_t head;          /* Bytes ever written to the ring */
+    uint32_t site_bytes;    /* Bytes of the site table in use */
+    uint32_t site_count;
+    uint32_t pid;           /* Process that created the file */
+};
+
+/* A site in the table, followed by its file, function and format strings,
+ * each NUL terminated, and padded to 8 bytes */
+struct log_site_entry {
+    uint32_t id;
+    uint32_t line;
+    uint16_t level;
+    uint16_t raw;
+    uint16_t nargs;
+    uint16_t size;          /* Bytes of the entry and its strings */
+    unsigned char args[LOGGER_MAX_ARGS];
+};
+
+/* A message in the ring, followed by its arguments: 4 bytes for an int, a
+ * 2 byte length and the bytes for a string, 8 bytes for anything else */
+struct log_record {
+    uint64_t pos;           /* Position in the ring it was written at, set last */
+    uint32_t site;
+    uint32_t size;          /* Bytes of the record and arguments, padded to 8 */
+    uint64_t ns;            /* Wall clock time it was logged */
+};
+
+/* String length standing for a NULL pointer */
+#define LOGGER_NULL_STR 0xffff
+
+#if LOGGER_STDERR
+
+#define LOGGER_PRINT(level, fmt, ...) \
     do { \
-        if (LOGGER) { \
-            if (LOGGER_COLOR) { \
-                if (isatty(STDERR_FILENO)) { \
-                    fprintf(stderr, "%s%s%s:%d:%s%s()%s: %s", \
-                            LOGGER_COLOR_RED, __FILE__, LOGGER_COLOR_RESET, \
-                            __LINE__, \
-                            LOGGER_COLOR_BLUE, __func__, LOGGER_COLOR_RESET, \
-                            str); \
-                    break; \
-                } \
-                fprintf(stderr, "%s:%d:%s(): %s", \
-                        __FILE__, __LINE__, __func__, str); \
+        if (LOGGER && (level) >= LOGGER_LEVEL) { \
+            if (LOGGER_COLOR && isatty(STDERR_FILENO)) { \
+                fprintf(stderr, "%s%s%s:%d:%s%s()%s: " fmt, \
+                        LOGGER_COLOR_RED, __FILE__, LOGGER_COLOR_RESET, \
+                        __LINE__, \
+                        LOGGER_COLOR_BLUE, __func__, LOGGER_COLOR_RESET, \
+                        __VA_ARGS__); \
+                break; \
             } \
+            fprintf(stderr, "%s:%d:%s(): " fmt, __FILE__, \
+                    __LINE__, __func__, __VA_ARGS__); \
         } \
     } while (0)
 
+#define LOGL(level, fmt, ...) LOGGER_PRINT(level, fmt, __VA_ARGS__)
+#define LOGGER_LOGP(str) LOGGER_PRINT(LOGGER_DEBUG, "%s", str)
+
+#else
+
+#define LOGGER_RECORD(lvl, is_raw, format, ...) \
+    do { \
+        if (LOGGER && (lvl) >= LOGGER_LEVEL) { \
+            static struct log_site log_site_ = { \
+                .file = __FILE__, .func = __func__, .fmt = format, \
+                .line = __LINE__, .level = (lvl), .raw = (is_raw), \
+            }; \
+            log_write(&log_site_, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOGL(level, fmt, ...) LOGGER_RECORD(level, 0, fmt, __VA_ARGS__)
+#define LOGGER_LOGP(str) LOGGER_RECORD(LOGGER_DEBUG, 1, "" str, 0)
+
+#endif
+
 /**
- * Prints a formatted log message.
+ * Logs an unformatted log message (single string literal).
+ *
+ * Example Usage:
+ * LOGP("Hello world!");
+ */
+#define LOGP(str) LOGGER_LOGP(str)
+
+/**
+ * Logs a formatted log message.
  *
  * Example Usage:
  * LOG("Hello %s, your lucky number is %d\n", "World", 42);
  */
-#define LOG(fmt, ...) \
-    do { \
-        if (LOGGER) { \
-            if (LOGGER_COLOR) { \
-                if (isatty(STDERR_FILENO)) { \
-                    fprintf(stderr, "%s%s%s:%d:%s%s()%s: " fmt, \
-                            LOGGER_COLOR_RED, __FILE__, LOGGER_COLOR_RESET, \
-                            __LINE__, \
-                            LOGGER_COLOR_BLUE, __func__, LOGGER_COLOR_RESET, \
-                            __VA_ARGS__); \
-                    break; \
-                } \
-                fprintf(stderr, "%s:%d:%s(): " fmt, __FILE__, \
-                        __LINE__, __func__, __VA_ARGS__); \
-            } \
-        } \
-    } while (0)
+#define LOG(fmt, ...) LOGL(LOGGER_DEBUG, fmt, __VA_ARGS__)
 
 #endif
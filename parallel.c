@@ -0,0 +1,393 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "jobs.h"
+#include "lex.h"
+#include "logger.h"
+#include "parallel.h"
+#include "util.h"
+
+/* Replaced by the argument in the words of the template */
+#define PARALLEL_PLACEHOLDER "{}"
+/* How far past the oldest argument whose output is not written out yet an
+ * ordered run may go. Each finished command keeps two memory files open
+ * until its output is written out. */
+#define PARALLEL_WINDOW 256
+/* Failed commands are counted in the exit status up to this many */
+#define PARALLEL_FAILED_MAX 101
+
+/* A worker slot. Idle slots take the next argument from one queue shared by
+ * all of them, so arguments are launched in order, each as soon as any slot
+ * is free. */
+struct slot {
+    struct job *job;    /* Command the slot runs, or NULL */
+    size_t item;        /* Argument of that command */
+};
+
+/* Arguments, one string after the other in buf */
+struct items {
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t *offsets;
+    size_t count;
+    size_t offsets_cap;
+};
+
+/* Set by SIGINT while a run waits, which stops it */
+static volatile sig_atomic_t interrupted = 0;
+
+/* Holds the command of one argument while it is launched */
+static struct arena item_arena;
+
+/**
+ * Stops the current run: no more commands are launched and the running ones
+ * are terminated. Safe to call from a signal handler.
+ */
+void parallel_interrupt(void)
+{
+    interrupted = 1;
+}
+
+/**
+ * Reads the arguments, one per line.
+ *
+ * @param fd file the arguments are read from
+ * @param items receives the arguments
+ */
+static void items_read(int fd, struct items *items)
+{
+    char *line;
+    size_t len;
+    while((line = buf_lineread(fd, &len)) != NULL) {
+        if(items->len + len + 1 > items->cap) {
+            items->cap = MAX(items->cap * 2, items->len + len + 1);
+            items->buf = realloc(items->buf, items->cap);
+        }
+        if(items->count == items->offsets_cap) {
+            items->offsets_cap = items->offsets_cap > 0 ? items->offsets_cap * 2 : 64;
+            items->offsets = realloc(items->offsets, items->offsets_cap * sizeof(size_t));
+        }
+        memcpy(items->buf + items->len, line, len + 1);
+        items->offsets[items->count++] = items->len;
+        items->len += len + 1;
+    }
+}
+
+/**
+ * Replaces every placeholder in a word of the template.
+ */
+static char *substitute(const char *word, const char *arg)
+{
+    size_t arg_len = strlen(arg);
+    size_t holder_len = strlen(PARALLEL_PLACEHOLDER);
+    size_t count = 0;
+    for(const char *at = word; (at = strstr(at, PARALLEL_PLACEHOLDER)) != NULL; at += holder_len) {
+        count += 1;
+    }
+
+    char *out = arena_alloc(&item_arena, strlen(word) + count * arg_len + 1);
+    char *end = out;
+    const char *at;
+    while((at = strstr(word, PARALLEL_PLACEHOLDER)) != NULL) {
+        memcpy(end, word, at - word);
+        end += at - word;
+        memcpy(end, arg, arg_len);
+        end += arg_len;
+        word = at + holder_len;
+    }
+    strcpy(end, word);
+    return out;
+}
+
+/**
+ * Launches the command of an argument as a captured job. Without a
+ * placeholder in the template, the argument is added as the last word of its
+ * last command, ahead of any redirections.
+ *
+ * @param tmpl lexed template
+ * @param argc tokens of the template to use
+ * @param insert_at where the argument goes, or -1 if it has placeholders
+ * @param arg the argument
+ * @return the job, or NULL if it could not be launched
+ */
+static struct job *item_launch(const struct cmdline *tmpl, int argc, int insert_at, const char *arg)
+{
+    int item_argc = argc + (insert_at != -1);
+    char **argv = arena_alloc(&item_arena, (item_argc + 1) * sizeof(char *));
+    unsigned char *kinds = arena_alloc(&item_arena, item_argc);
+    size_t command_len = 0;
+
+    for(int i = 0, j = 0; j < item_argc; j++) {
+        if(j == insert_at) {
+            argv[j] = (char *) arg;
+            kinds[j] = TOK_WORD;
+        } else {
+            kinds[j] = tmpl->kinds[i];
+            argv[j] = tmpl->argv[i];
+            if(kinds[j] == TOK_WORD && strstr(argv[j], PARALLEL_PLACEHOLDER) != NULL) {
+                argv[j] = substitute(argv[j], arg);
+            }
+            i += 1;
+        }
+        command_len += strlen(argv[j]) + 1;
+    }
+    argv[item_argc] = NULL;
+
+    /* The command is only shown by jobs and in the log */
+    char *command = arena_alloc(&item_arena, command_len + 1);
+    char *end = command;
+    for(int j = 0; j < item_argc; j++) {
+        end = stpcpy(end, argv[j]);
+        *end++ = ' ';
+    }
+    end[-1] = '\0';
+
+    struct job *job = jobs_submit(argv, kinds, item_argc, command, JOB_CAPTURE | JOB_NOW);
+    arena_reset(&item_arena);
+    return job;
+}
+
+/**
+ * Prints how parallel is used.
+ */
+static int usage(void)
+{
+    fprintf(stderr, "usage: parallel [-j slots] [-k] [--halt] [-a file] command [%s]...\n",
+            PARALLEL_PLACEHOLDER);
+    return EXIT_FAILURE << 8;
+}
+
+/**
+ * Runs the parallel builtin.
+ *
+ * parallel [-j slots] [-k] [--halt] [-a file] command [{}]...
+ *
+ * The words of the command template keep the kinds the shell lexed them
+ * with, except that a template given as a single quoted word is lexed as a
+ * command line of its own, so it may hold pipes and redirections. For every argument, each {} in the words
+ * is replaced by the argument, which is appended if there is none.
+ * The commands run on as many slots as -j gives, one per online CPU (or
+ * FISH_JOBS) by default, through the shell's own job launcher. Their output
+ * is captured and written out whole as each finishes, or in the order of
+ * the arguments with -k. With --halt, no command is launched once one
+ * failed.
+ *
+ * @param args tokens of the builtin
+ * @param kinds kind of each token, or NULL if they are all words
+ * @param argc total num of tokens
+ * @param in_fd standard input of the builtin
+ * @return wait status: that of the failed command with --halt, otherwise an
+ *  exit status holding the number of commands that failed
+ */
+int parallel_run(char *args[], const unsigned char *kinds, int argc, int in_fd)
+{
+    size_t slot_count = jobs_limit();
+    bool keep_order = false;
+    bool halt = false;
+    const char *path = NULL;
+
+    int i = 1;
+    for(; i < argc && args[i][0] == '-'; i++) {
+        if(strcmp(args[i], "--") == 0) {
+            i += 1;
+            break;
+        } else if(strcmp(args[i], "-k") == 0) {
+            keep_order = true;
+        } else if(strcmp(args[i], "--halt") == 0) {
+            halt = true;
+        } else if(strcmp(args[i], "-j") == 0 && i + 1 < argc && atoi(args[i + 1]) > 0) {
+            slot_count = atoi(args[++i]);
+        } else if(strcmp(args[i], "-a") == 0 && i + 1 < argc) {
+            path = args[++i];
+        } else {
+            return usage();
+        }
+    }
+    if(i >= argc) {
+        return usage();
+    }
+
+    /* A template given as one word is a command line of its own, which may
+     * hold pipes and redirections; otherwise its tokens are as lexed */
+    struct arena tmpl_arena = { 0 };
+    struct cmdline tmpl = { 0 };
+    if(argc - i == 1 && lex_line(&tmpl, args[i], &tmpl_arena) == -1) {
+        fprintf(stderr, "parallel: unterminated quote\n");
+        arena_free(&tmpl_arena);
+        return EXIT_FAILURE << 8;
+    } else if(argc - i > 1) {
+        tmpl.argv = args + i;
+        tmpl.argc = argc - i;
+        tmpl.kinds = arena_alloc(&tmpl_arena, tmpl.argc);
+        if(kinds != NULL) {
+            memcpy(tmpl.kinds, kinds + i, tmpl.argc);
+        } else {
+            memset(tmpl.kinds, TOK_WORD, tmpl.argc);
+        }
+    }
+    if(tmpl.argc - tmpl.background < 1) {
+        arena_free(&tmpl_arena);
+        return usage();
+    }
+    int tmpl_argc = tmpl.argc - tmpl.background;
+
+    /* Without a placeholder, the argument goes at the end of the last
+     * command, ahead of its redirections */
+    int insert_at = tmpl_argc;
+    for(int j = 0; j < tmpl_argc; j++) {
+        if(tmpl.kinds[j] == TOK_WORD && strstr(tmpl.argv[j], PARALLEL_PLACEHOLDER) != NULL) {
+            insert_at = -1;
+            break;
+        } else if(tmpl.kinds[j] == TOK_PIPE) {
+            insert_at = tmpl_argc;
+        } else if(tmpl.kinds[j] != TOK_WORD && insert_at == tmpl_argc) {
+            insert_at = j;
+        }
+    }
+
+    struct items items = { 0 };
+    int fd = in_fd;
+    if(path != NULL && (fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        perror(path);
+        arena_free(&tmpl_arena);
+        return EXIT_FAILURE << 8;
+    }
+    items_read(fd, &items);
+    if(path != NULL) {
+        buf_lineread_close(fd);
+        close(fd);
+    } else if(fd != STDIN_FILENO || isatty(fd)) {
+        /* A pipe or file is closed by the shell, and the terminal is
+         * readline's again */
+        buf_lineread_close(fd);
+    }
+
+    size_t count = items.count;
+    slot_count = MIN(slot_count, MAX(count, 1));
+    struct slot *slots = calloc(slot_count, sizeof(struct slot));
+    /* Ordered runs keep finished jobs until their turn */
+    struct job **results = keep_order ? calloc(count, sizeof(struct job *)) : NULL;
+    bool *finished = keep_order ? calloc(count, sizeof(bool)) : NULL;
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    interrupted = 0;
+    size_t running = 0;
+    size_t next_item = 0;
+    size_t next_out = 0;
+    size_t failed = 0;
+    int halt_status = 0;
+    bool halted = false;
+
+    for(;;) {
+        if(interrupted && !halted) {
+            halted = true;
+            for(size_t s = 0; s < slot_count; s++) {
+                if(slots[s].job != NULL) {
+                    jobs_kill(slots[s].job, SIGTERM);
+                }
+            }
+        }
+
+        /* Give every idle slot the next argument */
+        size_t below = keep_order ? MIN(next_out + PARALLEL_WINDOW, count) : count;
+        for(size_t s = 0; s < slot_count && !halted; s++) {
+            while(slots[s].job == NULL && !halted && next_item < below) {
+                size_t item = next_item++;
+                struct job *job = item_launch(&tmpl, tmpl_argc, insert_at,
+                        items.buf + items.offsets[item]);
+                if(job != NULL) {
+                    slots[s].job = job;
+                    slots[s].item = item;
+                    running += 1;
+                    continue;
+                }
+                failed += 1;
+                if(halt) {
+                    halted = true;
+                    halt_status = EXIT_FAILURE << 8;
+                }
+                if(keep_order) {
+                    finished[item] = true;
+                }
+            }
+        }
+        if(running == 0) {
+            break;
+        }
+
+        struct pollfd pfd = { .fd = jobs_fd(), .events = POLLIN };
+        if(poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        jobs_reap();
+
+        for(size_t s = 0; s < slot_count; s++) {
+            struct job *job = slots[s].job;
+            if(job == NULL || job->state != JOB_DONE) {
+                continue;
+            }
+            if(job->status != 0) {
+                failed += 1;
+                if(halt && !halted) {
+                    halted = true;
+                    halt_status = job->status;
+                }
+            }
+            if(keep_order) {
+                results[slots[s].item] = job;
+                finished[slots[s].item] = true;
+            } else {
+                jobs_collect(job);
+            }
+            slots[s].job = NULL;
+            running -= 1;
+        }
+
+        while(keep_order && next_out < count && finished[next_out]) {
+            if(results[next_out] != NULL) {
+                jobs_collect(results[next_out]);
+            }
+            next_out += 1;
+        }
+    }
+
+    /* A halted run may leave finished commands behind ones never launched */
+    for(; keep_order && next_out < count; next_out++) {
+        if(results[next_out] != NULL) {
+            jobs_collect(results[next_out]);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    LOG("Parallel ran %zu arguments on %zu slots in %ld us, %zu failed\n", count, slot_count,
+            (stop.tv_sec - start.tv_sec) * 1000000 + (stop.tv_nsec - start.tv_nsec) / 1000, failed);
+
+    free(results);
+    free(finished);
+    free(slots);
+    free(items.buf);
+    free(items.offsets);
+    arena_free(&tmpl_arena);
+    arena_free(&item_arena);
+
+    if(interrupted) {
+        return (128 + SIGINT) << 8;
+    } else if(halted) {
+        return halt_status;
+    }
+    return MIN(failed, PARALLEL_FAILED_MAX) << 8;
+}
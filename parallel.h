@@ -0,0 +1,17 @@
+/**
+ * @file
+ *
+ * The parallel builtin: runs a command template once per argument, with the
+ * arguments read from standard input or a file, a line each. The commands run
+ * as jobs on a number of worker slots, which take the arguments in order from
+ * one queue as they become free, so a few slow arguments never leave the
+ * other slots idle.
+ */
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+int parallel_run(char *args[], const unsigned char *kinds, int argc, int in_fd);
+void parallel_interrupt(void);
+
+#endif
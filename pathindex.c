@@ -0,0 +1,600 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "pathindex.h"
+
+/* Bytes of names a directory listing starts with room for */
+#define PATHINDEX_NAMES_MIN 4096
+/* Once a directory changes, the index waits until it has been quiet for this
+ * many milliseconds, so that installing a package rebuilds it only once */
+#define PATHINDEX_SETTLE_MS 100
+#define PATHINDEX_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+        | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/* A PATH directory and the names of the executables it held when it was last
+ * listed. Only the index thread touches these. */
+struct path_dir {
+    char *path;
+    struct timespec mtime;
+    int wd;             /* inotify watch, or -1 if the directory isn't watched */
+    bool listed;        /* Whether the directory could be listed */
+    bool dirty;         /* Whether it has to be listed again */
+    char *names;        /* Names one after the other, each NUL terminated */
+    size_t names_sz;
+    size_t count;
+};
+
+/* A finished index. It is never changed once built, and belongs either to
+ * the index thread, to the pending slot or to the completing thread. */
+struct snapshot {
+    char *names;
+    const char **entries;   /* Every name once, sorted, pointing into names */
+    size_t count;
+};
+
+/* State of the index thread */
+static pthread_t index_thread;
+static bool thread_running = false;
+static struct path_dir *dirs = NULL;
+static size_t dir_count = 0;
+static char *index_path = NULL;
+static int inotify_fd = -1;
+
+/* Wakes the index thread up: a byte is written whenever it has something
+ * to look at */
+static int wake_pipe[2] = { -1, -1 };
+static atomic_bool stopping = false;
+static atomic_bool check_unwatched = false;
+/* PATH the completing thread last saw, handed over under the lock */
+static pthread_mutex_t request_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *requested_path = NULL;
+
+/* The newest index the completing thread hasn't taken yet */
+static _Atomic(struct snapshot *) pending = NULL;
+
+/* State of the completing thread. Builtin names aren't copied. */
+static const char **builtins = NULL;
+static size_t builtin_count = 0;
+static char *seen_path = NULL;
+static struct snapshot *adopted = NULL;
+/* The adopted index merged with the builtins */
+static const char **entries = NULL;
+static size_t entry_count = 0;
+static bool stale = true;
+
+static int name_cmp(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *) a, *(const char *const *) b);
+}
+
+static void snapshot_free(struct snapshot *snap)
+{
+    if(snap != NULL) {
+        free(snap->names);
+        free(snap->entries);
+        free(snap);
+    }
+}
+
+/**
+ * Lists the executables of a directory, replacing what it held before.
+ */
+static void dir_list(struct path_dir *dir)
+{
+    dir->names_sz = 0;
+    dir->count = 0;
+    dir->listed = false;
+    dir->dirty = false;
+
+    struct stat st;
+    DIR *stream = opendir(dir->path);
+    if(stream == NULL || fstat(dirfd(stream), &st) != 0) {
+        if(stream != NULL) {
+            closedir(stream);
+        }
+        return;
+    }
+    dir->mtime = st.st_mtim;
+
+    size_t cap = PATHINDEX_NAMES_MIN;
+    char *names = malloc(cap);
+    struct dirent *entry;
+    while((entry = readdir(stream)) != NULL) {
+        const char *name = entry->d_name;
+        if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || entry->d_type == DT_DIR) {
+            continue;
+        }
+        if(faccessat(dirfd(stream), name, X_OK, 0) != 0) {
+            continue;
+        }
+        /* Links and unknown types may still lead to a directory */
+        if(entry->d_type != DT_REG
+                && (fstatat(dirfd(stream), name, &st, 0) != 0 || !S_ISREG(st.st_mode))) {
+            continue;
+        }
+
+        size_t len = strlen(name) + 1;
+        if(dir->names_sz + len > cap) {
+            cap *= 2;
+            names = realloc(names, cap);
+        }
+        memcpy(names + dir->names_sz, name, len);
+        dir->names_sz += len;
+        dir->count += 1;
+    }
+    closedir(stream);
+
+    free(dir->names);
+    dir->names = names;
+    dir->listed = true;
+    LOG("Indexed %zu commands in %s\n", dir->count, dir->path);
+}
+
+/**
+ * Starts watching a directory, if it exists.
+ */
+static void dir_watch(struct path_dir *dir)
+{
+    dir->wd = -1;
+    if(inotify_fd != -1) {
+        dir->wd = inotify_add_watch(inotify_fd, dir->path, PATHINDEX_WATCH_MASK | IN_ONLYDIR);
+    }
+}
+
+/**
+ * Stops watching a directory. The same directory may be in PATH under
+ * several names, which share one watch.
+ */
+static void dir_unwatch(struct path_dir *dir, const struct path_dir *others, size_t other_count)
+{
+    if(dir->wd == -1) {
+        return;
+    }
+    for(size_t i = 0; i < other_count; i++) {
+        if(others[i].wd == dir->wd) {
+            return;
+        }
+    }
+    inotify_rm_watch(inotify_fd, dir->wd);
+}
+
+/**
+ * Takes the directories from a new PATH. Directories that are still in it
+ * keep their listing and watch, new ones are watched and listed.
+ */
+static void path_sync(const char *path)
+{
+    LOG("Indexing PATH %s\n", path);
+
+    size_t count = 1;
+    for(const char *c = path; *c != '\0'; c++) {
+        count += *c == ':';
+    }
+    struct path_dir *fresh = calloc(count, sizeof(struct path_dir));
+    size_t fresh_count = 0;
+
+    const char *start = path;
+    while(start != NULL) {
+        const char *end = strchr(start, ':');
+        size_t len = end != NULL ? (size_t) (end - start) : strlen(start);
+        /* An empty PATH entry means the current directory */
+        char *dir_path = len == 0 ? strdup(".") : strndup(start, len);
+
+        bool seen = false;
+        for(size_t i = 0; i < fresh_count && !seen; i++) {
+            seen = strcmp(fresh[i].path, dir_path) == 0;
+        }
+        if(seen) {
+            free(dir_path);
+            start = end != NULL ? end + 1 : NULL;
+            continue;
+        }
+
+        struct path_dir *dir = &fresh[fresh_count++];
+        for(size_t i = 0; i < dir_count; i++) {
+            if(dirs[i].path != NULL && strcmp(dirs[i].path, dir_path) == 0) {
+                *dir = dirs[i];
+                dirs[i].path = NULL;
+                dirs[i].names = NULL;
+                dirs[i].wd = -1;
+                break;
+            }
+        }
+        if(dir->path == NULL) {
+            dir->path = dir_path;
+            dir_watch(dir);
+            dir->dirty = true;
+        } else {
+            free(dir_path);
+        }
+        start = end != NULL ? end + 1 : NULL;
+    }
+
+    for(size_t i = 0; i < dir_count; i++) {
+        dir_unwatch(&dirs[i], fresh, fresh_count);
+        free(dirs[i].path);
+        free(dirs[i].names);
+    }
+    free(dirs);
+    dirs = fresh;
+    dir_count = fresh_count;
+    free(index_path);
+    index_path = strdup(path);
+}
+
+/**
+ * Builds an index from the directory listings and hands it to the
+ * completing thread, replacing any index it hasn't taken yet.
+ */
+static void index_publish(void)
+{
+    size_t total = 0;
+    size_t names_sz = 0;
+    for(size_t i = 0; i < dir_count; i++) {
+        total += dirs[i].count;
+        names_sz += dirs[i].names_sz;
+    }
+
+    struct snapshot *snap = malloc(sizeof(struct snapshot));
+    snap->names = malloc(names_sz > 0 ? names_sz : 1);
+    snap->entries = malloc((total > 0 ? total : 1) * sizeof(char *));
+    size_t count = 0;
+    size_t offset = 0;
+    for(size_t i = 0; i < dir_count; i++) {
+        if(!dirs[i].listed) {
+            continue;
+        }
+        memcpy(snap->names + offset, dirs[i].names, dirs[i].names_sz);
+        const char *name = snap->names + offset;
+        for(size_t j = 0; j < dirs[i].count; j++) {
+            snap->entries[count++] = name;
+            name += strlen(name) + 1;
+        }
+        offset += dirs[i].names_sz;
+    }
+
+    qsort(snap->entries, count, sizeof(char *), name_cmp);
+    snap->count = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(snap->count == 0 || strcmp(snap->entries[snap->count - 1], snap->entries[i]) != 0) {
+            snap->entries[snap->count++] = snap->entries[i];
+        }
+    }
+
+    LOG("Publishing command index of %zu names\n", snap->count);
+    snapshot_free(atomic_exchange(&pending, snap));
+}
+
+/**
+ * Marks the directories an inotify event is about. The watch descriptors
+ * are all that is needed, not the names of the files that changed.
+ */
+static void watch_events(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for(char *p = buf; p < buf + len; ) {
+            struct inotify_event *event = (struct inotify_event *) p;
+            for(size_t i = 0; i < dir_count; i++) {
+                if(event->mask & IN_Q_OVERFLOW || dirs[i].wd == event->wd) {
+                    dirs[i].dirty = true;
+                }
+            }
+            if(event->mask & IN_IGNORED) {
+                /* The directory went away, its watch with it */
+                for(size_t i = 0; i < dir_count; i++) {
+                    if(dirs[i].wd == event->wd) {
+                        dirs[i].wd = -1;
+                    }
+                }
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+/**
+ * Lists the directories that are not watched again if their modification
+ * time changed, which covers directories that didn't exist before.
+ */
+static void check_dirs(void)
+{
+    for(size_t i = 0; i < dir_count; i++) {
+        struct path_dir *dir = &dirs[i];
+        if(dir->wd != -1) {
+            continue;
+        }
+        struct stat st;
+        if(stat(dir->path, &st) != 0) {
+            dir->dirty = dir->listed;
+            continue;
+        }
+        dir_watch(dir);
+        if(!dir->listed || st.st_mtim.tv_sec != dir->mtime.tv_sec
+                || st.st_mtim.tv_nsec != dir->mtime.tv_nsec) {
+            dir->dirty = true;
+        }
+    }
+}
+
+/**
+ * Body of the index thread. It lists PATH once, then sleeps until a watched
+ * directory changes or the completing thread asks it to look again.
+ */
+static void *index_main(void *arg)
+{
+    struct pollfd fds[2] = {
+        { .fd = wake_pipe[0], .events = POLLIN },
+        { .fd = inotify_fd, .events = POLLIN },
+    };
+    bool changed = true;
+
+    while(!atomic_load(&stopping)) {
+        pthread_mutex_lock(&request_lock);
+        char *path = requested_path;
+        requested_path = NULL;
+        pthread_mutex_unlock(&request_lock);
+        if(path != NULL) {
+            if(index_path == NULL || strcmp(path, index_path) != 0) {
+                path_sync(path);
+                changed = true;
+            }
+            free(path);
+        }
+        if(atomic_exchange(&check_unwatched, false)) {
+            check_dirs();
+        }
+
+        for(size_t i = 0; i < dir_count; i++) {
+            if(dirs[i].dirty) {
+                dir_list(&dirs[i]);
+                changed = true;
+            }
+        }
+        if(changed) {
+            index_publish();
+            changed = false;
+        }
+
+        poll(fds, inotify_fd != -1 ? 2 : 1, -1);
+        if(fds[0].revents & POLLIN) {
+            char drain[64];
+            while(read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+        if(inotify_fd != -1 && fds[1].revents & POLLIN) {
+            /* Wait for the directories to settle before listing them */
+            do {
+                watch_events();
+            } while(poll(&fds[1], 1, PATHINDEX_SETTLE_MS) > 0 && !atomic_load(&stopping));
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Asks the index thread to look at its state again.
+ */
+static void index_wake(void)
+{
+    if(wake_pipe[1] != -1) {
+        char byte = 0;
+        ssize_t unused = write(wake_pipe[1], &byte, 1);
+        (void) unused;
+    }
+}
+
+/**
+ * Hands the current PATH to the index thread if it changed.
+ */
+static void path_request(void)
+{
+    const char *path = getenv("PATH");
+    if(path == NULL) {
+        path = "";
+    }
+    if(seen_path != NULL && strcmp(seen_path, path) == 0) {
+        return;
+    }
+    free(seen_path);
+    seen_path = strdup(path);
+
+    pthread_mutex_lock(&request_lock);
+    free(requested_path);
+    requested_path = strdup(path);
+    pthread_mutex_unlock(&request_lock);
+    index_wake();
+}
+
+/**
+ * Starts building the index on a thread of its own, without waiting for it.
+ * Signals are left to the other threads.
+ */
+void pathindex_start(void)
+{
+    if(thread_running) {
+        return;
+    }
+    if(pipe2(wake_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        perror("pathindex");
+        return;
+    }
+    inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if(inotify_fd == -1) {
+        LOGL(LOGGER_WARN, "No inotify, directories are only checked on completion: %s\n",
+                strerror(errno));
+    }
+    path_request();
+
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    thread_running = pthread_create(&index_thread, NULL, index_main, NULL) == 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(!thread_running) {
+        perror("pathindex");
+    }
+}
+
+/**
+ * Adds a builtin to the commands that are completed.
+ *
+ * @param name name of the builtin, which must stay valid
+ */
+void pathindex_add_builtin(const char *name)
+{
+    builtins = realloc(builtins, (builtin_count + 1) * sizeof(char *));
+    builtins[builtin_count++] = name;
+    qsort(builtins, builtin_count, sizeof(char *), name_cmp);
+    stale = true;
+}
+
+/**
+ * Merges the adopted index with the builtins.
+ */
+static void index_merge(void)
+{
+    size_t path_count = adopted->count;
+    entries = realloc(entries, (path_count + builtin_count + 1) * sizeof(char *));
+    entry_count = 0;
+
+    size_t i = 0;
+    size_t j = 0;
+    while(i < path_count || j < builtin_count) {
+        int cmp = i == path_count ? 1
+            : j == builtin_count ? -1
+            : strcmp(adopted->entries[i], builtins[j]);
+        if(cmp <= 0) {
+            entries[entry_count++] = adopted->entries[i++];
+            j += cmp == 0;
+        } else {
+            entries[entry_count++] = builtins[j++];
+        }
+    }
+    stale = false;
+}
+
+/**
+ * Takes the newest index the index thread published, and lets it know
+ * whether PATH changed. Never waits for the index thread.
+ *
+ * @return true if there is an index to complete from
+ */
+bool pathindex_refresh(void)
+{
+    if(!thread_running) {
+        return false;
+    }
+    path_request();
+    /* Directories that couldn't be watched are checked on each completion */
+    atomic_store(&check_unwatched, true);
+    index_wake();
+
+    struct snapshot *fresh = atomic_exchange(&pending, NULL);
+    if(fresh != NULL) {
+        snapshot_free(adopted);
+        adopted = fresh;
+        stale = true;
+    }
+    if(adopted == NULL) {
+        return false;
+    }
+    if(stale) {
+        index_merge();
+    }
+    return true;
+}
+
+/**
+ * Finds the commands starting with a prefix.
+ *
+ * @param prefix start of the command names
+ * @param count receives the number of matches
+ * @return first of the matches, which are sorted and follow each other; valid
+ *  until the next refresh
+ */
+const char *const *pathindex_match(const char *prefix, size_t *count)
+{
+    size_t len = strlen(prefix);
+    size_t low = 0;
+    size_t high = entry_count;
+    while(low < high) {
+        size_t mid = low + (high - low) / 2;
+        if(strcmp(entries[mid], prefix) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    size_t end = low;
+    while(end < entry_count && strncmp(entries[end], prefix, len) == 0) {
+        end++;
+    }
+    *count = end - low;
+    return entries + low;
+}
+
+/**
+ * Stops the index thread and frees the index.
+ */
+void pathindex_destroy(void)
+{
+    if(thread_running) {
+        atomic_store(&stopping, true);
+        index_wake();
+        pthread_join(index_thread, NULL);
+        thread_running = false;
+    }
+
+    for(size_t i = 0; i < dir_count; i++) {
+        free(dirs[i].path);
+        free(dirs[i].names);
+    }
+    free(dirs);
+    dirs = NULL;
+    dir_count = 0;
+    free(index_path);
+    index_path = NULL;
+    free(requested_path);
+    requested_path = NULL;
+    free(seen_path);
+    seen_path = NULL;
+    if(inotify_fd != -1) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    for(int i = 0; i < 2; i++) {
+        if(wake_pipe[i] != -1) {
+            close(wake_pipe[i]);
+            wake_pipe[i] = -1;
+        }
+    }
+
+    snapshot_free(atomic_exchange(&pending, NULL));
+    snapshot_free(adopted);
+    adopted = NULL;
+    free(entries);
+    entries = NULL;
+    entry_count = 0;
+    free(builtins);
+    builtins = NULL;
+    builtin_count = 0;
+    atomic_store(&stopping, false);
+    stale = true;
+}
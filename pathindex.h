@@ -0,0 +1,24 @@
+/**
+ * @file
+ *
+ * Index of the commands that can be completed: every executable in the PATH
+ * directories plus the shell's builtins, kept as one sorted array so all the
+ * commands starting with a prefix are found with a binary search. The index
+ * is built on a thread of its own, which watches the directories with inotify
+ * and publishes a new index whenever one of them changes; completion only
+ * ever takes the newest index it published and never waits for it.
+ */
+
+#ifndef _PATHINDEX_H_
+#define _PATHINDEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+void pathindex_start(void);
+void pathindex_add_builtin(const char *name);
+bool pathindex_refresh(void);
+const char *const *pathindex_match(const char *prefix, size_t *count);
+void pathindex_destroy(void);
+
+#endif
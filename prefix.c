@@ -0,0 +1,279 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "prefix.h"
+
+/* Commands are indexed by at most this many leading characters. Longer
+ * prefixes are answered from the node for their first PREFIX_DEPTH characters,
+ * so callers have to check those candidates against the whole prefix. */
+#define PREFIX_DEPTH 16
+
+/* Trie node. Every node holds, in ascending order, the command numbers of all
+ * commands that start with the characters on the path to it. Since commands
+ * are added newest last and evicted oldest first, each list only ever grows
+ * at the back and shrinks at either end. */
+struct prefix_node {
+    char c;
+    struct prefix_node *child;
+    struct prefix_node *sibling;
+    unsigned int *cnums;
+    unsigned int first;     /* Index of the oldest command number */
+    unsigned int count;     /* Amount of command numbers held */
+    unsigned int cap;
+};
+
+/* The root holds every command, it stands for the empty prefix */
+static struct prefix_node root = { 0 };
+
+/**
+ * Finds the child of a node for a character, optionally creating it.
+ */
+static struct prefix_node *node_child(struct prefix_node *node, char c, int create)
+{
+    struct prefix_node *child = node->child;
+    while(child != NULL && child->c != c) {
+        child = child->sibling;
+    }
+    if(child == NULL && create) {
+        child = calloc(1, sizeof(struct prefix_node));
+        child->c = c;
+        child->sibling = node->child;
+        node->child = child;
+    }
+    return child;
+}
+
+/**
+ * Frees a node and all of its descendants.
+ */
+static void node_free(struct prefix_node *node)
+{
+    while(node->child != NULL) {
+        struct prefix_node *child = node->child;
+        node->child = child->sibling;
+        node_free(child);
+    }
+    free(node->cnums);
+    if(node != &root) {
+        free(node);
+    }
+}
+
+/**
+ * Unlinks an emptied child from its parent and frees it. Every command below
+ * it also passed through it, so its whole subtree is empty as well.
+ */
+static void node_prune(struct prefix_node *parent, struct prefix_node *child)
+{
+    struct prefix_node **link = &parent->child;
+    while(*link != child) {
+        link = &(*link)->sibling;
+    }
+    *link = child->sibling;
+    child->sibling = NULL;
+    node_free(child);
+}
+
+/**
+ * Allocates the lists of a node and its descendants at the capacity counted
+ * for them. Nodes of an empty index have no list yet.
+ */
+static void node_alloc(struct prefix_node *node)
+{
+    free(node->cnums);
+    node->cnums = malloc(node->cap * sizeof(unsigned int));
+    node->first = 0;
+    for(struct prefix_node *child = node->child; child != NULL; child = child->sibling) {
+        node_alloc(child);
+    }
+}
+
+/**
+ * Appends a command number to the back of a node's list.
+ */
+static void node_append(struct prefix_node *node, unsigned int command_number)
+{
+    if(node->first + node->count == node->cap) {
+        if(node->first > 0) {
+            memmove(node->cnums, node->cnums + node->first,
+                    node->count * sizeof(unsigned int));
+            node->first = 0;
+        } else {
+            node->cap = node->cap == 0 ? 4 : node->cap * 2;
+            node->cnums = realloc(node->cnums, node->cap * sizeof(unsigned int));
+        }
+    }
+    node->cnums[node->first + node->count] = command_number;
+    node->count += 1;
+}
+
+/**
+ * Adds a command to the index. Command numbers have to be added in ascending
+ * order.
+ *
+ * @param cmd command string
+ * @param command_number number of the command in the history
+ */
+void prefix_add(const char *cmd, unsigned int command_number)
+{
+    struct prefix_node *node = &root;
+    node_append(node, command_number);
+    for(int depth = 0; depth < PREFIX_DEPTH && cmd[depth] != '\0'; depth++) {
+        node = node_child(node, cmd[depth], 1);
+        node_append(node, command_number);
+    }
+}
+
+/**
+ * Adds many commands to the index at once. Into an empty index, the nodes
+ * are counted first so that each list is allocated once at its final size.
+ *
+ * @param cmds command strings, oldest first
+ * @param count number of commands
+ * @param command_number number of the first command; the others follow it
+ */
+void prefix_add_all(const char *cmds[], unsigned int count, unsigned int command_number)
+{
+    if(root.count == 0) {
+        /* An empty index has no nodes below the root */
+        root.cap = 0;
+        for(unsigned int i = 0; i < count; i++) {
+            struct prefix_node *node = &root;
+            node->cap += 1;
+            for(int depth = 0; depth < PREFIX_DEPTH && cmds[i][depth] != '\0'; depth++) {
+                node = node_child(node, cmds[i][depth], 1);
+                node->cap += 1;
+            }
+        }
+        node_alloc(&root);
+    }
+    for(unsigned int i = 0; i < count; i++) {
+        prefix_add(cmds[i], command_number + i);
+    }
+}
+
+/**
+ * Removes the oldest or newest command from every node on its path.
+ */
+static void prefix_pop(const char *cmd, int newest)
+{
+    struct prefix_node *node = &root;
+    for(int depth = 0; node != NULL; depth++) {
+        if(node->count > 0) {
+            node->count -= 1;
+            if(!newest) {
+                node->first += 1;
+            }
+        }
+
+        if(depth == PREFIX_DEPTH || cmd[depth] == '\0') {
+            break;
+        }
+        struct prefix_node *child = node_child(node, cmd[depth], 0);
+        if(child != NULL && child->count == 1) {
+            node_prune(node, child);
+            break;
+        }
+        node = child;
+    }
+}
+
+/**
+ * Removes the oldest command in the index.
+ *
+ * @param cmd command string of the oldest command
+ */
+void prefix_pop_oldest(const char *cmd)
+{
+    prefix_pop(cmd, 0);
+}
+
+/**
+ * Removes the newest command in the index.
+ *
+ * @param cmd command string of the newest command
+ */
+void prefix_pop_newest(const char *cmd)
+{
+    prefix_pop(cmd, 1);
+}
+
+/**
+ * Removes every command from the index.
+ */
+void prefix_clear(void)
+{
+    node_free(&root);
+    memset(&root, 0, sizeof(struct prefix_node));
+}
+
+/**
+ * Finds the node holding the commands that start with a prefix.
+ */
+static struct prefix_node *prefix_node(const char *prefix)
+{
+    struct prefix_node *node = &root;
+    for(int depth = 0; node != NULL && depth < PREFIX_DEPTH && prefix[depth] != '\0'; depth++) {
+        node = node_child(node, prefix[depth], 0);
+    }
+    return node;
+}
+
+/**
+ * Counts the command numbers in a node that are lower than the given one.
+ */
+static unsigned int node_lower(const struct prefix_node *node, unsigned int command_number)
+{
+    const unsigned int *cnums = node->cnums + node->first;
+    unsigned int low = 0;
+    unsigned int high = node->count;
+    while(low < high) {
+        unsigned int mid = low + (high - low) / 2;
+        if(cnums[mid] < command_number) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * Finds the newest command older than a command number that starts with a
+ * prefix. Only the first PREFIX_DEPTH characters of the prefix are matched.
+ *
+ * @param prefix prefix to search for
+ * @param command_number only commands numbered lower than this are considered
+ * @return the command number found, or 0 if there is none
+ */
+unsigned int prefix_older(const char *prefix, unsigned int command_number)
+{
+    struct prefix_node *node = prefix_node(prefix);
+    if(node == NULL) {
+        return 0;
+    }
+    unsigned int lower = node_lower(node, command_number);
+    return lower > 0
+        ? node->cnums[node->first + lower - 1]
+        : 0;
+}
+
+/**
+ * Finds the oldest command newer than a command number that starts with a
+ * prefix. Only the first PREFIX_DEPTH characters of the prefix are matched.
+ *
+ * @param prefix prefix to search for
+ * @param command_number only commands numbered higher than this are considered
+ * @return the command number found, or 0 if there is none
+ */
+unsigned int prefix_newer(const char *prefix, unsigned int command_number)
+{
+    struct prefix_node *node = prefix_node(prefix);
+    if(node == NULL) {
+        return 0;
+    }
+    unsigned int lower = node_lower(node, command_number + 1);
+    return lower < node->count
+        ? node->cnums[node->first + lower]
+        : 0;
+}
@@ -0,0 +1,19 @@
+/**
+ * @file
+ *
+ * Prefix index over the history, answering "newest command older than N that
+ * starts with this prefix" (and the newer counterpart) without scanning.
+ */
+
+#ifndef _PREFIX_H_
+#define _PREFIX_H_
+
+void prefix_add(const char *cmd, unsigned int command_number);
+void prefix_add_all(const char *cmds[], unsigned int count, unsigned int command_number);
+void prefix_pop_oldest(const char *cmd);
+void prefix_pop_newest(const char *cmd);
+void prefix_clear(void);
+unsigned int prefix_older(const char *prefix, unsigned int command_number);
+unsigned int prefix_newer(const char *prefix, unsigned int command_number);
+
+#endif
@@ -0,0 +1,676 @@
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEARCH_X86 1
+#else
+#define SEARCH_X86 0
+#endif
+
+#include "logger.h"
+#include "search.h"
+
+/* How many matches a query ranks, i.e. how far Ctrl-R can cycle. Commands
+ * containing the query rank first, then commands containing its characters
+ * in order; newer commands rank higher within each group. */
+#define SEARCH_RANKS 64
+
+/* Mirror of the history: every command NUL-terminated, oldest first, in one
+ * buffer. Offsets are absolute, text_shift is how many bytes of dead space
+ * have been dropped from the front of the buffer so far. */
+static char *text = NULL;
+static size_t text_cap = 0;
+static size_t text_shift = 0;
+static size_t text_start = 0;
+static size_t text_end = 0;
+
+/* Offset and character signature of every command, oldest first. A
+ * signature has a bit set for every (case folded) character class the
+ * command contains, so most commands that cannot hold a query's characters
+ * are ruled out without looking at their text. */
+static size_t *offs = NULL;
+static unsigned long long *sigs = NULL;
+static unsigned int ent_first = 0;
+static unsigned int ent_count = 0;
+static unsigned int ent_cap = 0;
+static unsigned int first_cnum = 0;
+
+/* Results of the last query, newest first. The history is examined from the
+ * newest command back and only as far as needed: subs holds the substring
+ * matches among the commands from sub_from on, fuzz the in-order matches among
+ * the commands from fuzz_from on. A query extending the last one can only
+ * match a subset of these, so it starts from them instead of from scratch. */
+struct match_list {
+    unsigned int *cnums;
+    unsigned int count;
+    unsigned int cap;
+};
+static char *last_query = NULL;
+static struct match_list subs = { 0 };
+static struct match_list fuzz = { 0 };
+static struct match_list demoted = { 0 };
+static unsigned int sub_from = 0;
+static unsigned int fuzz_from = 0;
+
+/* Finds the last occurrence of the query lying entirely in [start, end), or
+ * NULL. With fold set, letters match regardless of case (the query is
+ * lowercase then). */
+typedef const char *(*substr_fn)(const char *start, const char *end,
+        const char *query, size_t query_sz, bool fold);
+
+/* Finds the highest index below hi whose signature has every bit of the query
+ * signature set, or -1. */
+typedef long (*sig_fn)(const unsigned long long *sigs, long hi, unsigned long long query_sig);
+
+struct scanner {
+    const char *name;
+    substr_fn substr_back;
+    sig_fn sig_back;
+};
+static const struct scanner *scanner = NULL;
+
+/**
+ * Gives the mask that folds a byte onto the query character, 0x20 for letters
+ * when ignoring case.
+ */
+static unsigned char fold_mask(char c, bool fold)
+{
+    return fold && c >= 'a' && c <= 'z' ? 0x20 : 0;
+}
+
+static bool same(const char *str, const char *query, size_t query_sz, bool fold)
+{
+    return fold
+        ? strncasecmp(str, query, query_sz) == 0
+        : memcmp(str, query, query_sz) == 0;
+}
+
+static const char *substr_back_scalar(const char *start, const char *end,
+        const char *query, size_t query_sz, bool fold)
+{
+    unsigned char first = query[0];
+    unsigned char mask = fold_mask(query[0], fold);
+    for(const char *pos = end - query_sz; pos >= start; pos--) {
+        if(((unsigned char) *pos | mask) == first && same(pos, query, query_sz, fold)) {
+            return pos;
+        }
+    }
+    return NULL;
+}
+
+static long sig_back_scalar(const unsigned long long *sigs, long hi, unsigned long long query_sig)
+{
+    while(hi > 0) {
+        hi--;
+        if((sigs[hi] & query_sig) == query_sig) {
+            return hi;
+        }
+    }
+    return -1;
+}
+
+static const struct scanner scalar_scanner = {
+    "scalar", substr_back_scalar, sig_back_scalar
+};
+
+#if SEARCH_X86
+/* The vector scanners compare the query's first and last characters against
+ * a whole block of candidate positions at once, and only verify the positions
+ * where both agree. */
+
+__attribute__((target("sse2")))
+static const char *substr_back_sse2(const char *start, const char *end,
+        const char *query, size_t query_sz, bool fold)
+{
+    __m128i first = _mm_set1_epi8(query[0]);
+    __m128i last = _mm_set1_epi8(query[query_sz - 1]);
+    __m128i first_mask = _mm_set1_epi8(fold_mask(query[0], fold));
+    __m128i last_mask = _mm_set1_epi8(fold_mask(query[query_sz - 1], fold));
+
+    /* Candidate positions are the ones below pos */
+    const char *pos = end - query_sz + 1;
+    while(pos - start >= 16) {
+        __m128i head = _mm_loadu_si128((const __m128i *) (pos - 16));
+        __m128i tail = _mm_loadu_si128((const __m128i *) (pos - 16 + query_sz - 1));
+        head = _mm_cmpeq_epi8(_mm_or_si128(head, first_mask), first);
+        tail = _mm_cmpeq_epi8(_mm_or_si128(tail, last_mask), last);
+        unsigned int hits = _mm_movemask_epi8(_mm_and_si128(head, tail));
+        while(hits != 0) {
+            int bit = 31 - __builtin_clz(hits);
+            if(same(pos - 16 + bit, query, query_sz, fold)) {
+                return pos - 16 + bit;
+            }
+            hits &= ~(1u << bit);
+        }
+        pos -= 16;
+    }
+    return substr_back_scalar(start, pos + query_sz - 1, query, query_sz, fold);
+}
+
+__attribute__((target("sse2")))
+static long sig_back_sse2(const unsigned long long *sigs, long hi, unsigned long long query_sig)
+{
+    /* SSE2 has no 64-bit compare, so both 32-bit halves have to match */
+    __m128i query = _mm_set1_epi64x(query_sig);
+    while(hi >= 2) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (sigs + hi - 2));
+        block = _mm_cmpeq_epi32(_mm_and_si128(block, query), query);
+        unsigned int halves = _mm_movemask_ps(_mm_castsi128_ps(block));
+        unsigned int hits = halves & (halves >> 1) & 0x5;
+        if(hits != 0) {
+            return hi - 2 + ((31 - __builtin_clz(hits)) >> 1);
+        }
+        hi -= 2;
+    }
+    return sig_back_scalar(sigs, hi, query_sig);
+}
+
+static const struct scanner sse2_scanner = {
+    "SSE2", substr_back_sse2, sig_back_sse2
+};
+
+__attribute__((target("avx2")))
+static const char *substr_back_avx2(const char *start, const char *end,
+        const char *query, size_t query_sz, bool fold)
+{
+    __m256i first = _mm256_set1_epi8(query[0]);
+    __m256i last = _mm256_set1_epi8(query[query_sz - 1]);
+    __m256i first_mask = _mm256_set1_epi8(fold_mask(query[0], fold));
+    __m256i last_mask = _mm256_set1_epi8(fold_mask(query[query_sz - 1], fold));
+
+    const char *pos = end - query_sz + 1;
+    while(pos - start >= 32) {
+        __m256i head = _mm256_loadu_si256((const __m256i *) (pos - 32));
+        __m256i tail = _mm256_loadu_si256((const __m256i *) (pos - 32 + query_sz - 1));
+        head = _mm256_cmpeq_epi8(_mm256_or_si256(head, first_mask), first);
+        tail = _mm256_cmpeq_epi8(_mm256_or_si256(tail, last_mask), last);
+        unsigned int hits = _mm256_movemask_epi8(_mm256_and_si256(head, tail));
+        while(hits != 0) {
+            int bit = 31 - __builtin_clz(hits);
+            if(same(pos - 32 + bit, query, query_sz, fold)) {
+                return pos - 32 + bit;
+            }
+            hits &= ~(1u << bit);
+        }
+        pos -= 32;
+    }
+    return substr_back_scalar(start, pos + query_sz - 1, query, query_sz, fold);
+}
+
+__attribute__((target("avx2")))
+static long sig_back_avx2(const unsigned long long *sigs, long hi, unsigned long long query_sig)
+{
+    __m256i query = _mm256_set1_epi64x(query_sig);
+    while(hi >= 8) {
+        __m256i high = _mm256_loadu_si256((const __m256i *) (sigs + hi - 4));
+        __m256i low = _mm256_loadu_si256((const __m256i *) (sigs + hi - 8));
+        high = _mm256_cmpeq_epi64(_mm256_and_si256(high, query), query);
+        low = _mm256_cmpeq_epi64(_mm256_and_si256(low, query), query);
+        unsigned int hits
+            = _mm256_movemask_pd(_mm256_castsi256_pd(high)) << 4
+            | _mm256_movemask_pd(_mm256_castsi256_pd(low));
+        if(hits != 0) {
+            return hi - 8 + (31 - __builtin_clz(hits));
+        }
+        hi -= 8;
+    }
+    return sig_back_scalar(sigs, hi, query_sig);
+}
+
+static const struct scanner avx2_scanner = {
+    "AVX2", substr_back_avx2, sig_back_avx2
+};
+#endif
+
+/**
+ * Picks the widest scanner the CPU supports.
+ */
+static void scanner_init(void)
+{
+    scanner = &scalar_scanner;
+#if SEARCH_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        scanner = &avx2_scanner;
+    } else if(__builtin_cpu_supports("sse2")) {
+        scanner = &sse2_scanner;
+    }
+#endif
+    LOG("Using %s history scanner\n", scanner->name);
+}
+
+/**
+ * Gives the bit standing for a character in signatures.
+ */
+static unsigned int sig_bit(unsigned char c)
+{
+    if(c >= 'A' && c <= 'Z') {
+        c |= 0x20;
+    }
+    if(c >= 'a' && c <= 'z') {
+        return c - 'a';
+    }
+    if(c >= '0' && c <= '9') {
+        return 26 + c - '0';
+    }
+    return 36 + c % 28;
+}
+
+static unsigned long long signature(const char *str)
+{
+    unsigned long long sig = 0;
+    for(; *str != '\0'; str++) {
+        sig |= 1ULL << sig_bit(*str);
+    }
+    return sig;
+}
+
+/**
+ * Gives the text of the command at an index of the entry list.
+ */
+static char *entry_text(unsigned int idx)
+{
+    return text + (offs[ent_first + idx] - text_shift);
+}
+
+/**
+ * Finds the index of the command whose text holds a position.
+ */
+static unsigned int entry_at(const char *pos)
+{
+    size_t off = (pos - text) + text_shift;
+    const size_t *base = offs + ent_first;
+    unsigned int low = 0;
+    unsigned int high = ent_count;
+    while(high - low > 1) {
+        unsigned int mid = low + (high - low) / 2;
+        if(base[mid] <= off) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static void list_reserve(struct match_list *list, unsigned int count)
+{
+    if(count > list->cap) {
+        while(count > list->cap) {
+            list->cap = list->cap == 0 ? SEARCH_RANKS : list->cap * 2;
+        }
+        list->cnums = realloc(list->cnums, list->cap * sizeof(unsigned int));
+    }
+}
+
+static void list_push(struct match_list *list, unsigned int command_number)
+{
+    list_reserve(list, list->count + 1);
+    list->cnums[list->count++] = command_number;
+}
+
+static void list_free(struct match_list *list)
+{
+    free(list->cnums);
+    memset(list, 0, sizeof(struct match_list));
+}
+
+/**
+ * Forgets the results of the last query, they are stale once the history
+ * changes.
+ */
+static void query_reset(void)
+{
+    free(last_query);
+    last_query = NULL;
+    subs.count = 0;
+    fuzz.count = 0;
+    sub_from = fuzz_from = first_cnum + ent_count;
+}
+
+/**
+ * Makes room for size more bytes at the end of the mirrored text.
+ */
+static void text_reserve(size_t size)
+{
+    if(text_end - text_shift + size > text_cap) {
+        size_t live = text_end - text_start;
+        if(text_start - text_shift >= live && live + size <= text_cap) {
+            /* Most of the buffer is commands that were already evicted */
+            memmove(text, text + (text_start - text_shift), live);
+            text_shift = text_start;
+        } else {
+            while(text_end - text_shift + size > text_cap) {
+                text_cap = text_cap == 0 ? 4096 : text_cap * 2;
+            }
+            text = realloc(text, text_cap);
+        }
+    }
+}
+
+/**
+ * Makes room for count more entries at the end of the entry list.
+ */
+static void entries_reserve(unsigned int count)
+{
+    if(ent_first + ent_count + count > ent_cap) {
+        if(ent_first > 0) {
+            memmove(offs, offs + ent_first, ent_count * sizeof(size_t));
+            memmove(sigs, sigs + ent_first, ent_count * sizeof(unsigned long long));
+            ent_first = 0;
+        }
+        if(ent_count + count > ent_cap) {
+            while(ent_count + count > ent_cap) {
+                ent_cap = ent_cap == 0 ? 64 : ent_cap * 2;
+            }
+            offs = realloc(offs, ent_cap * sizeof(size_t));
+            sigs = realloc(sigs, ent_cap * sizeof(unsigned long long));
+        }
+    }
+}
+
+/**
+ * Appends a command to the text and the entry list, leaving the results of
+ * the last query to the caller.
+ */
+static void entry_append(const char *cmd, size_t len, unsigned int command_number)
+{
+    memcpy(text + (text_end - text_shift), cmd, len);
+    if(ent_count == 0) {
+        first_cnum = command_number;
+    }
+    offs[ent_first + ent_count] = text_end;
+    sigs[ent_first + ent_count] = signature(cmd);
+    ent_count += 1;
+    text_end += len;
+}
+
+/**
+ * Adds a command to the end of the mirrored history. Command numbers have to
+ * be added in ascending order without gaps.
+ *
+ * @param cmd command string
+ * @param command_number number of the command in the history
+ */
+void search_add(const char *cmd, unsigned int command_number)
+{
+    size_t len = strlen(cmd) + 1;
+    text_reserve(len);
+    entries_reserve(1);
+    entry_append(cmd, len, command_number);
+    query_reset();
+}
+
+/**
+ * Adds many commands at once, growing the buffers only once.
+ *
+ * @param cmds command strings, oldest first
+ * @param count number of commands
+ * @param command_number number of the first command; the others follow it
+ */
+void search_add_all(const char *cmds[], unsigned int count, unsigned int command_number)
+{
+    size_t size = 0;
+    for(unsigned int i = 0; i < count; i++) {
+        size += strlen(cmds[i]) + 1;
+    }
+    text_reserve(size);
+    entries_reserve(count);
+    for(unsigned int i = 0; i < count; i++) {
+        entry_append(cmds[i], strlen(cmds[i]) + 1, command_number + i);
+    }
+    query_reset();
+}
+
+/**
+ * Removes the oldest command from the mirrored history.
+ */
+void search_pop_oldest(void)
+{
+    if(ent_count == 0) {
+        return;
+    }
+    ent_first += 1;
+    ent_count -= 1;
+    first_cnum += 1;
+    text_start = ent_count > 0 ? offs[ent_first] : text_end;
+    query_reset();
+}
+
+/**
+ * Removes the newest command from the mirrored history.
+ */
+void search_pop_newest(void)
+{
+    if(ent_count == 0) {
+        return;
+    }
+    ent_count -= 1;
+    text_end = offs[ent_first + ent_count];
+    query_reset();
+}
+
+/**
+ * Removes every command from the mirrored history and frees its memory.
+ */
+void search_clear(void)
+{
+    search_done();
+    free(text);
+    free(offs);
+    free(sigs);
+    text = NULL;
+    offs = NULL;
+    sigs = NULL;
+    text_cap = text_shift = text_start = text_end = 0;
+    ent_first = ent_count = ent_cap = 0;
+    query_reset();
+}
+
+static bool has_substr(const char *cmd, const char *query, bool fold)
+{
+    return (fold ? strcasestr(cmd, query) : strstr(cmd, query)) != NULL;
+}
+
+/**
+ * Checks whether a command contains the query's characters in order.
+ */
+static bool has_subseq(const char *cmd, const char *query, bool fold)
+{
+    for(; *query != '\0'; query++) {
+        unsigned char mask = fold_mask(*query, fold);
+        while(*cmd != '\0' && ((unsigned char) *cmd | mask) != (unsigned char) *query) {
+            cmd++;
+        }
+        if(*cmd == '\0') {
+            return false;
+        }
+        cmd++;
+    }
+    return true;
+}
+
+/**
+ * Narrows the last query's matches down to the ones that still match a query
+ * extending it. Substring matches that no longer contain the query may still
+ * match in order, those move over to the in-order matches.
+ */
+static void query_narrow(const char *query, bool fold)
+{
+    unsigned int kept = 0;
+    demoted.count = 0;
+    for(unsigned int i = 0; i < subs.count; i++) {
+        unsigned int cnum = subs.cnums[i];
+        const char *cmd = entry_text(cnum - first_cnum);
+        if(has_substr(cmd, query, fold)) {
+            subs.cnums[kept++] = cnum;
+        } else if(cnum >= fuzz_from && has_subseq(cmd, query, fold)) {
+            list_push(&demoted, cnum);
+        }
+    }
+    subs.count = kept;
+
+    kept = 0;
+    for(unsigned int i = 0; i < fuzz.count; i++) {
+        unsigned int cnum = fuzz.cnums[i];
+        if(has_subseq(entry_text(cnum - first_cnum), query, fold)) {
+            fuzz.cnums[kept++] = cnum;
+        }
+    }
+    fuzz.count = kept;
+
+    if(demoted.count > 0) {
+        /* Merge both lists, newest first, working back from the end */
+        unsigned int i = fuzz.count;
+        unsigned int j = demoted.count;
+        unsigned int out = fuzz.count + demoted.count;
+        list_reserve(&fuzz, out);
+        fuzz.count = out;
+        while(j > 0) {
+            if(i > 0 && fuzz.cnums[i - 1] < demoted.cnums[j - 1]) {
+                fuzz.cnums[--out] = fuzz.cnums[--i];
+            } else {
+                fuzz.cnums[--out] = demoted.cnums[--j];
+            }
+        }
+    }
+}
+
+/**
+ * Finds more substring matches, going further back from where the last scan
+ * stopped, until there are enough to fill the ranking.
+ */
+static void query_substr(const char *query, bool fold)
+{
+    size_t query_sz = strlen(query);
+    const char *start = text + (text_start - text_shift);
+    while(subs.count < SEARCH_RANKS && sub_from > first_cnum) {
+        const char *end = sub_from - first_cnum < ent_count
+            ? entry_text(sub_from - first_cnum)
+            : text + (text_end - text_shift);
+        const char *hit = scanner->substr_back(start, end, query, query_sz, fold);
+        if(hit == NULL) {
+            sub_from = first_cnum;
+            break;
+        }
+        unsigned int idx = entry_at(hit);
+        list_push(&subs, first_cnum + idx);
+        sub_from = first_cnum + idx;
+    }
+}
+
+/**
+ * Finds more in-order matches, going further back from where the last scan
+ * stopped, until there are enough to fill the ranking.
+ */
+static void query_subseq(const char *query, bool fold)
+{
+    unsigned long long query_sig = signature(query);
+    while(subs.count + fuzz.count < SEARCH_RANKS && fuzz_from > first_cnum) {
+        long idx = scanner->sig_back(sigs + ent_first, fuzz_from - first_cnum, query_sig);
+        if(idx < 0) {
+            fuzz_from = first_cnum;
+            break;
+        }
+        const char *cmd = entry_text(idx);
+        if(has_subseq(cmd, query, fold) && !has_substr(cmd, query, fold)) {
+            list_push(&fuzz, first_cnum + idx);
+        }
+        fuzz_from = first_cnum + idx;
+    }
+}
+
+/**
+ * Searches the history for a query. A command matches if it contains the
+ * query, or failing that the query's characters in order. Case is ignored
+ * unless the query contains uppercase letters.
+ *
+ * @param query string to search for
+ * @return the number of ranked matches, which search_result() gives out
+ */
+unsigned int search_query(const char *query)
+{
+    if(scanner == NULL) {
+        scanner_init();
+    }
+
+    bool fold = true;
+    for(const char *q = query; *q != '\0'; q++) {
+        if(*q >= 'A' && *q <= 'Z') {
+            fold = false;
+        }
+    }
+
+    bool extends = last_query != NULL
+        && strncmp(last_query, query, strlen(last_query)) == 0;
+    if(extends) {
+        query_narrow(query, fold);
+    } else {
+        query_reset();
+    }
+    free(last_query);
+    last_query = strdup(query);
+
+    if(query[0] == '\0') {
+        query_reset();
+        return 0;
+    }
+
+    query_substr(query, fold);
+    if(sub_from == first_cnum) {
+        /* Every substring match is known, in-order ones rank after them */
+        query_subseq(query, fold);
+    }
+    LOG("Query '%s' has %u substring and %u in-order matches (%s)\n", query,
+            subs.count, fuzz.count, extends ? "narrowed" : "scanned");
+    return search_count();
+}
+
+/**
+ * Gives the number of ranked matches of the last query.
+ */
+unsigned int search_count(void)
+{
+    unsigned int count = subs.count;
+    if(sub_from == first_cnum) {
+        count += fuzz.count;
+    }
+    return count < SEARCH_RANKS ? count : SEARCH_RANKS;
+}
+
+/**
+ * Gives one of the ranked matches of the last query.
+ *
+ * @param rank position in the ranking, 0 for the best match
+ * @param command_number if not NULL, receives the match's command number
+ * @return the matching command, or NULL if there are not that many matches
+ */
+const char *search_result(unsigned int rank, unsigned int *command_number)
+{
+    if(rank >= search_count()) {
+        return NULL;
+    }
+    unsigned int cnum = rank < subs.count
+        ? subs.cnums[rank]
+        : fuzz.cnums[rank - subs.count];
+    if(command_number != NULL) {
+        *command_number = cnum;
+    }
+    return entry_text(cnum - first_cnum);
+}
+
+/**
+ * Ends a search, releasing the memory held for narrowing queries down.
+ */
+void search_done(void)
+{
+    query_reset();
+    list_free(&subs);
+    list_free(&fuzz);
+    list_free(&demoted);
+}
@@ -0,0 +1,23 @@
+/**
+ * @file
+ *
+ * Incremental fuzzy search over the history, used by the Ctrl-R widget. The
+ * history text is mirrored into one contiguous buffer so it can be scanned
+ * with SIMD instructions.
+ */
+
+#ifndef _SEARCH_H_
+#define _SEARCH_H_
+
+void search_add(const char *cmd, unsigned int command_number);
+void search_add_all(const char *cmds[], unsigned int count, unsigned int command_number);
+void search_pop_oldest(void);
+void search_pop_newest(void);
+void search_clear(void);
+
+unsigned int search_query(const char *query);
+unsigned int search_count(void);
+const char *search_result(unsigned int rank, unsigned int *command_number);
+void search_done(void);
+
+#endif
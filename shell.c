@@ -1,24 +1,38 @@
+#define _GNU_SOURCE
+#include <errno.h>
 #include <fcntl.h>
 #include <pwd.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "arena.h"
+#include "builtin.h"
+#include "hash.h"
 #include "history.h"
-#include "linkedhistory.h"
+#include "jobs.h"
+#include "lex.h"
 #include "logger.h"
+#include "parallel.h"
+#include "spawn.h"
 #include "util.h"
 #include "ui.h"
 
-/* Serves as the background jobs list */
-static struct LinkedHistory *bg_jobs = NULL;
-#define BG_LIMIT 10
-#define CMD_DELIM " \t\r\n"
+/* Commands kept in the history, unless FISH_HISTSIZE gives another limit */
+#define HIST_LIMIT 10000
+#define HIST_LIMIT_ENV "FISH_HISTSIZE"
+/* History file kept in the home directory of interactive sessions */
+#define HIST_FILE ".fish_history"
+/* Names the ring file of a history shared with other sessions, if set */
+#define HIST_SHARE_ENV "FISH_SHARED_HISTORY"
 
 /* Holds the previous cd directory */
 static char *prev_pwd = NULL;
@@ -26,79 +40,68 @@ static char *prev_pwd = NULL;
 /* Used for the forking status var */
 static int status = 0;
 
-/**
- * Initializes the background list with a list max based on the passed limit.
- *
- * @param limit the specified limit of max elements contained in list 
- */
-void bg_init(unsigned int limit)
-{
-    LOG("Initializing background jobs list%s\n", "");
-    bg_jobs = (struct LinkedHistory *) malloc(sizeof(struct LinkedHistory));
-    bg_jobs->list_max = limit;
-    bg_jobs->list_sz = 0;
-    bg_jobs->total_id_count = 0;
-    bg_jobs->head = NULL;
-    bg_jobs->tail = NULL;
-    bg_jobs->track = NULL;
-}
-
-/**
- * Frees each element of the background list before freeing the pointer itself.
- */
-void bg_destroy(void)
-{
-    while(bg_jobs->head != NULL) {
-        del_head(bg_jobs);
-    }
-    free(bg_jobs);
-}
-
+/* Standard input of the builtin being run, and the kinds of its tokens if it
+ * was lexed from the command line (NULL otherwise) */
+static int builtin_input = STDIN_FILENO;
+static const unsigned char *builtin_kinds = NULL;
+
+/* Holds everything a command needs only while it runs. It is reset after
+ * each command, so in the long run commands don't allocate at all. */
+static struct arena cmd_arena;
+
+/* The command being run, and the one a bang command expands to. Their
+ * buffers come from cmd_arena. */
+static struct cmdline cmd_line;
+static struct cmdline bang_line;
+
+/* Lines of a script run at once with -j, or 0 to run them one by one */
+static unsigned int script_slots = 0;
+/* Jobs of such a script whose output was not written out yet, in the order
+ * of their lines, from script_first on */
+static struct job **script_jobs = NULL;
+static size_t script_first = 0;
+static size_t script_count = 0;
+static size_t script_cap = 0;
 
 /* All builtin functions use the same arguments. Refer to builtin_handler() for arg explanations. */
 
 /**
  * Exits the program.
  */
-int exit_handler(char *args[], int *argc, char **buf[], char **buf_cmd, char *old_cmd) {
+int exit_handler(char *args[], int argc, struct cmdline *bang, char *old_cmd) {
+    jobs_drain();
     exit(EXIT_SUCCESS);
 }
 
 /**
  * Initializes the background list with a list max based on the passed limit.
  */
-int cd_handler(char *args[], int *argc, char **buf[], char **buf_cmd, char *old_cmd) {
+int cd_handler(char *args[], int argc, struct cmdline *bang, char *old_cmd) {
     int output = 0;
     char *temp = getcwd(NULL, 0);
 
-    if(*buf != NULL) {
-        if(*buf[1] == NULL) {
-            output = chdir(getenv("HOME"));
-        } else if(strcmp(*buf[1], "-") == 0 && prev_pwd != NULL){
-	    LOG("Made it into - conditional%s\n", "");
-	    output = chdir(prev_pwd);
-	} else {
-            output = chdir(*buf[1]);
-        }
+    if(bang->argv != NULL) {
+        args = bang->argv;
+    }
+    if(args[1] == NULL) {
+        output = chdir(getenv("HOME"));
+    } else if(strcmp(args[1], "-") == 0 && prev_pwd != NULL) {
+	LOG("Made it into - conditional%s\n", "");
+	output = chdir(prev_pwd);
     } else {
-        if(args[1] == NULL) {
-            output = chdir(getenv("HOME"));
-        } else if(strcmp(args[1], "-") == 0 && prev_pwd != NULL) {
-	    LOG("Made it into - conditional%s\n", "");
-	    output = chdir(prev_pwd);
-        } else {
-            output = chdir(args[1]);
-        }
+        output = chdir(args[1]);
     }
 
     if(output == -1) {
         perror("chdir");
+        free(temp);
     } else {
 	LOG("Checking if prev_pwd is empty...%s\n", "");
 	if(prev_pwd != NULL) { free(prev_pwd); }
 	LOG("Setting prev_pwd%s\n", "");
 	prev_pwd = temp;
 	LOG("prev_pwd is now %s\n", prev_pwd);
+	prompt_cwd_changed();
     }
 
     return output;
@@ -107,7 +110,7 @@ int cd_handler(char *args[], int *argc, char **buf[], char **buf_cmd, char *old_
 /**
  * Prints the history list.
  */
-int hist_handler(char *args[], int *argc, char **buf[], char **buf_cmd, char *old_cmd) {
+int hist_handler(char *args[], int argc, struct cmdline *bang, char *old_cmd) {
     hist_print();
     return 0;
 }
@@ -115,7 +118,7 @@ int hist_handler(char *args[], int *argc, char **buf[], char **buf_cmd, char *ol
 /**
  * Attempts to retrieve the specified command from the bang command.
  */
-int bang_handler(char *args[], int *argc, char **buf[], char **buf_cmd, char *old_cmd) {
+int bang_handler(char *args[], int argc, struct cmdline *bang, char *old_cmd) {
     /* If the first arg contains a bang, if 1) that is the only
      * arg, exit with 0, executing nothing. Else 2) if there are
      * other args, exit with -1 for command to be executed normally
@@ -124,7 +127,7 @@ int bang_handler(char *args[], int *argc, char **buf[], char **buf_cmd, char *ol
     const char *bang_cmd = NULL;
     LOG("Bang handler executed!%s\n", "");
 
-    if(*argc == 1 && strcmp(args[0], "!") == 0) {
+    if(argc == 1 && strcmp(args[0], "!") == 0) {
         LOG("Bang handler special finish!%s\n", "");
         return 0;
     }
@@ -142,7 +145,7 @@ int bang_handler(char *args[], int *argc, char **buf[], char **buf_cmd, char *ol
         bang_cmd = hist_search_prefix(args[0] + 1, 0);
         
         /* If no prefix found, check if the oldest command satisfies the requirement */
-        if(bang_cmd == NULL && strncmp(args[0] + 1, old_cmd, strlen(args[0] + 1)) == 0) {
+        if(bang_cmd == NULL && old_cmd != NULL && strncmp(args[0] + 1, old_cmd, strlen(args[0] + 1)) == 0) {
             bang_cmd = old_cmd;
         }
     } 
@@ -150,61 +153,232 @@ int bang_handler(char *args[], int *argc, char **buf[], char **buf_cmd, char *ol
    
     LOG("Bang_cmd currently %s\n", bang_cmd);
     hist_remove(hist_last_cnum());
-    if(bang_cmd != NULL) {
-        /*if(*buf != NULL || *buf_cmd != NULL) {
-            free(*buf);
-            free(*buf_cmd);
-        }*/
-    
+    if(bang_cmd != NULL && lex_line(bang, bang_cmd, &cmd_arena) != -1) {
         LOG("Bang cmd added to history! Bang command receive: %s\n", bang_cmd);
-        *buf_cmd = strdup(bang_cmd);
-        hist_add(*buf_cmd);
-        *argc = tok_str(*buf_cmd, buf, CMD_DELIM, true);
+        /* Adding to the history may move the strings it holds */
+        hist_add(arena_strdup(&cmd_arena, bang_cmd));
     }
     LOG("Bang handler default finish!%s\n", "");
     return -1;
 }
 
 /**
- * Prints the list of currently active background jobs.
+ * Prints the list of running and queued background jobs. With -j, prints the
+ * limit of jobs running at once, or sets it if a number follows.
  */
-int jobs_handler(char *args[], int *argc, char **buf[], char **buf_cmd, char *old_cmd)
-{ 
-    node_ptr temp_node = bg_jobs->head;
-    while(temp_node != NULL){
-        printf("%d %s\n", temp_node->id, temp_node->val);
+int jobs_handler(char *args[], int argc, struct cmdline *bang, char *old_cmd)
+{
+    if(argc > 1 && strcmp(args[1], "-j") == 0) {
+        if(argc == 2) {
+            printf("%u\n", jobs_limit());
+            return 0;
+        }
+        int limit = atoi(args[2]);
+        if(limit < 1) {
+            fprintf(stderr, "jobs: invalid limit: %s\n", args[2]);
+            return 0;
+        }
+        jobs_set_limit(limit);
+        return 0;
+    }
+
+    jobs_reap();
+    jobs_print();
+    return 0;
+}
+
+/**
+ * Finds the job a job control builtin names, complaining if there is none.
+ *
+ * @param name name of the builtin
+ * @param spec job spec, or NULL for the most recent job
+ * @return the job, or NULL
+ */
+static struct job *builtin_job(const char *name, const char *spec)
+{
+    jobs_reap();
+    struct job *job = jobs_get(spec);
+    if(job == NULL) {
+        fprintf(stderr, "%s: %s: no such job\n", name, spec != NULL ? spec : "current");
+        status = EXIT_FAILURE;
+    }
+    return job;
+}
+
+/**
+ * Runs a job in the foreground, continuing it if it was stopped.
+ */
+int fg_handler(char *args[], int argc, struct cmdline *bang, char *old_cmd)
+{
+    struct job *job = builtin_job("fg", args[1]);
+    if(job != NULL && job->state != JOB_DONE) {
+        printf("%s\n", job->command);
         fflush(stdout);
-        temp_node = temp_node->next;
+        status = jobs_foreground(job);
+    }
+    return 0;
+}
+
+/**
+ * Continues stopped jobs in the background.
+ */
+int bg_handler(char *args[], int argc, struct cmdline *bang, char *old_cmd)
+{
+    /* With no job named, args[1] is NULL, which is the most recent job */
+    int count = argc > 1 ? argc - 1 : 1;
+    for(int i = 1; i <= count; i++) {
+        struct job *job = builtin_job("bg", args[i]);
+        if(job != NULL) {
+            jobs_background(job);
+            printf("[%d] %s\n", job->id, job->command);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Waits for the named jobs, given as %n or as the pid of one of their
+ * processes, or for every background job if none is named. The status is the
+ * one of the last job waited for.
+ */
+int wait_handler(char *args[], int argc, struct cmdline *bang, char *old_cmd)
+{
+    if(args[1] == NULL) {
+        jobs_reap();
+        status = jobs_wait_all();
+        return 0;
     }
-    return 0; 
+
+    for(int i = 1; args[i] != NULL; i++) {
+        struct job *job;
+        if(args[i][0] == '%') {
+            job = builtin_job("wait", args[i]);
+        } else if((job = jobs_find(atoi(args[i]))) == NULL) {
+            fprintf(stderr, "wait: pid %s is not a child of this shell\n", args[i]);
+            status = EXIT_FAILURE;
+        }
+        if(job != NULL) {
+            status = jobs_wait(job);
+        }
+    }
+    return 0;
 }
 
-/* Struct for builtin functions, including name and to be specified function */
-struct builtin {
-    char name[25];
-    int (*function)(char *args[], int *argc, char **buf[], char **buf_cmd, char *old_cmd);
+/* Signals kill knows by name */
+static const struct {
+    const char *name;
+    int signo;
+} kill_signals[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+    {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"TERM", SIGTERM}, {"CONT", SIGCONT},
+    {"STOP", SIGSTOP}, {"TSTP", SIGTSTP},
 };
 
-/* List for all supported builtin functions */
-struct builtin builtin_list[] = {
+/**
+ * Sends a signal, SIGTERM unless given as -NAME, -SIGNAME or -N, to jobs
+ * given as %n and to processes given by pid.
+ */
+int kill_handler(char *args[], int argc, struct cmdline *bang, char *old_cmd)
+{
+    int signo = SIGTERM;
+    int i = 1;
+    if(args[i] != NULL && args[i][0] == '-') {
+        const char *name = args[i] + 1;
+        if(strncmp(name, "SIG", 3) == 0) {
+            name += 3;
+        }
+        signo = atoi(name);
+        for(size_t j = 0; j < sizeof(kill_signals) / sizeof(kill_signals[0]); j++) {
+            if(strcmp(name, kill_signals[j].name) == 0) {
+                signo = kill_signals[j].signo;
+            }
+        }
+        if(signo <= 0 || signo >= NSIG) {
+            fprintf(stderr, "kill: %s: invalid signal\n", args[i] + 1);
+            status = EXIT_FAILURE;
+            return 0;
+        }
+        i += 1;
+    }
+
+    for(; args[i] != NULL; i++) {
+        int result;
+        if(args[i][0] == '%') {
+            struct job *job = builtin_job("kill", args[i]);
+            if(job == NULL) {
+                continue;
+            }
+            result = jobs_kill(job, signo);
+        } else {
+            result = kill(atoi(args[i]), signo);
+        }
+        if(result == -1) {
+            fprintf(stderr, "kill: %s: %s\n", args[i], strerror(errno));
+            status = EXIT_FAILURE;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Runs a command template once per argument read from standard input or a
+ * file, see parallel_run().
+ */
+int parallel_handler(char *args[], int argc, struct cmdline *bang, char *old_cmd)
+{
+    status = parallel_run(args, builtin_kinds, argc, builtin_input);
+    return 0;
+}
+
+/**
+ * Lists the remembered command locations, forgets them all with -r, or looks
+ * up and remembers the named commands.
+ */
+int hash_handler(char *args[], int argc, struct cmdline *bang, char *old_cmd)
+{
+    if(args[1] == NULL) {
+        hash_print();
+        return 0;
+    }
+
+    for(int i = 1; args[i] != NULL; i++) {
+        if(strcmp(args[i], "-r") == 0) {
+            hash_reset();
+        } else if(hash_lookup(args[i]) == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", args[i]);
+        }
+    }
+    return 0;
+}
+
+/* List for all supported builtin functions, registered in main() */
+static const struct builtin builtin_list[] = {
     {"!", bang_handler},
+    {"bg", bg_handler},
     {"cd", cd_handler},
     {"exit", exit_handler},
+    {"fg", fg_handler},
+    {"hash", hash_handler},
     {"history", hist_handler},
     {"jobs", jobs_handler},
+    {"kill", kill_handler},
+    {"parallel", parallel_handler},
+    {"wait", wait_handler},
 };
 
 /**
- * Handler function to check for builtin functions. 
+ * Handler function to check for builtin functions. Builtins are matched by
+ * their whole name, except that every word starting with '!' is a bang
+ * command. Once a bang command expanded, the builtin the expansion names is
+ * run as well.
  * 
  * @param args array of tokens from originally entered command
  * @param argc total num of argument tokens
- * @param buf pointer to array for arg tokens of a new command
- * @param buf_cmd pointer to new command string
+ * @param bang receives the command a bang command expands to
  * @param old_cmd string of the "oldest" command (to handle bang of oldest command num);
  * @return 0 when builtin function finishes or -1 if specified otherwise
  */
-int builtin_handler(char *args[], int *argc, char **buf[], char **buf_cmd, char *old_cmd)
+int builtin_handler(char *args[], int argc, struct cmdline *bang, char *old_cmd)
 {
     if(args[0] == NULL) {
         return -1;
@@ -212,15 +386,15 @@ int builtin_handler(char *args[], int *argc, char **buf[], char **buf_cmd, char
 
     int return_stat = -1;
 
-    for(int i = 0; i < (sizeof(builtin_list)/sizeof(struct builtin)); i++) {
-        if(*buf != NULL) {
-            if(strncmp(builtin_list[i].name, *buf[0], strlen(builtin_list[i].name)) == 0) {
-                return_stat = builtin_list[i].function(args, argc, buf, buf_cmd, old_cmd);
-            }
-        } else {
-            if(strncmp(builtin_list[i].name, args[0], strlen(builtin_list[i].name)) == 0) {
-                return_stat = builtin_list[i].function(args, argc, buf, buf_cmd, old_cmd);
-            }
+    bool is_bang = args[0][0] == '!';
+    const struct builtin *builtin = builtin_find(is_bang ? "!" : args[0]);
+    if(builtin != NULL) {
+        return_stat = builtin->function(args, argc, bang, old_cmd);
+    }
+    if(is_bang && bang->argv != NULL && bang->argv[0] != NULL) {
+        builtin = builtin_find(bang->argv[0]);
+        if(builtin != NULL) {
+            return_stat = builtin->function(args, argc, bang, old_cmd);
         }
     }
 
@@ -228,200 +402,245 @@ int builtin_handler(char *args[], int *argc, char **buf[], char **buf_cmd, char
 }
 
 /**
- * Signal handler for interrupt and child process finish.
+ * Signal handler for interrupt. Finished children are left to the reaper in
+ * jobs.c.
  */
 void sig_handler(int signo) {
     switch(signo) {
         case SIGINT:
             fflush(stdout);
-            break;
-        case SIGCHLD:
-            int id = -1;
-            if((id = waitpid(-1, &status, WNOHANG)) > 0) {
-                remove_node(bg_jobs, id, true);
-            }
-            LOG("The value from wait was %d\n", id);
+            parallel_interrupt();
             break;
     }
 }
 
 /**
- * Searches for the next instance of NULL character in String array.
+ * Checks if a pipe is within the lexed command.
  *
- * @param sel_args array of String tokens from command
- * @param argc amount of arguments in sel_args
- * @return index of next occurance of NULL character or -1 if not found
+ * @param cmd lexed command
  */
-int next_null(const char *sel_args[], int argc) {
-    int i = 0;
-    while(i < argc) {
-        if(sel_args[i] == NULL) { return i; }
-        i += 1;
+bool pipe_check(const struct cmdline *cmd) {
+    if(cmd->argc != 1 && cmd->pipes > 0) {
+        LOG("Pipes found: %d\n", cmd->pipes);
+        return true;
     }
-    return -1;
+    return false;
 }
 
 /**
- * Checks the tokenized command if one of the elements promotes a redireciton
- * and then redirects standard input and output to specified files.
+ * Launches the pipeline of a job for the scheduler in jobs.c. Every section
+ * is launched into the job's process group with its own file redirections,
+ * reading from the previous section and writing into the next one, so all
+ * sections run at the same time.
  *
- * @param sel_args array of String tokens from command
- * @param argc amount of arguments in sel_args
- * @param redir_fd array of 3 file descriptors: two for current input and
- *  output with another serving as a temp descriptor
- * @return 0 if no errors are thrown
+ * @param job job the processes are added to
+ * @param argv NULL terminated pipeline, redirections included; its tokens
+ *  are cut into sections in place
+ * @param kinds kind of each token in argv
+ * @param argc amount of tokens in argv
  */
-int file_redir(char *sel_args[], int argc, int redir_fd[]) {
-    int ind = 1;
-    int nxt_null = next_null((const char **) sel_args, argc + 1);
-    LOG("Val of next null is %d\n", nxt_null);
-    while(ind < nxt_null - 1) {
-        /* IO Redirection check */
-   	    if(strcmp("<", sel_args[ind]) == 0) {
-            LOG("Input redir found at %d\n", ind);
-            sel_args[ind] = NULL;
-            redir_fd[2] = open(sel_args[ind + 1], O_RDONLY);
-	        redir_fd[0] = dup2(redir_fd[2], STDIN_FILENO);
-            close(redir_fd[2]);
-            LOG("New input file is: %s\n", sel_args[ind + 1]);
-            LOG("New input fd is: %d\n", redir_fd[0]);
-        } else if(strcmp(">>", sel_args[ind]) == 0) {
-            redir_fd[1] = 2;
-            redir_fd[2] = 1;
-        } else if(strcmp(">", sel_args[ind]) == 0) { 
-            redir_fd[1] = 1;
-            redir_fd[2] = 1;
-        }
-
-        if(redir_fd[1] && redir_fd[2]) {
-            sel_args[ind] = NULL;
-            if(redir_fd[1] == 2) {
-                redir_fd[2] = open(sel_args[ind + 1], O_CREAT | O_WRONLY | O_APPEND, 0666);
-            } else {
-                redir_fd[2] = open(sel_args[ind + 1], O_CREAT | O_WRONLY, 0666);
-            }    
-            redir_fd[1] = dup2(redir_fd[2], STDOUT_FILENO);
-            close(redir_fd[2]);
-            redir_fd[2] = 0;
-            LOG("New output file is: %s\n", sel_args[ind + 1]);
-            LOG("New redir_fd[1] is %d\n", redir_fd[1]);
-        }
-
-        ind += 1;
-    
+static void launch_job(struct job *job, char *argv[], const unsigned char *kinds, int argc)
+{
+    int start = 0;  /* Tracks starting index for pipe command */
+    int i = 0;      /* Tracks last index of pipe command */
+    struct redirect redir;
+    /* Pipe vars */
+    int fds[2];
+    int input_fd = -1;
+
+    while(start < argc) {
+        while(i < argc) {
+            if(kinds[i] == TOK_PIPE) { break; }
+            i += 1;
+        }
+        argv[i] = NULL;
+        spawn_redirects(argv + start, kinds + start, i - start, &redir);
+        i += 1;
+
+        /* The first section inherits stdin unless it reads a file, so give
+         * back any script lines read ahead (queued jobs may launch while a
+         * script is being read) */
+        if(start == 0 && redir.in_path == NULL) {
+            buf_lineread_sync(STDIN_FILENO);
+        }
+
+        fds[0] = -1;
+        fds[1] = -1;
+        /* Every section but the last one writes into a new pipe */
+        if(i < argc && pipe2(fds, O_CLOEXEC) == -1) { perror("pipe"); }
+
+        /* A captured job's last section writes into its memory file, and
+         * every section's errors go into the other one */
+        int output_fd = fds[1] != -1 ? fds[1] : job->out_fd;
+        jobs_add_proc(job, spawn_cmd(argv + start, &redir, input_fd, output_fd,
+                    job->err_fd, jobs_group(job)));
+
+        /* Only the children may hold on to the pipe ends, otherwise readers
+         * would never see the end of their input */
+        if(input_fd != -1) { close(input_fd); }
+        if(fds[1] != -1) { close(fds[1]); }
+        input_fd = fds[0];
+        start = i;
     }
-    return 0;
+    if(input_fd != -1) { close(input_fd); }
 }
 
 /**
- * Checks if a pipe is within the tokenized command.
+ * Writes out the output of the jobs of a parallel script in the order of
+ * their lines: that of the jobs that finished, up to the first one still
+ * running, or that of every job once they all finished.
  *
- * @param sel_args array of String tokens from command
- * @param argc amount of arguments in sel_args
+ * @param all whether to wait for every job
  */
-bool pipe_check(char *sel_args[], int argc) { 
-    for(int ind = 0; ind < argc; ind++) {
-        if(argc != 1 && strncmp("|", sel_args[ind], 1) == 0) {
-            /* Pipe check */
-            LOG("Pipe found at arg %d\n", ind);
-            return true;
+static void script_collect(bool all)
+{
+    jobs_reap();
+    while(script_first < script_count) {
+        struct job *job = script_jobs[script_first];
+        if(!all && job->state != JOB_DONE) {
+            break;
         }
+        jobs_collect(job);
+        script_first += 1;
+    }
+    if(script_first == script_count) {
+        script_first = 0;
+        script_count = 0;
     }
-    return false;
 }
 
 /**
- * Execute the inputted pipe command. The shell then checks if the command
- * is a builtin function and if it is not, then the code proceeds to execute
- * individual sections of the piped command. It first checks for file
- * redirection within the command. After that has been handled, the command
- * is finally executed.
- *
- * @param sel_args array of String tokens from command
- * @param argc amount of arguments in sel_args
- * @param redir_fd array of 2 file descriptors for current input and output
- * @param redir_ind array of 2 indecies for locations of '<' and/or '>' chars
- * @return 0 if no errors were thrown, else a corresponding error value
+ * Adds a job of a parallel script to those whose output is still to be
+ * written out. If there is no memory to keep it waiting, the output of every
+ * job up to it is written out at once.
  */
-int exec_pipe(char *sel_args[], int argc,  int redir_fd[]) {
-    int start = 0;  /* Tracks starting index for pipe command */
-    int i = 0;      /* Tracks last index of pipe command */
-    pid_t child;
-    /* Pipe vars */
-    int fds[2];
-    int input_fd = STDIN_FILENO;
-    int stdin_fd = dup(STDIN_FILENO);   /* Holds STDIN_FILENO for input restoration */
-    int stdout_fd = dup(STDOUT_FILENO);  /* Holds STDOUT_FILENO for output restoration */
- 
-    while(start < argc) {
-        while(i < argc) {
-            if(strcmp(sel_args[i], "|") == 0) { break; }
-            i += 1;
+static void script_add(struct job *job)
+{
+    if(script_count == script_cap) {
+        if(script_first > 0) {
+            memmove(script_jobs, script_jobs + script_first,
+                    (script_count - script_first) * sizeof(struct job *));
+            script_count -= script_first;
+            script_first = 0;
+        } else {
+            size_t new_cap = script_cap > 0 ? script_cap * 2 : 64;
+            struct job **tmp_jobs = realloc(script_jobs, new_cap * sizeof(struct job *));
+            if(tmp_jobs == NULL) {
+                script_collect(true);
+                jobs_collect(job);
+                return;
+            }
+            script_jobs = tmp_jobs;
+            script_cap = new_cap;
         }
-        sel_args[i] = NULL;
-        i += 1;
+    }
+    script_jobs[script_count++] = job;
+}
 
-        if(pipe(fds) == -1) { perror("pipe"); }
-        
-        child = fork();
-        if(child == -1) {
-            perror("fork");
-        } else if (child == 0) {
-            file_redir(sel_args, argc, redir_fd);
-            if(redir_fd[0] == 0 && start != 0) {
-                dup2(input_fd, STDIN_FILENO);
-                close(input_fd);
-            }
-            close(fds[0]);
+/**
+ * Runs a builtin that is the last section of a command line, in the shell
+ * itself. The sections before it are launched as a job writing into a pipe,
+ * which the builtin reads as its standard input, and are waited for once it
+ * returned. Its own redirections are opened by the shell.
+ *
+ * @param cmd lexed command line
+ * @param start index of the builtin's section in cmd
+ * @param command command line, for the job of the sections before it
+ * @param bang see builtin_handler()
+ * @param old_cmd see builtin_handler()
+ */
+static void builtin_run(struct cmdline *cmd, int start, const char *command,
+        struct cmdline *bang, char *old_cmd)
+{
+    char **args = cmd->argv + start;
+    int argc = cmd->argc - start - cmd->background;
+    struct redirect redir;
+    spawn_redirects(args, cmd->kinds + start, argc, &redir);
+    args[argc] = NULL;
+    for(argc = 0; args[argc] != NULL; argc++) {
+    }
 
-            if(redir_fd[1] == 0) {
-                if(i != argc + 1) {
-                    dup2(fds[1], STDOUT_FILENO);
-                }
-            }
-            close(fds[1]);
-            
-            if(execvp(sel_args[start], sel_args + start) == -1){
-                perror("exec");
-                exit(EXIT_FAILURE);
-            }
+    int in_fd = -1;
+    int saved_out = -1;
+    struct job *job = NULL;
+    if(start > 0) {
+        int fds[2];
+        if(pipe2(fds, O_CLOEXEC) == -1) {
+            perror("pipe");
+            status = EXIT_FAILURE;
+            return;
         }
-        if(input_fd != STDIN_FILENO) { close(input_fd); } 
-        input_fd = dup(fds[0]);
-        close(fds[0]);
+        /* The job inherits the shell's standard output, which is the pipe
+         * while it is launched */
+        fflush(stdout);
+        saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+        dup2(fds[1], STDOUT_FILENO);
+        job = jobs_submit(cmd->argv, cmd->kinds, start - 1, command, JOB_FOREGROUND);
+        dup2(saved_out, STDOUT_FILENO);
+        close(saved_out);
+        saved_out = -1;
         close(fds[1]);
-        fds[0] = 0;
-        fds[1] = 0;
-        wait(&status);
-        start = i;
-        if(redir_fd[0]) {
-            close(redir_fd[0]);
-            dup2(stdin_fd, STDIN_FILENO);
-            close(stdin_fd);
-            redir_fd[0] = 0;
-        }
-        if(redir_fd[1]) {
-            close(redir_fd[1]);
-            dup2(stdout_fd, STDOUT_FILENO);
-            close(stdout_fd);
-            redir_fd[1] = 0;
-        }
-    }
-    close(stdin_fd);
-    close(stdout_fd);
-    close(input_fd);
-    return status;
+        in_fd = fds[0];
+    }
+
+    if(redir.in_path != NULL) {
+        if(in_fd != -1) {
+            close(in_fd);
+        }
+        if((in_fd = spawn_open(&redir, false)) == -1) {
+            perror(redir.in_path);
+            status = EXIT_FAILURE;
+        }
+    }
+    if(redir.out_path != NULL && status == 0) {
+        int out_fd = spawn_open(&redir, true);
+        if(out_fd == -1) {
+            perror(redir.out_path);
+            status = EXIT_FAILURE;
+        } else {
+            fflush(stdout);
+            saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+            dup2(out_fd, STDOUT_FILENO);
+            close(out_fd);
+        }
+    }
+
+    if(status == 0) {
+        builtin_input = in_fd != -1 ? in_fd : STDIN_FILENO;
+        builtin_kinds = cmd->kinds + start;
+        builtin_handler(args, argc, bang, old_cmd);
+        builtin_input = STDIN_FILENO;
+        builtin_kinds = NULL;
+    }
+
+    if(saved_out != -1) {
+        fflush(stdout);
+        dup2(saved_out, STDOUT_FILENO);
+        close(saved_out);
+    }
+    /* Closing the pipe stops writers the builtin did not read to the end */
+    if(in_fd != -1) {
+        buf_lineread_close(in_fd);
+        close(in_fd);
+    }
+    if(job != NULL) {
+        jobs_foreground(job);
+    }
 }
 
 /**
- * Attempts to execute the inputted command. The shell tokenizes the command,
+ * Attempts to execute the inputted command. The shell lexes the command,
  * then checks if piping is to be executed. If it is, a special pipe handler
  * function is executed. After checking, the shell then checks if the command
  * is a builtin function and if it is not, then the code proceeds to check for
  * file redirection within the command. After that has been handled, the
  * command is finally executed,
  *
- * @param command command string to be executed
+ * Everything the command needs while it runs comes from cmd_arena, which is
+ * reset on the way out.
+ *
+ * @param command command string to be executed; it is left untouched and
+ *  remains owned by the caller
  * @return 0 if no errors were thrown, else a corresponding error value
  */
 int execute_cmd(char *command)
@@ -434,113 +653,114 @@ int execute_cmd(char *command)
     }
 
     /* Input command vars */
-    char **cmd_args = NULL;
-    char **buf_args = NULL;
-    char **sel_args = NULL;
+    struct cmdline *sel = NULL;
     char *old_cmd = NULL;
-    char *buf_cmd = NULL;
-    char *full_cmd = strdup(command);
     int argc = 0;
-    /* IO Redirection vars */
-    int redir_fd[3] = {0};
     /* Pipe check */
     bool pipe_found = false;
+    unsigned long chunk_allocs = cmd_arena.chunk_allocs;
+
+    if(command[strspn(command, " \t")] == '!') {
+        /* Bang lookups see what other sessions ran in the meantime */
+        hist_sync();
+        /* Adding this command may push the oldest one out of the history,
+         * while a bang may still refer to it */
+        if(hist_oldest_cnum() != -1) {
+            old_cmd = arena_strdup(&cmd_arena, hist_search_cnum(hist_oldest_cnum()));
+        }
+    }
 
-    if(hist_oldest_cnum() != -1) {
-        old_cmd = strdup(hist_search_cnum(hist_oldest_cnum()));
+    hist_add(command);
+    lex_clear(&bang_line);
+    if(lex_line(&cmd_line, command, &cmd_arena) == -1) {
+        fprintf(stderr, "fish: unterminated quote\n");
+        status = EXIT_FAILURE;
+        goto done;
     }
-    
-    hist_add(full_cmd);
-    argc = tok_str(command, &cmd_args, CMD_DELIM, true);
 
-    pipe_found = pipe_check(cmd_args, argc);
+    pipe_found = pipe_check(&cmd_line);
+
+    /* A builtin also runs as the last section of a pipeline */
+    int last = 0;
+    for(int i = 0; i < cmd_line.argc; i++) {
+        if(cmd_line.kinds[i] == TOK_PIPE) {
+            last = i + 1;
+        }
+    }
+    bool builtin = cmd_line.argv[last] != NULL && cmd_line.argv[last][0] != '!'
+        && builtin_find(cmd_line.argv[last]) != NULL;
+
+    /* Builtins may change what the lines after them do, so in a parallel
+     * script they wait for the lines before them, as wait does */
+    if(script_slots > 0 && (builtin || (!pipe_found && cmd_line.argv[0] != NULL
+            && cmd_line.argv[0][0] == '!'))) {
+        script_collect(true);
+    }
 
-    if(!pipe_found) {
-        if(builtin_handler(cmd_args, &argc, &buf_args, &buf_cmd, old_cmd) == 0) {
+    if(builtin) {
+        builtin_run(&cmd_line, last, command, &bang_line, old_cmd);
+        LOG("Builtin handled!%s\n", "");
+        goto done;
+    } else if(!pipe_found) {
+        if(builtin_handler(cmd_line.argv, cmd_line.argc, &bang_line, old_cmd) == 0) {
             LOG("Builtin handled!%s\n", "");
-            good_status();
-            free(cmd_args);
-            free(command);
-            free(buf_args);
-            free(buf_cmd);
-            free(old_cmd);
-            free(full_cmd);
-            return EXIT_SUCCESS;
+            goto done;
         }
     }
-    
-    free(old_cmd);
 
     /* Checks for bang handle execution */
-    if(buf_args != NULL) {
-        sel_args = buf_args;
+    if(bang_line.argv != NULL) {
+        sel = &bang_line;
     } else {
-        sel_args = cmd_args;
+        sel = &cmd_line;
     }
+    argc = sel->argc;
 
-
-
-    signal(SIGCHLD, sig_handler);
     LOG("Value of argc is %d\n", argc);
     
  
     LOG("DONE CHECKING ARGS %s\n", "");
     
 
-    if(pipe_found || pipe_check(sel_args, argc)) {
-        exec_pipe(sel_args, argc, redir_fd);    
-    } else {
-        pid_t child = fork();
-        if (child == -1) {
-            perror("fork");
-        } else if (child == 0) {
-            /* I am the child */
-            LOG("CHILD PID IS: %d\n", getpid());
-
-            LOG("First arg (file location) is: %s\n", sel_args[0]);
-            if(strcmp("&", sel_args[argc - 1]) == 0) {
-                sel_args[argc - 1] = NULL;
-            }
-            
-            /* Checks for io redirection in command and applies if found */
-            file_redir(sel_args, argc, redir_fd);
-
-            if(execvp(sel_args[0], sel_args) == -1) {
-                perror("exec");
-                free(cmd_args);
-                free(command);
-                free(buf_args);
-                free(buf_cmd);
-                free(full_cmd);
-                if(redir_fd[0]) { close(redir_fd[0]); }
-                if(redir_fd[1]) { close(redir_fd[1]); }
-                exit(EXIT_FAILURE);
-            }
-        } else {
-            /* I am the parent */
-            if(argc != 0 && strcmp("&", sel_args[argc - 1]) == 0) {
-                append_node(bg_jobs, full_cmd, child, true);
-            } else {
-                wait(&status);
-            }
+    if(argc > 0) {
+        LOG("First arg (file location) is: %s\n", sel->argv[0]);
+        /* A background job is launched by the scheduler, now or once a slot
+         * frees up; a foreground job at once, and is waited for */
+        bool background = sel->background;
+        if(background) {
+            sel->argv[--argc] = NULL;
+        }
+        /* Lines of a parallel script run like background jobs, their
+         * output kept until the lines before them wrote theirs */
+        enum job_flags flags = JOB_FOREGROUND;
+        if(background) {
+            flags = JOB_BACKGROUND;
+        } else if(script_slots > 0) {
+            flags = JOB_CAPTURE;
+        }
+        struct job *job = jobs_submit(sel->argv, sel->kinds, argc, command, flags);
+        if(job == NULL) {
+            status = EXIT_FAILURE;
+        } else if(flags & JOB_FOREGROUND) {
+            status = jobs_foreground(job);
+        } else if(flags & JOB_CAPTURE) {
+            script_add(job);
         }
     }
     
+    LOG("Child exited with status code: %d\n", status);
+
+done:
     if(status != 0) {
         bad_status();
     } else {
         good_status();
     }
-    LOG("Child exited with status code: %d\n", status);
-   
-    free(cmd_args);
-    free(command);
-    free(buf_args);
-    free(buf_cmd);
-    free(full_cmd);
-    if(redir_fd[0]) { close(redir_fd[0]); }
-    if(redir_fd[1]) { close(redir_fd[1]); }
-    LOG("Final frees executed%s\n", "");
+    LOG("Command used %zu arena bytes, %lu new arena chunks\n",
+            cmd_arena.in_use, cmd_arena.chunk_allocs - chunk_allocs);
+    lex_clear(&cmd_line);
+    lex_clear(&bang_line);
+    arena_reset(&cmd_arena);
     return EXIT_SUCCESS;
 }
 
@@ -549,59 +769,201 @@ void terminal_input(char *command) {
 
     while(true) {
         LOG("New loop executed!%s\n", "");
+        jobs_reap();
+        jobs_notify();
         command = read_command();
 
         if(!strcasecmp(command, "exit")) {
             break;
         }
 
+        /* An empty command is either readline's EOF placeholder or an empty
+         * line, neither of which needs freeing here */
+        bool empty = command[0] == '\0';
         execute_cmd(command);
+        if(!empty) {
+            free(command);
+        }
         LOG("Command execution complete! Checking for next loop...%s\n", "");
     }
     LOG("Program run complete! Proceeding to exit terminal read...%s\n", "");
 }
 
-void script_input(char *command) {
+/**
+ * Runs one line of a script. Returns false once the script should stop.
+ *
+ * @param command line to execute
+ * @return true if the next line should be run
+ */
+bool script_line(char *command) {
+    LOG("Input command: %s\n", command);
+
+    if (!strcasecmp(command, "exit")) {
+        return false;
+    }
+
+    /* Background jobs that finished are collected between lines */
+    jobs_reap();
+    if(execute_cmd(command) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    if(script_slots > 0) {
+        script_collect(false);
+    }
+    return true;
+}
+
+/**
+ * Runs a script streamed from a file descriptor, one buffered line at a time.
+ *
+ * @param fd file descriptor the script is read from
+ */
+void script_input(int fd) {
     /* This is the script version of the project */
-    
-    while(true) {
-        command = dynamic_lineread(fileno(stdin));
-        if(command == NULL) {
-            break;
-        }
-        
-        LOG("Input command: %s\n", command);
+    char *command = NULL;
 
-        if (!strcasecmp(command, "exit")) {
+    /* Lines point into the reader's buffer, so they are never freed */
+    while((command = buf_lineread(fd, NULL)) != NULL) {
+        if(!script_line(command)) {
             break;
         }
+    }
+    buf_lineread_close(fd);
+}
 
-        if(execute_cmd(command) == -1) {
-            exit(EXIT_FAILURE);
+/**
+ * Runs a script file given on the command line. Regular files are mapped
+ * privately and each line is terminated in place in the mapping and lexed
+ * straight from there. Anything that cannot be mapped (pipes,
+ * process substitution, ...) is streamed through script_input() instead.
+ *
+ * @param path location of the script
+ * @return 0 if the script could be run, -1 if it could not be opened
+ */
+int file_input(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        perror(path);
+        return -1;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        script_input(fd);
+        close(fd);
+        return 0;
+    }
+
+    size_t map_sz = st.st_size;
+    char *map = NULL;
+    if(map_sz > 0) {
+        /* Private and writable: each line's newline is overwritten with a
+         * NUL in place, so the pages are copied on write as lines are
+         * terminated, which for most scripts is every page */
+        map = mmap(NULL, map_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if(map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    } else if(map == NULL) {
+        return 0;
+    }
+    madvise(map, map_sz, MADV_SEQUENTIAL);
+
+    char *line = map;
+    char *map_end = map + map_sz;
+    while(line < map_end) {
+        char *newline = memchr(line, '\n', map_end - line);
+        bool keep_going;
+        if(newline != NULL) {
+            *newline = '\0';
+            keep_going = script_line(line);
+            line = newline + 1;
+        } else {
+            /* The last line has no newline and there may be no room left in
+             * the mapping for a NUL, so it is the one line that gets copied */
+            char *last = strndup(line, map_end - line);
+            keep_going = script_line(last);
+            free(last);
+            line = map_end;
+        }
+        if(!keep_going) {
+            break;
         }
     }
+
+    munmap(map, map_sz);
+    return 0;
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
+    int opt;
+    unsigned int slots = 0;
+    while((opt = getopt(argc, argv, "j:")) != -1) {
+        if(opt != 'j' || atoi(optarg) < 1) {
+            fprintf(stderr, "usage: %s [-j slots] [script]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        slots = atoi(optarg);
+    }
+
     init_ui();
-    bg_init(10);
-    hist_init(100);
+    jobs_init(launch_job);
+    if(slots > 0) {
+        jobs_set_limit(slots);
+    }
+    char *hist_limit = getenv(HIST_LIMIT_ENV);
+    if(hist_limit != NULL && hist_limit[0] != '\0') {
+        hist_init(strtoul(hist_limit, NULL, 10));
+    } else {
+        hist_init(HIST_LIMIT);
+    }
+    for(int i = 0; i < (sizeof(builtin_list)/sizeof(struct builtin)); i++) {
+        builtin_register(builtin_list[i].name, builtin_list[i].function);
+    }
 
     signal(SIGINT, sig_handler);
 
+    int exit_code = 0;
     char *command = "";
-    if(isatty(STDIN_FILENO)) {
+    if(optind < argc) {
+        script_slots = slots;
+        if(file_input(argv[optind]) == -1) {
+            exit_code = EXIT_FAILURE;
+        }
+    } else if(isatty(STDIN_FILENO)) {
+        /* Only interactive sessions share their history through the file */
+        char *home = getenv("HOME");
+        if(home != NULL) {
+            char hist_path[PATH_MAX];
+            snprintf(hist_path, PATH_MAX, "%s/%s", home, HIST_FILE);
+            hist_open(hist_path);
+        }
+        char *share_path = getenv(HIST_SHARE_ENV);
+        if(share_path != NULL && share_path[0] != '\0') {
+            hist_share(share_path);
+        }
+        jobs_control(STDIN_FILENO);
         terminal_input(command);
     }
     else {
-        script_input(command);
+        script_slots = slots;
+        script_input(STDIN_FILENO);
     }
 
-    bg_destroy();
+    /* The last lines of a parallel script and queued jobs still get to run */
+    script_collect(true);
+    free(script_jobs);
+    jobs_drain();
+    jobs_destroy();
+    arena_free(&cmd_arena);
     hist_destroy();
+    hash_destroy();
+    builtin_destroy();
     destroy_ui();
     if(prev_pwd != NULL) { free(prev_pwd); }
     LOG("Thank you for using the %s!\nExiting shell...\n", "Frequently Inconsistant Shell");
-    return 0;
+    return exit_code;
 }
@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "lex.h"
+#include "logger.h"
+#include "spawn.h"
+
+/**
+ * If SPAWN is not set, commands are launched with posix_spawn(). Setting it
+ * to 0 launches them with fork() and execv() instead.
+ */
+#ifndef SPAWN
+#define SPAWN 1
+#endif
+
+#define IN_FLAGS O_RDONLY
+#define OUT_FLAGS (O_CREAT | O_WRONLY)
+#define APPEND_FLAGS (O_CREAT | O_WRONLY | O_APPEND)
+
+extern char **environ;
+
+/* Signals an interactive shell ignores or catches, which commands launched
+ * into a group of their own get back at their defaults */
+static const int default_signals[] = {
+    SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD,
+};
+
+/**
+ * Finds the '<', '>' and '>>' redirections of a command and takes them out of
+ * its argument list, which is cut off at the first redirection.
+ *
+ * @param args NULL terminated tokens of a single command
+ * @param kinds kind of each token in args, as given by lex_line()
+ * @param argc amount of tokens in args
+ * @param redir receives the redirections found
+ */
+void spawn_redirects(char *args[], const unsigned char *kinds, int argc, struct redirect *redir)
+{
+    int first = -1;
+    redir->in_path = NULL;
+    redir->out_path = NULL;
+    redir->append = false;
+
+    /* The command itself is never a redirection, so start at 1 */
+    for(int ind = 1; ind < argc - 1; ind++) {
+        if(kinds[ind] == TOK_IN) {
+            redir->in_path = args[ind + 1];
+            LOG("New input file is: %s\n", redir->in_path);
+        } else if(kinds[ind] == TOK_OUT || kinds[ind] == TOK_APPEND) {
+            redir->out_path = args[ind + 1];
+            redir->append = kinds[ind] == TOK_APPEND;
+            LOG("New output file is: %s\n", redir->out_path);
+        } else {
+            continue;
+        }
+
+        if(first == -1) {
+            first = ind;
+        }
+        ind += 1;
+    }
+
+    if(first != -1) {
+        args[first] = NULL;
+    }
+}
+
+/**
+ * Opens the file of a redirection the way a launched command gets it, for
+ * builtins, which run in the shell itself.
+ *
+ * @param redir redirections of the command
+ * @param output whether to open the output file rather than the input one
+ * @return descriptor of the file, or -1 with errno set
+ */
+int spawn_open(const struct redirect *redir, bool output)
+{
+    if(!output) {
+        return open(redir->in_path, IN_FLAGS | O_CLOEXEC);
+    }
+    return open(redir->out_path, (redir->append ? APPEND_FLAGS : OUT_FLAGS) | O_CLOEXEC, 0666);
+}
+
+#if SPAWN
+
+/**
+ * Launches a command with posix_spawn(). The pipe ends and redirections are
+ * set up by spawn file actions, so the shell is never copied.
+ */
+static pid_t spawn_posix(const char *path, char *args[], const struct redirect *redir,
+        int in_fd, int out_fd, int err_fd, const struct spawn_group *group)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    pid_t child = -1;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+    if(group != NULL) {
+        sigset_t defaults;
+        sigemptyset(&defaults);
+        for(size_t i = 0; i < sizeof(default_signals) / sizeof(int); i++) {
+            sigaddset(&defaults, default_signals[i]);
+        }
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF);
+        posix_spawnattr_setpgroup(&attr, group->pgid);
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+        /* The child takes the terminal before it execs, so it can never
+         * read from it while still in the background */
+        if(group->tty_fd != -1) {
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, group->tty_fd);
+        }
+#endif
+    }
+    /* Pipe ends are close-on-exec, so only the dup'd copies survive */
+    if(in_fd != -1 && in_fd != STDIN_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    }
+    if(out_fd != -1 && out_fd != STDOUT_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    }
+    if(err_fd != -1 && err_fd != STDERR_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+    }
+    /* Files take precedence over pipes, so they are opened last */
+    if(redir->in_path != NULL) {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+                redir->in_path, IN_FLAGS, 0);
+    }
+    if(redir->out_path != NULL) {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+                redir->out_path, redir->append ? APPEND_FLAGS : OUT_FLAGS, 0666);
+    }
+
+    int err = posix_spawn(&child, path, &actions, &attr, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if(err != 0) {
+        errno = err;
+        return -1;
+    }
+    return child;
+}
+
+#else
+
+/**
+ * Launches a command with fork() and exec, applying the pipe ends and
+ * redirections in the child.
+ */
+static pid_t spawn_fork(const char *path, char *args[], const struct redirect *redir,
+        int in_fd, int out_fd, int err_fd, const struct spawn_group *group)
+{
+    pid_t child = fork();
+    if(child == -1) {
+        return -1;
+    } else if(child > 0) {
+        /* Both sides set the group, whichever runs first wins the race */
+        if(group != NULL) {
+            setpgid(child, group->pgid > 0 ? group->pgid : child);
+        }
+        return child;
+    }
+
+    /* I am the child */
+    LOG("CHILD PID IS: %d\n", getpid());
+    if(group != NULL) {
+        setpgid(0, group->pgid);
+        if(group->tty_fd != -1) {
+            tcsetpgrp(group->tty_fd, getpgrp());
+        }
+        for(size_t i = 0; i < sizeof(default_signals) / sizeof(int); i++) {
+            signal(default_signals[i], SIG_DFL);
+        }
+    }
+    if(in_fd != -1 && in_fd != STDIN_FILENO) {
+        dup2(in_fd, STDIN_FILENO);
+    }
+    if(out_fd != -1 && out_fd != STDOUT_FILENO) {
+        dup2(out_fd, STDOUT_FILENO);
+    }
+    if(err_fd != -1 && err_fd != STDERR_FILENO) {
+        dup2(err_fd, STDERR_FILENO);
+    }
+
+    int fd;
+    if(redir->in_path != NULL) {
+        if((fd = open(redir->in_path, IN_FLAGS)) == -1) {
+            perror("exec");
+            _exit(EXIT_FAILURE);
+        }
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+    }
+    if(redir->out_path != NULL) {
+        fd = open(redir->out_path, redir->append ? APPEND_FLAGS : OUT_FLAGS, 0666);
+        if(fd == -1) {
+            perror("exec");
+            _exit(EXIT_FAILURE);
+        }
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+
+    execv(path, args);
+    if(errno == ENOENT) {
+        /* The remembered location went stale, the parent cannot learn about
+         * it from here, so fall back to a full PATH search */
+        execvp(args[0], args);
+    }
+    perror("exec");
+    _exit(EXIT_FAILURE);
+}
+
+#endif
+
+/**
+ * Launches an external command without waiting for it. The command is looked
+ * up through the command table, which is corrected if the location it
+ * remembered no longer exists. Redirected files are opened before the
+ * command is launched, so a missing one is reported by its own name.
+ *
+ * @param args NULL terminated command and arguments, without redirections
+ * @param redir files to redirect input and output to
+ * @param in_fd descriptor to use as standard input, or -1 to inherit it
+ * @param out_fd descriptor to use as standard output, or -1 to inherit it
+ * @param err_fd descriptor to use as standard error, or -1 to inherit it
+ * @param group process group to launch into, or NULL to stay in the shell's
+ * @return pid of the new process, or -1 if it could not be started
+ */
+pid_t spawn_cmd(char *args[], const struct redirect *redir, int in_fd, int out_fd,
+        int err_fd, const struct spawn_group *group)
+{
+    if(args[0] == NULL) {
+        return -1;
+    }
+
+    /* Files take precedence over pipes */
+    int in_file = -1;
+    int out_file = -1;
+    if(redir->in_path != NULL && (in_file = spawn_open(redir, false)) == -1) {
+        perror(redir->in_path);
+        return -1;
+    }
+    if(redir->out_path != NULL && (out_file = spawn_open(redir, true)) == -1) {
+        perror(redir->out_path);
+        if(in_file != -1) {
+            close(in_file);
+        }
+        return -1;
+    }
+    const struct redirect opened = { NULL, NULL, false };
+    if(in_file != -1) {
+        in_fd = in_file;
+    }
+    if(out_file != -1) {
+        out_fd = out_file;
+    }
+
+    pid_t child = -1;
+    const char *path = NULL;
+    for(int attempt = 0; attempt < 2; attempt++) {
+        path = hash_lookup(args[0]);
+        if(path == NULL) {
+            errno = ENOENT;
+            break;
+        }
+#if SPAWN
+        child = spawn_posix(path, args, &opened, in_fd, out_fd, err_fd, group);
+#else
+        child = spawn_fork(path, args, &opened, in_fd, out_fd, err_fd, group);
+#endif
+        if(child != -1 || errno != ENOENT || path == args[0]) {
+            break;
+        }
+        /* The files are open already, so the command itself moved */
+        LOG("Exec of %s failed, searching PATH again\n", path);
+        hash_forget(args[0]);
+    }
+
+    if(child == -1) {
+        perror(path != NULL ? path : args[0]);
+    }
+    if(in_file != -1) {
+        close(in_file);
+    }
+    if(out_file != -1) {
+        close(out_file);
+    }
+    return child;
+}
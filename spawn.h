@@ -0,0 +1,33 @@
+/**
+ * @file
+ *
+ * Launches external commands, either through posix_spawn() or, as a fallback,
+ * through fork() and exec. Commands can be launched into a process group of
+ * their own, which may also be handed the terminal.
+ */
+
+#ifndef _SPAWN_H_
+#define _SPAWN_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* File redirections of a single command */
+struct redirect {
+    char *in_path;      /* File after '<', or NULL */
+    char *out_path;     /* File after '>' or '>>', or NULL */
+    bool append;        /* Whether out_path was given with '>>' */
+};
+
+/* Process group a command is launched into */
+struct spawn_group {
+    pid_t pgid;         /* Group to join, or 0 to lead a new one */
+    int tty_fd;         /* Terminal to make the group the foreground of, or -1 */
+};
+
+void spawn_redirects(char *args[], const unsigned char *kinds, int argc, struct redirect *redir);
+int spawn_open(const struct redirect *redir, bool output);
+pid_t spawn_cmd(char *args[], const struct redirect *redir, int in_fd, int out_fd,
+        int err_fd, const struct spawn_group *group);
+
+#endif
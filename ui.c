@@ -1,19 +1,25 @@
+#include <ctype.h>
 #include <stdio.h>
 #include <signal.h>
 #include <readline/readline.h>
 #include <locale.h>
 #include <limits.h>
+#include <pwd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
-//UNSURE IF THIS CAN BE INCLUDED, BUT REQUIRED DIRECTORY ACCESS
-#include <dirent.h>
 
+#include "dircache.h"
 #include "history.h"
+#include "jobs.h"
 #include "logger.h"
+#include "pathindex.h"
+#include "search.h"
 #include "ui.h"
 #include "util.h"
 
-#define PATH_DELIM ":"
+#define SEARCH_QUERY_MAX 256
 
 static const char *good_str = "✅";
 static const char *bad_str  = "🔥";
@@ -21,13 +27,33 @@ static int status = 0;
 static char *prefix = NULL;
 static char *home = NULL;
 static int home_size = 0;
-//static int delim_offset = 0;
-static char **path_complete = NULL;
-//static int path_size = 0;
-//static int path_ind = 0;
+/* Parts of the prompt that are kept from one prompt to the next */
+static const char *user_name = NULL;
+static char host_name[HOST_NAME_MAX + 1];
+static char *cwd_str = NULL;
+static char *prompt_tail = NULL;
+static size_t prompt_tail_len = 0;
+static char *prompt_buf = NULL;
+static size_t prompt_cap = 0;
+/* Names command_generator() or path_generator() hands out, and the next one
+ * to hand out */
+static const char *const *gen_matches = NULL;
+static size_t gen_count = 0;
+static size_t gen_next = 0;
+/* Directory part of the word path_generator() completes, as it was typed */
+static char *gen_dir = NULL;
 
 static int readline_init(void);
 
+/**
+ * Collects finished background jobs while readline waits for input.
+ */
+static int reap_hook(void)
+{
+    jobs_reap();
+    return 0;
+}
+
 void init_ui(void)
 {
     LOGP("Initializing UI...\n");
@@ -37,95 +63,168 @@ void init_ui(void)
             (locale != NULL) ? locale : "could not set locale!");
 
     rl_startup_hook = readline_init;
+
+    /* The first prompt doesn't wait for the command index */
+    if(isatty(STDIN_FILENO)) {
+        pathindex_start();
+    }
 }
 
 void destroy_ui(void)
 {
-    if(path_complete != NULL) {
-        free(path_complete);
-        path_complete = NULL;
-    }
+    pathindex_destroy();
+    dircache_destroy();
+    free(gen_dir);
+    gen_dir = NULL;
+    prompt_cwd_changed();
+    free(prompt_buf);
+    prompt_buf = NULL;
+    prompt_cap = 0;
     if(prefix != NULL) {
         ui_clear_prefix();
     }
 }
 
-char *prompt_line(void)
+/**
+ * Rebuilds the part of the prompt after the command number, which only
+ * changes with the working directory.
+ */
+static void prompt_tail_build(void)
 {
-    const char *status_val = prompt_status() ? bad_str : good_str;
-
-    char cmd_num[25];
-    snprintf(cmd_num, 25, "%u", prompt_cmd_num());
-
-    char *user = prompt_username();
-    char *host = prompt_hostname();
-    char *cwd = prompt_cwd();
-
-    char *format_str = ">>-[%s]-[%s]-[%s@%s:%s]-> ";
-
-    size_t prompt_sz
-        = strlen(format_str)
-        + strlen(status_val)
-        + strlen(cmd_num)
-        + strlen(user)
-        + strlen(host)
-        + strlen(cwd)
-        + 1;
+    const char *user = prompt_username();
+    const char *host = prompt_hostname();
+    const char *cwd = prompt_cwd();
+
+    size_t tail_sz = strlen(user) + strlen(host) + strlen(cwd) + sizeof("]-[@:]-> ");
+    free(prompt_tail);
+    prompt_tail = malloc(tail_sz);
+    prompt_tail_len = snprintf(prompt_tail, tail_sz, "]-[%s@%s:%s]-> ", user, host, cwd);
+}
 
-    char *prompt_str =  malloc(sizeof(char) * prompt_sz);
+/**
+ * Renders the prompt. Only the status and command number are written for
+ * each prompt; the user, host and working directory are kept from the last
+ * one until cd changes the directory.
+ *
+ * @return the prompt, in a buffer that is reused by the next call
+ */
+const char *prompt_line(void)
+{
+    if(prompt_tail == NULL) {
+        prompt_tail_build();
+    }
 
-    snprintf(prompt_str, prompt_sz, format_str,
-            status_val,
-            cmd_num,
-            user,
-            host,
-            cwd);
+    const char *status_val = prompt_status() ? bad_str : good_str;
+    size_t status_len = strlen(status_val);
+
+    /* Command number, written backwards from the end of cmd_num */
+    char cmd_num[16];
+    char *num = cmd_num + sizeof(cmd_num);
+    unsigned int n = prompt_cmd_num();
+    do {
+        *--num = '0' + n % 10;
+        n /= 10;
+    } while(n != 0);
+    size_t num_len = cmd_num + sizeof(cmd_num) - num;
+
+    size_t prompt_sz = sizeof(">>-[]-[") - 1 + status_len + num_len + prompt_tail_len + 1;
+    if(prompt_sz > prompt_cap) {
+        prompt_cap = prompt_sz * 2;
+        prompt_buf = realloc(prompt_buf, prompt_cap);
+    }
 
-    free(cwd);
-    free(host);
-    return prompt_str;
+    char *out = prompt_buf;
+    memcpy(out, ">>-[", 4);
+    out += 4;
+    memcpy(out, status_val, status_len);
+    out += status_len;
+    memcpy(out, "]-[", 3);
+    out += 3;
+    memcpy(out, num, num_len);
+    out += num_len;
+    memcpy(out, prompt_tail, prompt_tail_len + 1);
+    return prompt_buf;
 }
 
-char *prompt_username(void)
+/**
+ * Gives the user name for the prompt, looked up once.
+ */
+const char *prompt_username(void)
 {
-    return getenv("USER");
+    if(user_name == NULL) {
+        user_name = getenv("USER");
+        if(user_name == NULL) {
+            struct passwd *pw = getpwuid(getuid());
+            user_name = pw != NULL ? strdup(pw->pw_name) : "?";
+        }
+    }
+    return user_name;
 }
 
-char *prompt_hostname(void)
+/**
+ * Gives the host name for the prompt, looked up once.
+ */
+const char *prompt_hostname(void)
 {
-    char *name = malloc(HOST_NAME_MAX * sizeof(char));
-    gethostname(name, HOST_NAME_MAX);
-    return name;
+    if(host_name[0] == '\0') {
+        if(gethostname(host_name, sizeof(host_name) - 1) != 0) {
+            strcpy(host_name, "?");
+        }
+        host_name[sizeof(host_name) - 1] = '\0';
+    }
+    return host_name;
 }
 
-char *prompt_cwd(void)
+/**
+ * Looks up the home directory that '~' stands for, once.
+ */
+static void home_init(void)
 {
-    char *cwd = getcwd(NULL, 0);
-
-    if(home_size == 0) {
+    if(home == NULL) {
         home = getenv("HOME");
+        if(home == NULL) {
+            home = "";
+        }
         home_size = strlen(home);
     }
+}
 
-    if(strncmp(home, cwd, home_size) == 0) {
-        int new_size = strlen(cwd) - home_size;
-        if(new_size == 0) {
-            char *new_cwd = malloc(2 * sizeof(char));
-            new_cwd[0] = '~';
-            new_cwd[1] = '\0';
-            return new_cwd;
-        } else {
-            char *new_cwd = malloc((new_size + 2) * sizeof(char));
-            new_cwd[0] = '~';
-            int new_ind = 1;
-            for(int i = home_size; i < strlen(cwd); i++) {
-                new_cwd[new_ind++] = cwd[i];
-            }
-            new_cwd[new_size + 1] = '\0';
-            return new_cwd;
-        }
+/**
+ * Gives the working directory for the prompt, with the home directory shown
+ * as '~'. It is only looked up again after prompt_cwd_changed().
+ */
+const char *prompt_cwd(void)
+{
+    if(cwd_str != NULL) {
+        return cwd_str;
+    }
+
+    char *cwd = getcwd(NULL, 0);
+    if(cwd == NULL) {
+        cwd = strdup("?");
     }
-    return cwd;
+    home_init();
+
+    size_t cwd_len = strlen(cwd);
+    if(home_size > 0 && strncmp(home, cwd, home_size) == 0
+            && (cwd[home_size] == '\0' || cwd[home_size] == '/')) {
+        /* "~" takes the place of the home directory, so this fits */
+        cwd[0] = '~';
+        memmove(cwd + 1, cwd + home_size, cwd_len - home_size + 1);
+    }
+    cwd_str = cwd;
+    return cwd_str;
+}
+
+/**
+ * Tells the prompt the working directory changed.
+ */
+void prompt_cwd_changed(void)
+{
+    free(cwd_str);
+    cwd_str = NULL;
+    free(prompt_tail);
+    prompt_tail = NULL;
 }
 
 int prompt_status(void)
@@ -153,12 +252,14 @@ unsigned int prompt_cmd_num(void)
 
 char *read_command(void)
 {
-    char *prompt = NULL;
-    char *command = NULL;
-
-    prompt = prompt_line();
-    command = readline(prompt);
-    free(prompt);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const char *prompt = prompt_line();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    LOG("Prompt rendered in %ld ns\n",
+            (end.tv_sec - start.tv_sec) * 1000000000L + end.tv_nsec - start.tv_nsec);
+
+    char *command = readline(prompt);
     return command == NULL
         ? ""
         : command;
@@ -168,10 +269,12 @@ int readline_init(void)
 {
     rl_bind_keyseq("\\e[A", key_up);
     rl_bind_keyseq("\\e[B", key_down);
+    rl_bind_keyseq("\\C-r", key_search);
     rl_variable_bind("show-all-if-ambiguous", "on");
     rl_variable_bind("colored-completion-prefix", "on");
     rl_attempted_completion_function = command_completion;
     rl_getc_function = getc;
+    rl_event_hook = reap_hook;
     return 0;
 }
 
@@ -179,6 +282,11 @@ int key_up(int count, int key)
 {
     const char *output_str = NULL;
 
+    /* Other sessions' commands are picked up before moving off the line */
+    if(hist_track_cnum() == -1) {
+        hist_sync();
+    }
+
     //LOG("Current value of val is %s\n", hist_track_val());
     const char *track_val = hist_track_val();
     if(track_val == NULL) {
@@ -275,19 +383,110 @@ int key_down(int count, int key)
     return 0;
 }
 
+/**
+ * Reverse incremental search through the history. Every character typed
+ * refines the query and the line shows its best match; Ctrl-R moves on to the
+ * next best one and Ctrl-G gives the original line back. Any other key keeps
+ * the match on the line and then does what it normally does, so Enter runs it
+ * and the arrow keys continue through the history from it.
+ */
+int key_search(int count, int key)
+{
+    char query[SEARCH_QUERY_MAX] = "";
+    size_t query_sz = 0;
+    unsigned int matches = 0;
+    unsigned int rank = 0;
+    unsigned int cnum = 0;
+    bool cancelled = false;
+    char *original = strdup(rl_line_buffer);
+
+    rl_save_prompt();
+    while(true) {
+        const char *found = search_result(rank, &cnum);
+        if(found != NULL) {
+            rl_replace_line(found, 1);
+            rl_point = rl_end;
+        }
+        rl_message("(%sreverse-i-search)`%s': ",
+                query_sz > 0 && matches == 0 ? "failed " : "", query);
+        rl_redisplay();
+
+        int c = rl_read_key();
+        if(c == CTRL('R')) {
+            if(rank + 1 < matches) {
+                rank++;
+            } else {
+                rl_ding();
+            }
+        } else if(c == CTRL('G')) {
+            cancelled = true;
+            break;
+        } else if(c == RUBOUT || c == CTRL('H')) {
+            if(query_sz > 0) {
+                query[--query_sz] = '\0';
+                matches = search_query(query);
+                rank = 0;
+            }
+        } else if(isprint(c) && query_sz + 1 < SEARCH_QUERY_MAX) {
+            query[query_sz++] = c;
+            query[query_sz] = '\0';
+            matches = search_query(query);
+            rank = 0;
+        } else {
+            rl_execute_next(c);
+            break;
+        }
+    }
+    rl_restore_prompt();
+    rl_clear_message();
+
+    if(cancelled) {
+        rl_replace_line(original, 1);
+        rl_point = rl_end;
+    } else if(matches > 0) {
+        ui_clear_prefix();
+        hist_search_cnum(cnum);
+    }
+    search_done();
+    free(original);
+    return 0;
+}
+
 void ui_clear_prefix()
 {
     free(prefix);
     prefix = NULL;
 }
 
-char **command_completion(const char *text, int start, int end)
+/**
+ * Tells whether the word starting at start is in command position: first on
+ * the line, or right after a pipe or '&'.
+ */
+static bool command_position(int start)
 {
-    /* Tell readline that if we don't find a suitable completion, it should fall
-     * back on its built-in filename completion. */
-    rl_attempted_completion_over = 0;
+    int i = start - 1;
+    while(i >= 0 && isblank((unsigned char) rl_line_buffer[i])) {
+        i--;
+    }
+    return i < 0 || rl_line_buffer[i] == '|' || rl_line_buffer[i] == '&';
+}
 
-    return rl_completion_matches(text, command_generator);
+char **command_completion(const char *text, int start, int end)
+{
+    /* File names come from the directory cache rather than readline's own
+     * filename completion, which reads the directory on every Tab. */
+    rl_attempted_completion_over = 1;
+
+    /* Arguments and paths are file names, and so are commands until the
+     * command index is ready */
+    if(command_position(start) && strchr(text, '/') == NULL && pathindex_refresh()) {
+        char **matches = rl_completion_matches(text, command_generator);
+        if(matches != NULL) {
+            return matches;
+        }
+    }
+    rl_filename_completion_desired = 1;
+    return rl_completion_matches(text, path_generator);
 }
 
 
@@ -295,43 +494,61 @@ char **command_completion(const char *text, int start, int end)
  * This function is called repeatedly by the readline library to build a list of
  * possible completions. It returns one match per function call. Once there are
  * no more completions available, it returns NULL.
+ *
+ * The matches are the builtins and PATH commands starting with text, looked
+ * up in the command index command_completion() refreshed when state is 0.
  */
 char *command_generator(const char *text, int state)
 {
-    // TODO: find potential matching completions for 'text.' If you need to
-    // initialize any data structures, state will be set to '0' the first time
-    // this function is called. You will likely need to maintain static/global
-    // variables to track where you are in the search so that you don't start
-    // over from the beginning.
-    //if(state == 0) {
-    //    char *path = getenv("PATH");
-
-    //    if(path_complete != NULL) {
-    //        free(path_complete);
-    //        path_complete = NULL;
-    //    }
-
-    //    path_size = tok_str(path, &path_complete, PATH_DELIM, false);
-    //    LOG("I at least made it this far!%s\n", "");
-    //}
-
-    //for(int i = 0; i < path_size; i++) {
-    //    LOG("%s\n", path_complete[i]);
-    //}
-    //char *output = NULL;
-    //DIR *dir;
-    //struct dirent *direntry;
-    //for(int i = 0; i < path_size; i++) {
-    //    dir = opendir(path_complete[path_ind]);
-    //    while((direntry = readdir(dir)) != NULL) {
-    //        if(strcmp(text, direntry->d_name) == 0) {
-    //            path_ind = i;
-    //            closedir(direntry);
-    //            return direntry->d_name;
-    //        }
-    //    }
-    //    closedir(direntry);
-    //}
+    if(state == 0) {
+        gen_matches = pathindex_match(text, &gen_count);
+        gen_next = 0;
+    }
+
+    if(gen_next < gen_count) {
+        return strdup(gen_matches[gen_next++]);
+    }
+    return NULL;
+}
+
+/**
+ * Generates file name completions for readline, one per call like
+ * command_generator().
+ *
+ * The word is split after its last '/': the names in that directory starting
+ * with the rest are looked up in the directory cache when state is 0. A
+ * leading "~/" is the home directory, as in the prompt, and stays in the
+ * matches as it was typed.
+ */
+char *path_generator(const char *text, int state)
+{
+    if(state == 0) {
+        const char *slash = strrchr(text, '/');
+        size_t dir_len = slash != NULL ? (size_t) (slash - text) + 1 : 0;
+        free(gen_dir);
+        gen_dir = strndup(text, dir_len);
+
+        char *expanded = NULL;
+        if(text[0] == '~' && text[1] == '/') {
+            home_init();
+            expanded = malloc(home_size + dir_len);
+            memcpy(expanded, home, home_size);
+            memcpy(expanded + home_size, gen_dir + 1, dir_len);
+        }
+        gen_matches = dircache_match(expanded != NULL ? expanded : gen_dir,
+                text + dir_len, &gen_count);
+        free(expanded);
+        gen_next = 0;
+    }
 
+    if(gen_next < gen_count) {
+        const char *name = gen_matches[gen_next++];
+        size_t dir_len = strlen(gen_dir);
+        size_t name_len = strlen(name);
+        char *match = malloc(dir_len + name_len + 1);
+        memcpy(match, gen_dir, dir_len);
+        memcpy(match + dir_len, name, name_len + 1);
+        return match;
+    }
     return NULL;
 }
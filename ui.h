@@ -11,10 +11,11 @@
 void init_ui(void);
 void destroy_ui(void);
 
-char *prompt_line(void);
-char *prompt_username(void);
-char *prompt_hostname(void);
-char *prompt_cwd(void);
+const char *prompt_line(void);
+const char *prompt_username(void);
+const char *prompt_hostname(void);
+const char *prompt_cwd(void);
+void prompt_cwd_changed(void);
 int prompt_status(void);
 void good_status(void);
 void bad_status(void);
@@ -24,9 +25,11 @@ char *read_command(void);
 
 int key_up(int count, int key);
 int key_down(int count, int key);
+int key_search(int count, int key);
 
 void ui_clear_prefix();
 char **command_completion(const char *text, int start, int end);
 char *command_generator(const char *text, int state);
+char *path_generator(const char *text, int state);
 
 #endif
@@ -1,12 +1,44 @@
+#define _GNU_SOURCE
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/param.h>
+#include <sys/stat.h>
 
 #include "util.h"
 
+/* Size of each block read by the buffered line reader */
+#define READER_BLOCK 65536
+/* Max number of file descriptors that can hold a buffered reader at once */
+#define READER_MAX 8
+
+/* How a buffered reader is allowed to read ahead of the current line */
+enum reader_mode {
+    READ_SEEK,  /* Regular file: read whole blocks, lseek back on sync */
+    READ_PEEK,  /* Pipe: peek blocks with tee(), consume only full lines */
+    READ_BYTE,  /* Anything else: one byte at a time, never read ahead */
+};
+
+/* Per-fd state for buf_lineread() */
+struct line_reader {
+    int fd;
+    enum reader_mode mode;
+    char *buf;
+    size_t cap;
+    size_t start;   /* First byte not yet handed out as a line */
+    size_t end;     /* One past the last byte held in buf */
+    size_t peeked;  /* Bytes at the end of buf still sitting in the pipe */
+    off_t handed_back;  /* Offset READ_SEEK seeked back to on sync, or -1 */
+    int peek[2];    /* Private pipe used by READ_PEEK */
+};
+
+static struct line_reader *readers[READER_MAX] = { NULL };
+
 /**
  * Reads from a line of a file into a limited sized buffer.
  *
@@ -77,103 +109,274 @@ char *dynamic_lineread(int fd) {
 }
 
 /**
- * Retrieves the next token from a string.
+ * Finds the buffered reader attached to a file descriptor.
  *
- * @param str_ptr current pointer to string
- * @param delim the delimiters to consider
- * @return token generated
+ * @param fd file descriptor to look up
+ * @param create whether to set up a new reader if none exists
+ * @return the reader, or NULL if none exists (or could be created)
  */
-char *next_token(char **str_ptr, const char *delim) {
-    if (*str_ptr == NULL) {
+static struct line_reader *get_reader(int fd, bool create) {
+    int free_slot = -1;
+    for(int i = 0; i < READER_MAX; i++) {
+        if(readers[i] != NULL && readers[i]->fd == fd) {
+            return readers[i];
+        } else if(readers[i] == NULL && free_slot == -1) {
+            free_slot = i;
+        }
+    }
+    if(!create || free_slot == -1) {
         return NULL;
     }
 
-    size_t tok_start = strspn(*str_ptr, delim);
-    size_t tok_end = strcspn(*str_ptr + tok_start, delim);
-
-    /* Zero length token. We must be finished. */
-    if (tok_end  == 0) {
-        *str_ptr = NULL;
+    struct line_reader *rd = malloc(sizeof(struct line_reader));
+    if(rd == NULL) {
+        return NULL;
+    }
+    rd->fd = fd;
+    rd->cap = READER_BLOCK;
+    rd->start = 0;
+    rd->end = 0;
+    rd->peeked = 0;
+    rd->handed_back = -1;
+    rd->peek[0] = -1;
+    rd->peek[1] = -1;
+    rd->buf = malloc(rd->cap);
+    if(rd->buf == NULL) {
+        free(rd);
         return NULL;
     }
 
-    /* Take note of the start of the current token. We'll return it later. */
-    char *current_ptr = *str_ptr + tok_start;
+    /* Only read ahead when the extra bytes can be handed back later */
+    struct stat st;
+    rd->mode = READ_BYTE;
+    if(fstat(fd, &st) == 0) {
+        if(S_ISREG(st.st_mode) && lseek(fd, 0, SEEK_CUR) != -1) {
+            rd->mode = READ_SEEK;
+        }
+#ifdef __linux__
+        else if(S_ISFIFO(st.st_mode) && pipe2(rd->peek, O_CLOEXEC) == 0) {
+            rd->mode = READ_PEEK;
+        }
+#endif
+    }
 
-    /* Shift pointer forward (to the end of the current token) */
-    *str_ptr += tok_start + tok_end;
+    readers[free_slot] = rd;
+    return rd;
+}
 
-    if (**str_ptr == '\0') {
-        /* If the end of the current token is also the end of the string, we
-         * must be at the last token. */
-        *str_ptr = NULL;
-    } else {
-        /* Replace the matching delimiter with a NUL character to terminate the
-         * token string. */
-        **str_ptr = '\0';
+/**
+ * Removes bytes that were peeked from a READ_PEEK pipe, so that the pipe
+ * position catches up with the reader.
+ *
+ * @param rd reader to update
+ * @param sz amount of bytes to remove from the pipe
+ * @param dst where to read the bytes to, or NULL to throw them away
+ * @return 0 on success, -1 on error
+ */
+static int reader_consume(struct line_reader *rd, size_t sz, char *dst) {
+    char scratch[4096];
+    while(sz > 0) {
+        size_t want = sz;
+        char *to = dst;
+        if(to == NULL) {
+            to = scratch;
+            want = MIN(want, sizeof(scratch));
+        }
+        ssize_t read_sz = read(rd->fd, to, want);
+        if(read_sz <= 0) {
+            return -1;
+        }
+        if(dst != NULL) {
+            dst += read_sz;
+        }
+        sz -= read_sz;
+        rd->peeked -= read_sz;
+    }
+    return 0;
+}
+
+/**
+ * Pulls more input into a reader's buffer, making room by shifting the
+ * pending partial line to the front or by growing the buffer.
+ *
+ * @param rd reader to fill
+ * @return amount of bytes added, 0 on end of file or -1 on error
+ */
+static ssize_t reader_fill(struct line_reader *rd) {
+    if(rd->peeked > 0) {
+        /* Every peeked byte has been scanned by now. Lines handed out before
+         * this call are no longer in use, so the copies still sitting in the
+         * buffer can simply be read over with the same data. */
+        if(reader_consume(rd, rd->peeked, rd->buf + rd->end - rd->peeked) == -1) {
+            return -1;
+        }
+    }
+
+    if(rd->end == rd->cap) {
+        if(rd->start > 0) {
+            memmove(rd->buf, rd->buf + rd->start, rd->end - rd->start);
+            rd->end -= rd->start;
+            rd->start = 0;
+        } else {
+            char *tmp_buf = realloc(rd->buf, rd->cap * 2);
+            if(tmp_buf == NULL) {
+                return -1;
+            }
+            rd->buf = tmp_buf;
+            rd->cap *= 2;
+        }
+    }
 
-        /* Shift forward one character over the newly-placed NUL so that
-         * next_pointer now points at the first character of the next token. */
-        (*str_ptr)++;
+    size_t room = rd->cap - rd->end;
+    ssize_t read_sz;
+    switch(rd->mode) {
+        case READ_SEEK:
+            read_sz = read(rd->fd, rd->buf + rd->end, room);
+            break;
+#ifdef __linux__
+        case READ_PEEK:
+            /* Copy what is in the pipe without taking it out of the pipe */
+            read_sz = tee(rd->fd, rd->peek[1], room, 0);
+            if(read_sz == -1 && errno == EINVAL) {
+                /* Not a real pipe after all, stop peeking */
+                rd->mode = READ_BYTE;
+                return reader_fill(rd);
+            }
+            if(read_sz > 0) {
+                read_sz = read(rd->peek[0], rd->buf + rd->end, read_sz);
+                rd->peeked = read_sz > 0 ? read_sz : 0;
+            }
+            break;
+#endif
+        default:
+            read_sz = read(rd->fd, rd->buf + rd->end, 1);
+            break;
     }
 
-    return current_ptr;
+    if(read_sz > 0) {
+        rd->end += read_sz;
+    }
+    return read_sz;
 }
 
 /**
- * Resizes array using addition or multiplication as specified.
+ * Takes back the read-ahead of a READ_SEEK reader that buf_lineread_sync()
+ * handed back. If nobody moved the file offset since, the buffered bytes are
+ * still what comes next and the offset is moved past them again; otherwise a
+ * child read some of the input, and reading goes on from where it stopped.
  *
- * @param arr array to be resized
- * @param arr_sz current size of the array
- * @param oper int val representing operation for resizing
- * @param val value to resize array by
- * @return the updated array size
+ * @param rd reader to update
  */
-int resize_arr(char **arr[], int arr_sz, int oper, int val) {
-    switch(oper) {
-	case 0:
-	    arr_sz += val;
-	    break;
-	case 1:
-	    arr_sz *= val;
-	    break;
-    }
-    *arr = (char **)realloc(*arr, arr_sz * sizeof(char *));
-    return arr_sz;
+static void reader_reclaim(struct line_reader *rd) {
+    if(lseek(rd->fd, 0, SEEK_CUR) != rd->handed_back
+            || lseek(rd->fd, rd->end - rd->start, SEEK_CUR) == -1) {
+        rd->end = rd->start;
+    }
+    rd->handed_back = -1;
 }
 
-/** Tokenizes a string based on passed delimiters. Has extra functionality
- * to check if the line is a C lang comment, and ignores the line.
+/**
+ * Reads the next line from a file descriptor using a per-fd block buffer.
+ * The returned line has its newline stripped and points into the reader's
+ * buffer, so it stays valid (and may be modified in place) only until the next
+ * call for the same fd. A final line without a newline is still returned.
  *
- * @param str entry string to be tokenized
- * @param buf buffer array that will store all resulting tokens
- * @param delim string containing delimiters to adhere to
- * @param comments boolean if tokenizing should ignore C lang comment lines
- * @return the total number of tokens from string (excluding NULL terminator)
+ * @param fd file to be read from
+ * @param len if not NULL, receives the length of the line
+ * @return the line, or NULL on end of file or error
  */
-int tok_str(char *str, char **buf[], char *delim, bool comments) {
-    char *str_iter = str;
-    char *curr_tok = NULL;
-    int arr_sz = 1;
-    int i = 0;
-
-    *buf = (char **) malloc(sizeof(char *));
-    while((curr_tok = next_token(&str_iter, delim)) != NULL) {
-        if(comments && strncmp("#", curr_tok, 1) == 0) {
+char *buf_lineread(int fd, size_t *len) {
+    struct line_reader *rd = get_reader(fd, true);
+    if(rd == NULL) {
+        return NULL;
+    }
+    if(rd->handed_back != -1) {
+        reader_reclaim(rd);
+    }
+
+    /* Bytes past rd->start that are already known to hold no newline */
+    size_t scanned = 0;
+    char *newline = NULL;
+    while((newline = memchr(rd->buf + rd->start + scanned, '\n',
+                    rd->end - rd->start - scanned)) == NULL) {
+        scanned = rd->end - rd->start;
+
+        ssize_t read_sz = reader_fill(rd);
+        if(read_sz == -1) {
+            return NULL;
+        } else if(read_sz == 0) {
+            if(rd->start == rd->end) {
+                return NULL;
+            }
+            /* Unterminated last line. The buffer always keeps a spare byte
+             * for the NUL, growing before a read if it has to. */
+            if(rd->end == rd->cap && reader_fill(rd) == -1) {
+                return NULL;
+            }
+            newline = rd->buf + rd->end;
             break;
-        } else {
-            if(i == arr_sz) {
-                arr_sz = resize_arr(buf, arr_sz, 1, 2);
-	    }
-            (*buf)[i] = curr_tok;
-            i++;
         }
     }
 
-    /* If the array is completely filled, add space for NULL terminator */
-    if(i == arr_sz) {
-        resize_arr(buf, arr_sz, 0, 1);
+    char *line = rd->buf + rd->start;
+    size_t line_end = newline - rd->buf;
+    *newline = '\0';
+    if(len != NULL) {
+        *len = line_end - rd->start;
+    }
+    rd->start = MIN(line_end + 1, rd->end);
+    return line;
+}
+
+/**
+ * Hands any bytes read ahead by buf_lineread() back to the file descriptor,
+ * so that a child process inheriting it starts reading right after the last
+ * line returned. Lines already returned stay valid. A regular file keeps its
+ * buffer, which the next buf_lineread() goes on with unless a child moved the
+ * offset in the meantime, so commands that don't read their input cost no
+ * more than two lseek() calls.
+ *
+ * @param fd file descriptor to synchronize
+ */
+void buf_lineread_sync(int fd) {
+    struct line_reader *rd = get_reader(fd, false);
+    if(rd == NULL) {
+        return;
+    }
+
+    size_t ahead = rd->end - rd->start;
+    if(rd->mode == READ_SEEK) {
+        if(ahead > 0 && rd->handed_back == -1) {
+            rd->handed_back = lseek(fd, -(off_t) ahead, SEEK_CUR);
+        }
+        if(rd->handed_back != -1) {
+            return;
+        }
+    } else if(rd->mode == READ_PEEK && rd->peeked > ahead) {
+        /* Take the lines already handed out out of the pipe, but leave the
+         * read-ahead in it. The scratch copy keeps those lines intact. */
+        reader_consume(rd, rd->peeked - ahead, NULL);
+    }
+    rd->peeked = 0;
+    rd->end = rd->start;
+}
+
+/**
+ * Frees the buffered reader attached to a file descriptor, if there is one.
+ *
+ * @param fd file descriptor whose reader is released
+ */
+void buf_lineread_close(int fd) {
+    for(int i = 0; i < READER_MAX; i++) {
+        if(readers[i] != NULL && readers[i]->fd == fd) {
+            buf_lineread_sync(fd);
+            if(readers[i]->peek[0] != -1) {
+                close(readers[i]->peek[0]);
+                close(readers[i]->peek[1]);
+            }
+            free(readers[i]->buf);
+            free(readers[i]);
+            readers[i] = NULL;
+        }
     }
-    (*buf)[i] = NULL;
-    return i;
 }
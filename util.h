@@ -6,8 +6,9 @@
 
 ssize_t lineread(int fd, char *buf, size_t sz);
 char *dynamic_lineread(int fd);
-char *next_token(char **str_ptr, const char *delim);
-int tok_str(char *str, char **buf[], char *delim, bool comments);
+char *buf_lineread(int fd, size_t *len);
+void buf_lineread_sync(int fd);
+void buf_lineread_close(int fd);
 char *str_to_lower(char *str);
 char *str_to_upper(char *str);
 // void  str_to_lower(char *str);